@@ -3,18 +3,102 @@
 #include <string.h>
 #include <time.h>
 #include <ctype.h>
+#include <limits.h>
+#include <stddef.h>
 
 #ifdef _WIN32
 #include <windows.h>
+#include <io.h>
 #ifndef ENABLE_VIRTUAL_TERMINAL_PROCESSING
 #define ENABLE_VIRTUAL_TERMINAL_PROCESSING 0x0004
 #endif
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <pthread.h>
 #endif
 
-#define MAX_EXPENSES 1000
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define TEXT_SCAN_X86  // SSE2 and AVX2 text scan and AVX2 amount kernels, picked at run time
+#endif
+
+#define EXPENSE_CHUNK_SIZE 4096  // records per chunk; chunks never move once allocated
+#define DESCRIPTION_BLOCK_SIZE (1 << 20)  // bytes per description arena block
+#define COMPACTION_THRESHOLD 4096  // dead slots and stale index entries tolerated before compacting
+#define DATE_PAGE_DAYS 512  // days per date index page
+#define FIRST_INDEXED_DAY (-719162)  // 0001-01-01, counted in days from 1970-01-01
+#define LAST_INDEXED_DAY 2932896  // 9999-12-31
+#define DATE_PAGE_COUNT ((LAST_INDEXED_DAY - FIRST_INDEXED_DAY) / DATE_PAGE_DAYS + 1)
+#define DAY_WINDOW_MIN_DAYS 4096  // smallest window of days the range total trees cover
+#define MAX_SEARCH_TERMS 16
+#define TEXT_SCAN_BATCH 256  // matching slots handed out per call of a text scan
+#define MAX_SCAN_THREADS 64
+#define PARALLEL_MIN_ROWS 65536  // smaller stores are scanned on the calling thread alone
 #define MAX_CATEGORY_LENGTH 50
 #define MAX_DESCRIPTION_LENGTH 100
+#define MONEY_SCALE 100  // paisa per taka; amounts are kept as whole paisa
+#define MONEY_TEXT_SIZE 24  // bytes format_money() may write, NUL included
+#define AMOUNT_TEXT_SIZE (MONEY_TEXT_SIZE + 4)  // bytes format_amount() may write, NUL included
+#define MAX_MONEY_DIGITS 15  // digits of whole taka an amount may have
+#define BASE_CURRENCY "BDT"  // currency of amounts that name none; totals are kept in it
+#define BASE_CURRENCY_SYMBOL "TK"  // how the base currency is shown
+#define MAX_CURRENCIES 256  // currency ids fit the one-byte currency column
+#define RATE_SCALE 1000000  // exchange rates are kept in millionths
+#define MAX_RATE_DIGITS 6  // digits of whole base currency a rate may have
+#define RATE_FILE_SUFFIX ".rates"  // appended to the data file's name
 #define FILENAME "expenses.dat"
+#define DATA_FILE_MAGIC "EXPCOLS"  // first 8 bytes (with the NUL) of column data files
+#define DATA_FILE_VERSION 5
+#define DATA_FILE_HEADER_SIZE 128
+#define DATA_FILE_CRC_BLOCK 65536  // bytes covered by each CRC-32 in a data file
+#define ID_TRAILER_TAG "NXID"  // precedes the saved next id after the records
+#define SEQUENCE_TRAILER_TAG "JSEQ"  // precedes the checkpoint sequence after the records
+#define ROLLUP_FILE_SUFFIX ".rollups"  // appended to the data file's name
+#define ROLLUP_FILE_MAGIC "EXPROLL"  // first 8 bytes (with the NUL) of rollup files
+#define ROLLUP_FILE_VERSION 3
+#define ROLLUP_HEADER_SIZE 32
+#define ROLLUP_CELL_SIZE 24
+#define MONTH_COUNT (9999 * 12)  // months from 0001-01 to 9999-12
+#define BUDGET_FILE_SUFFIX ".budgets"  // appended to the data file's name
+#define BUDGET_WARNING_PERCENT 80  // share of a budget whose crossing draws the first alert
+#define SOCKET_FILE_SUFFIX ".sock"  // appended to the data file's name
+#define SERVER_REQUEST_MAX 8192  // bytes of arguments one request may carry
+#define LOAD_TEST_SECONDS 1.0  // how long each round of the server benchmark runs
+#define LOAD_MIXED 1    // load-test client sending reads and one add in ten
+#define LOAD_ADDS 2     // sending adds only
+#define LOAD_EXPORTS 3  // exporting every expense, over and over
+#define SYNTHETIC_CATEGORY_COUNT 12  // named categories of synthetic ledgers
+#define JOURNAL_FILENAME "expenses.log"
+#define JOURNAL_TAG "EXJ3"
+#define SINGLE_CURRENCY_JOURNAL_TAG "EXJ2"  // journals whose records have no currency
+#define LEGACY_JOURNAL_TAG "EXPJ"  // journals whose records hold float amounts
+#define JOURNAL_CHECKPOINT_ENTRIES 10000  // journal entries tolerated before folding them into the data file
+#define JOURNAL_ADD 1
+#define JOURNAL_MODIFY 2
+#define JOURNAL_DELETE 3
+#define BATCH_COMMIT_COMMANDS 1000  // batch commands between journal syncs
+#define MAX_COMMAND_ARGS 32
+#define IMPORT_BUFFER_SIZE (1 << 20)  // bytes read from an import file at a time; the longest line
+#define IMPORT_MAX_FIELDS 64
+#define IMPORT_REPORTED_ROWS 100  // rejected rows reported one by one
+#define EXPORT_BUFFER_SIZE (1 << 20)  // bytes of output gathered before each write
+#define EXPORT_RECORD_MAX 2048  // most bytes one formatted record can take, escapes and all
+#define FORMAT_CSV 1
+#define FORMAT_JSON_LINES 2
+#define FORMAT_TSV 3  // query output: tab-separated and unquoted
+#define SORT_NONE 0      // the order the query's index gives
+#define SORT_DATE 1
+#define SORT_AMOUNT 2
+#define SORT_CATEGORY 3  // by category name, ignoring case
 
 // Simple color codes for text only
 #define COLOR_RESET "\033[0m"
@@ -26,16 +110,628 @@
 #define COLOR_CYAN "\033[96m"
 #define COLOR_WHITE "\033[97m"
 
+// An amount of money in paisa, so that amounts and their totals are exact
+typedef long long Money;
+
+// A single expense record. The store keeps records column-wise; this struct
+// is used to read and write whole records.
 typedef struct {
     int id;
     char date[11];  // YYYY-MM-DD
-    float amount;
+    Money amount;
+    char currency[4];  // three-letter code; empty or BASE_CURRENCY for the base currency
     char category[MAX_CATEGORY_LENGTH];
     char description[MAX_DESCRIPTION_LENGTH];
 } Expense;
 
-Expense expenses[MAX_EXPENSES];
-int expense_count = 0;
+// The record of journals written before amounts had a currency
+typedef struct {
+    int id;
+    char date[11];
+    Money amount;
+    char category[MAX_CATEGORY_LENGTH];
+    char description[MAX_DESCRIPTION_LENGTH];
+} SingleCurrencyExpense;
+
+// The original on-disk record layout, with the amount in taka as a float.
+// Also the record in journals written before amounts were exact.
+typedef struct {
+    int id;
+    char date[11];
+    float amount;
+    char category[MAX_CATEGORY_LENGTH];
+    char description[MAX_DESCRIPTION_LENGTH];
+} LegacyExpense;
+
+// One chunk of the expense store, laid out as separate columns so that scans
+// only pull in the fields they actually read. Each column holds
+// EXPENSE_CHUNK_SIZE entries, either allocated along with the chunk or, for a
+// store loaded from a column data file, inside the mapped file.
+typedef struct {
+    int *ids;
+    int *dates;                  // days since 1970-01-01
+    Money *amounts;
+    int *categories;             // index into category_names
+    unsigned int *descriptions;  // offset into the description arena
+    unsigned char *currencies;   // index into currency_list
+    unsigned char *deleted;      // tombstone, set until the next compaction
+} ExpenseChunk;
+
+// Header of a column data file, decoded. On disk every field is little-endian
+// at a fixed position (see encode_header()). The header is followed by one
+// column of little-endian values per field (ids, dates, amounts, categories,
+// description offsets and currencies; amounts are 64-bit, currencies 8-bit,
+// the rest 32-bit; version 3 files hold amounts as 32-bit floats, and files
+// before version 5 have no currency column), the category names and then
+// the currency codes as NUL-terminated strings, the description text in
+// arena blocks, and a CRC-32 of every DATA_FILE_CRC_BLOCK bytes from the
+// first column to the end of the text.
+// Columns are stored whole, so the full chunks of a loaded store point
+// straight into the mapped file. Offsets count from the start of the file.
+typedef struct {
+    int version;
+    int count;  // records; all are live
+    int next_id;
+    int checkpoint_sequence;
+    int category_count;
+    int currency_count;
+    int description_blocks;
+    long long column_offsets[5];  // the currency column's place follows from its count
+    long long names_offset;
+    long long text_offset;
+    long long crc_offset;
+    long long file_size;
+    unsigned int crc_table_crc;
+} DataFileHeader;
+
+// Writes the sections of a data file in order, keeping a CRC-32 of every
+// DATA_FILE_CRC_BLOCK bytes
+typedef struct {
+    FILE *file;
+    long long position;  // bytes written after the header
+    unsigned int crc;    // of the unfinished block
+    unsigned int *crcs;  // of the finished blocks
+    int crc_count;
+    int crc_capacity;
+    int failed;
+} DataWriter;
+
+// A list of store slots. Slots are appended as they come and the list is
+// sorted (and de-duplicated) lazily, the next time it is read. Entries may be
+// stale: readers check that the slot is live and still has the list's key.
+typedef struct {
+    int *slots;
+    int count;
+    int capacity;
+    int unsorted;
+} SlotList;
+
+// Expense store: a directory of fixed-size chunks. Growing the directory only
+// moves chunk pointers, so record addresses stay stable and appends are
+// amortized O(1). Deleting only marks a tombstone; compaction later squeezes
+// out dead slots and stale index entries once enough have piled up.
+ExpenseChunk **expense_chunks = NULL;
+int chunk_count = 0;
+int chunk_capacity = 0;
+int slot_count = 0;     // slots in use, including deleted ones
+int expense_count = 0;  // live expenses
+int garbage_count = 0;  // deleted slots plus stale index entries
+
+// A store loaded from a column data file reads its columns and description
+// text from a private mapping of the file; pages are read in as queries touch
+// them and copied only when written. The indexes are then built on first use.
+char *data_map = NULL;
+size_t data_map_size = 0;
+unsigned char *mapped_tombstones = NULL;  // tombstone column of the mapped chunks
+int indexes_ready = 1;
+
+// ID index: open-addressing hash table from expense id to slot
+typedef struct {
+    int id;    // 0 marks a free bucket
+    int slot;
+} IdBucket;
+
+IdBucket *id_table = NULL;
+int id_table_size = 0;
+int id_table_used = 0;
+
+// ID allocator: ids only grow and are never handed out twice, even after a
+// delete. The high-water mark is saved with the data.
+int next_expense_id = 1;
+
+// File the expenses are loaded from and saved to
+const char *data_path = FILENAME;
+
+// Journal: every add, modify and delete is appended to the journal as it
+// happens and synced once per action, so a crash loses nothing committed. A
+// checkpoint folds the journal into the data file. The journal header and the
+// data file both carry the checkpoint sequence, so a journal that was already
+// folded in is never replayed.
+typedef struct {
+    int op;
+    Expense expense;
+    unsigned int checksum;  // over op and expense; catches a torn last entry
+} JournalEntry;
+
+// An entry of a journal written before amounts were exact
+typedef struct {
+    int op;
+    LegacyExpense expense;
+    unsigned int checksum;
+} LegacyJournalEntry;
+
+// An entry of a journal written before amounts had a currency
+typedef struct {
+    int op;
+    SingleCurrencyExpense expense;
+    unsigned int checksum;
+} SingleCurrencyJournalEntry;
+
+FILE *journal_file = NULL;
+const char *journal_path = JOURNAL_FILENAME;
+int checkpoint_sequence = 0;
+int journal_entries = 0;  // entries since the last checkpoint
+int journal_pending = 0;  // entries written but not yet synced
+
+// Command mode: set when running commands from the command line or stdin.
+// Nothing prompts or pauses, and messages go to stderr without colors so
+// that stdout carries only results.
+int batch_mode = 0;
+int batch_line = 0;  // stdin line being run by a batch, for messages
+
+// Category dictionary: distinct names (compared without case, spelled as
+// first entered), referenced by id from the category column. A hash table
+// maps names to ids, and each id keeps the sorted slots that use it.
+char (*category_names)[MAX_CATEGORY_LENGTH] = NULL;
+SlotList *category_slots = NULL;
+int category_count = 0;
+int category_capacity = 0;
+int *category_table = NULL;  // open addressing, -1 marks a free bucket
+int category_table_size = 0;
+
+// Currencies: each record's amount is in the currency it names, the base
+// currency (id 0) unless it names another. Codes are kept in a list like the
+// category names, ids in the order first seen. Each currency has its
+// exchange rates, read at load from a text file next to the data file, as
+// what one unit was worth in the base currency from a date on. A month
+// converts at the last rate dated on or before its last day (months before
+// the first rate at the first month's), and as the rates are loaded a cache
+// of that rate for every month they span is built, so a conversion is one
+// array read. Statistics and range totals add up amounts converted to the
+// base currency a record at a time; the rollups keep each currency apart
+// and convert a cell's total at once, so a report in any currency never
+// looks up a rate per record.
+typedef struct {
+    int day;
+    long long rate;  // base currency per unit, in RATE_SCALE parts
+} ExchangeRate;
+
+typedef struct {
+    char code[4];
+    ExchangeRate *rates;  // in date order, one per date
+    int rate_count;
+    int rate_capacity;
+    long long *month_rates;  // conversion cache: the rate of each month from first_month on
+    int first_month;
+    int month_count;
+} Currency;
+
+Currency *currency_list = NULL;
+int currency_count = 0;
+int currency_capacity = 0;
+
+// Description text, packed as NUL-terminated strings into fixed-size blocks
+char **description_blocks = NULL;
+int description_block_count = 0;
+int description_block_capacity = 0;
+int description_block_used = 0;
+int description_mapped_blocks = 0;  // leading blocks that live in the data file mapping
+size_t description_mapped_used = 0;  // bytes of text in the last mapped block
+
+// Date index: for every day, the slots of the expenses on that day in
+// ascending order. Days are grouped into pages that are only allocated once
+// they hold an expense, so a range query walks the days it covers rather than
+// the whole store.
+SlotList *date_pages[DATE_PAGE_COUNT];
+
+// Statistics aggregates: the total of the live amounts, a total and count
+// per category, and heaps of (amount, slot) with the highest and the lowest
+// expense on top. One scan builds them the first time the statistics are
+// asked for; after that every add, modify and delete keeps them current. A
+// modify or delete leaves the old heap entries behind, to be dropped when
+// they reach the top; compaction renumbers slots, so it rebuilds them.
+typedef struct {
+    Money amount;
+    int slot;
+} HeapEntry;
+
+typedef struct {
+    HeapEntry *entries;
+    int count;
+    int capacity;
+    int highest;  // 1 for the highest amount on top, 0 for the lowest
+} AmountHeap;
+
+typedef struct {
+    Money total;
+    int count;
+} CategoryTotal;
+
+int aggregates_ready = 0;
+Money amount_total = 0;
+CategoryTotal *category_totals = NULL;  // by category id, alongside category_slots
+AmountHeap highest_amounts = {NULL, 0, 0, 1};
+AmountHeap lowest_amounts = {NULL, 0, 0, 0};
+
+// Monthly rollups: the total and count of the live expenses in each month,
+// category and currency, in an open-addressing table keyed by all three,
+// with months counted as year * 12 + month - 1. Every add, modify and delete
+// adjusts one or two cells. A checkpoint saves the cells next to the data
+// file, tagged with its checkpoint sequence, and loading reads them back
+// before replaying the journal, so period reports never read the records.
+// Without a matching saved copy one scan of the date, amount and category
+// columns rebuilds them.
+typedef struct {
+    int month;
+    int category;  // -1 marks a free bucket
+    int currency;
+    int count;
+    Money total;   // in the cell's currency
+} RollupCell;
+
+RollupCell *rollup_table = NULL;
+int rollup_table_size = 0;
+int rollup_table_used = 0;
+int rollups_ready = 0;
+Money *month_totals = NULL;  // each month's total over every category, from 0001-01; built for an overall budget
+
+// Budgets: monthly limits on a category's spending or on all of it, kept in
+// a text file next to the data file. A change that takes a month's total
+// for a budget to BUDGET_WARNING_PERCENT of it or over it draws an alert;
+// the totals come from the rollup cell and the running month total, so the
+// check costs the same however large the ledger is.
+typedef struct {
+    char category[MAX_CATEGORY_LENGTH];  // empty for the overall budget
+    Money limit;
+    Money warning;  // BUDGET_WARNING_PERCENT of the limit
+} Budget;
+
+Budget *budgets = NULL;
+int budget_count = 0;
+int overall_budget = -1;          // index of the overall budget, -1 if none
+int *category_budgets = NULL;     // budget index by category id, -1 if none
+int budgeted_categories = 0;      // category ids category_budgets covers
+long long budget_alerts = 0;      // alerts raised since budget_alert_quota was set
+long long budget_alert_quota = -1;  // alerts shown before the rest are only counted, -1 for all
+
+// Range totals: Fenwick trees (binary indexed trees) of the amounts and
+// counts of the live expenses by day, over a window of days around their
+// dates. Tree 0 covers every category; the tree of category k, at k + 1, is
+// only built once a total for that category is asked for. A total between
+// two dates is the difference of two prefix sums, and an add, modify or
+// delete updates a tree, both in O(log days). A date outside the window
+// drops the trees, to be rebuilt over a wider window when next needed.
+typedef struct {
+    Money *sums;  // NULL until the tree is built
+    int *counts;
+} DayTree;
+
+DayTree *day_trees = NULL;
+int day_tree_capacity = 0;
+int day_window_first = 0;  // day number of the first day in the window
+int day_window_size = 0;   // days in the window, a power of two
+int day_trees_ready = 0;
+
+// Text index: every distinct word (a run of letters and digits, lowercased)
+// used in a description, with the slots of the records using it. Lists are
+// appended to as records are added or described anew and may go stale;
+// searches check the hits on changed records (restated_slots) against the
+// record, so a stale entry costs a check but never gives a wrong result.
+// Category names are few enough to be matched directly. Built on first
+// search and rebuilt by compaction.
+typedef struct {
+    char *text;
+    SlotList slots;
+} IndexTerm;
+
+IndexTerm *index_terms = NULL;
+int index_term_count = 0;
+int index_term_capacity = 0;
+int *index_term_table = NULL;  // open addressing, -1 marks a free bucket
+int index_term_table_size = 0;
+int *index_term_order = NULL;  // word ids sorted by text, for prefix searches
+int index_term_sorted = 0;     // words in index_term_order
+int text_index_ready = 0;
+// Slots whose description or category changed since the last compaction.
+// Only these can have stale word or category entries, so only their search
+// hits need checking against the record.
+SlotList restated_slots = {NULL, 0, 0, 0};
+
+// A parsed search: terms of the same group must all match, and any one
+// group matching is enough
+typedef struct {
+    char text[MAX_DESCRIPTION_LENGTH];
+    int prefix;  // matches any word starting with `text`
+    int group;
+} SearchTerm;
+
+typedef struct {
+    SearchTerm terms[MAX_SEARCH_TERMS];
+    int count;
+    int groups;
+} SearchQuery;
+
+// Text scan: substring searches, ignoring case, for what the text index
+// cannot find, such as text inside a word. The arena is scanned block by
+// block with the widest kernel the processor has, marking the strings that
+// contain the needle; records are then matched by their string's offset.
+typedef struct {
+    char text[MAX_DESCRIPTION_LENGTH];  // lowercased
+    size_t length;
+} FoldedNeedle;
+
+typedef struct {
+    FoldedNeedle needle;
+    unsigned char *matched;  // bit per arena offset, set where a matching string starts
+    char *category_hits;     // by category id
+    int next_slot;
+} TextScan;
+
+const char *(*find_folded)(const char *text, size_t length, const FoldedNeedle *needle) = NULL;
+const char *text_kernel_name = NULL;
+
+// Amount kernels: the count, total, highest and lowest of the amounts of a
+// chunk's live records dated from..to, optionally in one category, in one
+// pass over the columns. The AVX2 kernel works on four rows at a time,
+// turning the date, category and tombstone tests into a lane mask; the
+// scalar one is the reference it is checked against.
+typedef struct {
+    int from;      // day numbers
+    int to;
+    int category;  // -1 for any
+} AmountFilter;
+
+typedef struct {
+    int count;
+    Money total;
+    Money highest;
+    Money lowest;
+    int highest_row;  // first row with the highest amount, -1 if none matched
+    int lowest_row;   // first row with the lowest amount, -1 if none matched
+} AmountSummary;
+
+void (*summarize_amounts)(const ExpenseChunk *chunk, int rows, const AmountFilter *filter, AmountSummary *summary) = NULL;
+const char *amount_kernel_name = NULL;
+
+// One line of a period report; `key` orders lines by period, then by
+// category name
+typedef struct {
+    long long key;
+    int period;
+    int month;
+    int category;
+    int currency;  // of the cell the line was made from, until lines are merged
+    int count;
+    Money total;
+} ReportRow;
+
+// What a query or export selects: expenses dated from..to (day numbers) in
+// the named category (NULL for any) whose description or category contains
+// `search`, ignoring case, and has the words `match` asks for (NULL for
+// any; see parse_search()). `category` is the name's id once looked up.
+typedef struct {
+    int from;
+    int to;
+    int by_date;  // a date bound was given
+    const char *category_name;
+    int category;
+    const char *search;
+    const char *match;
+    FoldedNeedle needle;  // `search` lowercased, set by select_expenses()
+} QueryFilter;
+
+// How a query orders and pages what it selects: by `key` (a SORT_ value),
+// ties in slot order, at most `limit` rows (0 for all) coming after the
+// expense with ID `after` (0 to start at the first). Paging through with
+// the last ID printed is stable while expenses are added or deleted.
+typedef struct {
+    int key;
+    int descending;
+    int limit;
+    int after;
+} ResultOrder;
+
+// A selected row as an ordered query places it: its sort key, negated for
+// a descending order, then its slot
+typedef struct {
+    long long key;
+    int slot;
+} ResultRow;
+
+// The rows an ordered query keeps: the `limit` first after the cursor as a
+// heap with the last of them on top, or with no limit all of them
+typedef struct {
+    const QueryFilter *filter;
+    const ResultOrder *order;
+    const int *ranks;      // each category's place by name, for SORT_CATEGORY
+    int has_cursor;
+    ResultRow cursor;
+    ResultRow *rows;
+    int count;
+    int capacity;
+    int failed;            // memory ran out
+} ResultSet;
+
+// Called with each slot a filter selects; returns 0 to stop the walk
+typedef int (*SlotVisitor)(void *context, int slot);
+
+// Parallel scans: a full scan is split into items (chunks of the store or
+// blocks of the description arena) that a pool of worker threads, started
+// on first use, and the calling thread take one at a time from a shared
+// counter, so a thread that finishes early takes on more. Each item writes
+// a partial result of its own or adds to its thread's, and the parts are
+// merged in item or thread order afterwards. Amounts are integers, so the
+// results are the same however the items were shared out.
+typedef void (*ScanTask)(void *context, int item, int thread);
+
+typedef struct {
+    ScanTask task;
+    void *context;
+    int items;
+    int next_item;  // next item to hand out
+    int threads;    // threads taking part, numbered from 0 (the caller)
+} ScanJob;
+
+#ifdef _WIN32
+typedef CONDITION_VARIABLE ScanSignal;
+SRWLOCK scan_lock = SRWLOCK_INIT;
+ScanSignal scan_wake = CONDITION_VARIABLE_INIT;  // a job was posted
+ScanSignal scan_done = CONDITION_VARIABLE_INIT;  // a worker checked in or finished a job
+#else
+typedef pthread_cond_t ScanSignal;
+pthread_mutex_t scan_lock = PTHREAD_MUTEX_INITIALIZER;
+ScanSignal scan_wake = PTHREAD_COND_INITIALIZER;
+ScanSignal scan_done = PTHREAD_COND_INITIALIZER;
+#endif
+
+ScanJob scan_job;
+unsigned int scan_generation = 0;  // bumped for every job posted to the workers
+int scan_threads = 0;        // threads a scan may use, the caller included; 0 until first needed
+int scan_workers = 0;        // worker threads started
+int scan_workers_ready = 0;  // workers waiting for jobs
+int scan_workers_busy = 0;   // workers yet to finish the current job
+
+// What a scan adds up for the records a filter selects
+typedef struct {
+    int count;
+    Money total;
+    int highest;  // slot of the first record with the highest amount, -1 if none
+    int lowest;   // slot of the first record with the lowest amount, -1 if none
+    CategoryTotal *categories;  // category_count totals, by category id; filled in if not NULL
+} ScanTotals;
+
+// State shared by the chunks of a filtered scan
+typedef struct {
+    const QueryFilter *filter;  // without its search, which `text` has done
+    const TextScan *text;       // NULL without a search
+    ScanTotals *chunks;         // each chunk's part, categories left out
+    CategoryTotal *categories;  // each thread's category totals, `stride` apart
+    int stride;
+    int with_categories;        // category totals are wanted
+} FilterScan;
+
+// State shared by the chunks of an aggregate rebuild
+typedef struct {
+    CategoryTotal *categories;  // each thread's category totals, `stride` apart
+    int stride;
+    int *live;  // heap entries each chunk put in place
+} AggregateScan;
+
+// Output gathered in a large buffer and written out a buffer at a time.
+// Records are formatted straight into it.
+typedef struct {
+    FILE *file;
+    char *data;  // EXPORT_BUFFER_SIZE bytes
+    size_t used;
+    int failed;  // a write failed
+} OutputBuffer;
+
+// Where the unordered walk of a query writes
+typedef struct {
+    OutputBuffer *out;
+    int format;
+    int start;  // first slot to write
+    int left;   // rows still to write, or -1 for no limit
+} RecordWriter;
+
+// Reads a file a buffer at a time and hands out its lines in place
+typedef struct {
+    FILE *file;
+    char *buffer;    // IMPORT_BUFFER_SIZE bytes and room for a terminator
+    size_t start;    // first byte not handed out yet
+    size_t end;      // end of the bytes read
+    int eof;
+    int overlong;    // the line being read did not fit and is being skipped
+    long long bytes; // read so far
+} LineReader;
+
+// Counts kept by an import
+typedef struct {
+    long long rows;  // data rows, not counting blank lines and a CSV header
+    long long imported;
+    long long rejected;
+    long long bytes;
+} ImportStats;
+
+// Server: `expense --serve` holds the store in memory and runs the commands
+// sent to a Unix domain socket next to the data file, and command mode sends
+// its command there rather than loading the store whenever a server is
+// listening, so several people and scripts can work on one ledger at once.
+// Changes run one at a time in the server itself, each synced to the journal
+// before it is answered. Every other command runs in a child forked for it,
+// which reads a copy-on-write snapshot of the store as it stood between two
+// changes: a long report or export neither waits for changes nor holds them
+// up, and sees none of those made while it runs. A request passes the
+// client's stdout and stderr (and a copy of its stdin, for an import from
+// it) as descriptors, so output goes straight to the client; the reply is
+// the command's exit status in one byte.
+#ifndef _WIN32
+typedef struct {
+    int length;  // bytes of arguments that follow, each NUL-terminated
+    int line;    // batch line the command came from, 0 if none
+} RequestHeader;
+
+typedef struct {
+    int socket;
+    char *request;   // sizeof(RequestHeader) + SERVER_REQUEST_MAX bytes
+    int received;    // bytes of it read so far
+    int files[3];    // the client's stdout, stderr and, if passed, stdin
+    int file_count;
+} ServerClient;
+
+ServerClient *server_clients = NULL;
+struct pollfd *server_polls = NULL;  // the wake pipe, the socket, then the clients
+int server_client_count = 0;
+int server_client_capacity = 0;
+int server_socket = -1;
+int server_wake[2] = {-1, -1};  // written to by the signal that stops the server
+int server_null = -1;  // /dev/null, the stdin of commands not given one
+volatile sig_atomic_t server_stopping = 0;
+
+// A load-test client of the server benchmark, with the latency of every
+// request it sent
+typedef struct {
+    int mode;            // LOAD_MIXED, LOAD_ADDS or LOAD_EXPORTS
+    unsigned int state;  // for synthetic_random()
+    double until;
+    int output;          // where the server writes what the commands print
+    double *reads;       // seconds per request, and per add below
+    int read_count;
+    int read_capacity;
+    double *adds;
+    int add_count;
+    int add_capacity;
+    Money added;         // total of the amounts added
+    int failures;
+} LoadClient;
+#endif
+
+// The shape of the ledgers the benchmark suite generates
+typedef struct {
+    int categories;   // the first SYNTHETIC_CATEGORY_COUNT have everyday names
+    int skew;         // category shares fall off as 1 / rank^skew; 0 spreads them evenly
+    int first_year;
+    int years;        // the dates run from first_year to the end of first_year + years - 1
+    int recent;       // dates grow denser towards the end rather than spreading evenly
+    unsigned int seed;
+    double *shares;   // cumulative share of each category, the last one 1
+} LedgerShape;
+
+// Category names of the synthetic ledgers
+const char *synthetic_categories[] = {
+    "Groceries", "Transportation", "Entertainment", "Rent", "Utilities", "Dining",
+    "Health", "Shopping", "Education", "Travel", "Insurance", "Gifts"
+};
 
 // Function prototypes
 void enable_colors();
@@ -52,9 +748,377 @@ void modify_expense();
 void show_statistics();
 void save_to_file();
 void load_from_file();
+int read_data_file();
 int validate_date(const char *date);
 void get_current_date(char *buffer);
 void clear_input_buffer();
+void read_rest_of_line(char *buffer, size_t size);
+
+// Expense store
+ExpenseChunk *chunk_of(int index);
+ExpenseChunk *allocate_chunk();
+int chunk_rows(int chunk);
+int reserve_expenses(int count);
+int append_expense(const Expense *expense);
+int write_expense(int index, const Expense *expense);
+void read_expense(int index, Expense *expense);
+void remove_expense_at(int index);
+int find_expense_by_id(int id);
+int require_indexes();
+int allocate_expense_id();
+int renumber_duplicate_ids();
+int slot_is_live(int slot);
+void compact_if_needed();
+int compact_expenses();
+void free_expenses();
+int intern_category(const char *name);
+int find_category(const char *name);
+unsigned int category_hash(const char *name);
+int grow_category_table();
+int store_description(const char *text, unsigned int *offset);
+const char *description_text(unsigned int offset);
+int parse_date(const char *date, int *day);
+int days_from_civil(int year, int month, int day);
+void format_date(int day, char *buffer);
+void civil_from_days(int day, int *year, int *month, int *day_of_month);
+int parse_money(const char *text, Money *amount);
+char *format_money(Money amount, char *buffer);
+char *format_amount(Money amount, int currency, char *buffer);
+Money money_from_float(float amount);
+Money rounded_average(Money total, int count);
+void print_expense_row(const ExpenseChunk *chunk, int row);
+
+// Journal
+int journal_record(int op, const Expense *expense);
+int journal_commit();
+int journal_reset();
+void journal_close();
+int journal_resume(int entries);
+int replay_journal(int *intact);
+int read_journal_entry(FILE *file, int version, JournalEntry *entry);
+unsigned int journal_checksum(const void *entry, size_t length);
+int checkpoint_data();
+int sync_file(FILE *file);
+
+// Data files
+int save_data_file(const char *path, int sequence);
+int write_data_file(FILE *file, int sequence);
+void data_write(DataWriter *writer, const void *bytes, size_t length);
+void data_finish_block(DataWriter *writer);
+void data_write_words(DataWriter *writer, unsigned int *words, int count);
+void data_write_longs(DataWriter *writer, unsigned long long *longs, int count);
+int write_legacy_file(FILE *file, int sequence);
+unsigned int pack_description(size_t length, int *block, size_t *used);
+int read_legacy_file(FILE *file);
+void expense_from_legacy(const LegacyExpense *old, Expense *expense);
+void expense_to_legacy(const Expense *expense, LegacyExpense *old);
+int map_data_file();
+int check_data_file(const char *map, size_t size, DataFileHeader *header);
+int data_column_width(int version, int column);
+long long data_column_offset(int version, int column, long long count);
+void quarantine_data_file();
+int convert_data_file(int argc, char *argv[]);
+char *map_file(const char *path, size_t *size);
+void unmap_file(char *map, size_t size);
+void encode_header(const DataFileHeader *header, unsigned char *bytes);
+int decode_header(const unsigned char *bytes, DataFileHeader *header);
+unsigned int crc32(unsigned int crc, const void *bytes, size_t length);
+void put_le32(unsigned char *bytes, unsigned int value);
+void put_le64(unsigned char *bytes, long long value);
+unsigned int get_le32(const unsigned char *bytes);
+long long get_le64(const unsigned char *bytes);
+int host_is_little_endian();
+void swap_words(unsigned int *words, long long count);
+void swap_longs(unsigned long long *longs, long long count);
+
+// Date index
+SlotList *date_index_list(int day, int create);
+int date_index_add(int day, int slot);
+int rebuild_indexes();
+void free_date_index();
+int slot_list_add(SlotList *list, int slot);
+void slot_list_sort(SlotList *list);
+int compare_slots(const void *a, const void *b);
+
+// Id index
+unsigned int id_hash(int id);
+int id_index_put(int id, int slot);
+int id_index_get(int id);
+void id_index_remove(int id);
+
+// Statistics aggregates
+int require_aggregates();
+int rebuild_aggregates();
+void aggregate_expense(int slot, int sign);
+void aggregate_amount(int slot);
+void free_aggregates();
+int heap_reserve(AmountHeap *heap, int count);
+int heap_top(AmountHeap *heap);
+void heap_sift_up(AmountHeap *heap, int index);
+void heap_sift_down(AmountHeap *heap, int index);
+int heap_before(const AmountHeap *heap, const HeapEntry *a, const HeapEntry *b);
+
+// Monthly rollups
+int require_rollups();
+int rebuild_rollups();
+void rollup_expense(int slot, int sign);
+RollupCell *rollup_cell(int month, int category, int currency);
+RollupCell *find_rollup_cell(int month, int category, int currency);
+Money rollup_total(int month, int category);
+int grow_rollup_table();
+unsigned int rollup_hash(int month, int category, int currency);
+void free_rollups();
+int month_of_day(int day);
+int load_rollups();
+int save_rollups(int sequence);
+void rollup_file_path(char *path, size_t size);
+void remove_rollup_file();
+int require_month_totals();
+Money *month_total(int month);
+int collect_report(int from, int to, int by_year, int category, int currency, ReportRow **rows);
+int compare_report_rows(const void *a, const void *b);
+int compare_category_names(const void *a, const void *b);
+
+// Currencies
+int intern_currency(const char *code);
+int find_currency(const char *code);
+const char *currency_code(int currency);
+const char *currency_symbol(const char *code);
+int parse_currency(const char *text, char *code);
+int parse_amount(const char *text, Money *amount, char *currency);
+int currency_has_rates(const char *code);
+int check_currency(const char *code);
+long long month_rate(int currency, int month);
+Money convert_amount(Money amount, int from, int to, int month);
+Money scale_money(Money amount, long long multiply, long long divide);
+Money base_amount(const ExpenseChunk *chunk, int row);
+Money slot_base_amount(int slot);
+Money expense_base_amount(const Expense *expense);
+Money cell_total_in(const RollupCell *cell, int currency);
+int chunk_in_base_currency(const ExpenseChunk *chunk, int rows);
+int load_rates();
+int add_rate(int currency, int day, long long rate);
+int build_rate_cache(int currency);
+int parse_rate(const char *text, long long *rate);
+void rate_file_path(char *path, size_t size);
+void free_currencies();
+
+// Budgets
+int load_budgets();
+int save_budgets();
+void budget_file_path(char *path, size_t size);
+int set_budget(const char *category, Money limit);
+int clear_budget(const char *category);
+int find_budget(const char *category);
+int category_budget(int category);
+void check_budgets(const Expense *expense, const Expense *old);
+void check_budget(int index, int month, Money total, Money added);
+void free_budgets();
+
+// Range totals
+DayTree *require_day_tree(int category);
+int fit_day_window();
+int build_day_tree(DayTree *tree, int category);
+void day_tree_update(int slot, int sign);
+void day_tree_add(DayTree *tree, int position, Money amount, int count);
+void day_range_total(const DayTree *tree, int from, int to, Money *total, int *count);
+void free_day_trees();
+
+// Text index
+int require_text_index();
+int rebuild_text_index();
+int index_description(int slot);
+int next_token(const char **cursor, char *token, size_t size);
+int intern_index_term(const char *token);
+int find_index_term(const char *token);
+int grow_index_term_table();
+unsigned int text_hash(const char *text);
+int sort_index_terms();
+int compare_index_terms(const void *a, const void *b);
+void free_text_index();
+int parse_search(const char *text, SearchQuery *query);
+int search_slots(const SearchQuery *query, int **slots);
+int term_slots(const SearchTerm *term, int **slots);
+int merge_slots(const int *a, int a_count, const int *b, int b_count, int *out, int intersect);
+int record_matches_search(const SearchQuery *query, const ExpenseChunk *chunk, int row);
+int text_has_term(const char *text, const SearchTerm *term);
+int count_tokens(const char *text);
+int search_by_scan(const char *search_term, Money *total);
+
+// Text scan
+size_t description_block_extent(int block);
+unsigned char fold_byte(unsigned char c);
+void fold_needle(const char *text, FoldedNeedle *needle);
+int folded_equal(const char *text, const char *folded, size_t length);
+int text_contains(const char *text, const FoldedNeedle *needle);
+const char *find_folded_scalar(const char *text, size_t length, const FoldedNeedle *needle);
+#ifdef TEXT_SCAN_X86
+const char *find_folded_sse2(const char *text, size_t length, const FoldedNeedle *needle);
+const char *find_folded_avx2(const char *text, size_t length, const FoldedNeedle *needle);
+#endif
+void choose_text_kernel();
+int begin_text_scan(TextScan *scan, const char *text);
+void scan_text_block(void *context, int block, int thread);
+int next_text_matches(TextScan *scan, int *slots, int capacity);
+int text_scan_hit(const TextScan *scan, const ExpenseChunk *chunk, int row);
+void end_text_scan(TextScan *scan);
+
+// Amount kernels
+void summarize_amounts_scalar(const ExpenseChunk *chunk, int rows, const AmountFilter *filter, AmountSummary *summary);
+#ifdef TEXT_SCAN_X86
+void summarize_amounts_avx2(const ExpenseChunk *chunk, int rows, const AmountFilter *filter, AmountSummary *summary);
+#endif
+void choose_amount_kernel();
+void add_amount(AmountSummary *summary, Money amount, int row);
+
+// Parallel scans
+int scan_thread_count();
+int scan_threads_for(int items);
+int start_scan_workers(int count);
+void run_parallel(int items, int threads, ScanTask task, void *context);
+void run_scan_items(int thread);
+void run_scan_worker(int thread);
+void lock_scan_pool();
+void unlock_scan_pool();
+void wait_scan_signal(ScanSignal *signal);
+void raise_scan_signal(ScanSignal *signal);
+#ifndef _WIN32
+void reset_scan_pool();
+#endif
+int category_stride();
+int scan_totals(const QueryFilter *filter, ScanTotals *totals);
+void total_chunk(void *context, int chunk, int thread);
+void aggregate_chunk(void *context, int chunk, int thread);
+void heapify_amounts(int threads);
+void heapify_subtree(void *context, int item, int thread);
+#ifdef _WIN32
+DWORD WINAPI scan_worker_main(LPVOID thread);
+#else
+void *scan_worker_main(void *thread);
+#endif
+
+// Command mode
+int run_command(int argc, char *argv[]);
+int run_batch(int server);
+int execute_command(int argc, char *argv[]);
+int command_add(int argc, char *argv[]);
+int command_modify(int argc, char *argv[]);
+int command_delete(int argc, char *argv[]);
+int command_query(int argc, char *argv[]);
+int command_stats(int argc, char *argv[]);
+int command_report(int argc, char *argv[]);
+int parse_month(const char *text, int last, int *month);
+int command_total(int argc, char *argv[]);
+int command_budget(int argc, char *argv[]);
+void print_command_usage(FILE *stream);
+int split_command_line(char *line, char *args[], int max_args);
+int set_expense_field(Expense *expense, const char *field, const char *value);
+int find_command_expense(const char *text);
+int parse_query_option(QueryFilter *filter, const char *option, const char *value);
+int select_expenses(QueryFilter *filter, const ResultOrder *order, OutputBuffer *out, int format);
+int visit_expenses(const QueryFilter *filter, int start, SlotVisitor visit, void *context);
+int write_visited(void *context, int slot);
+int query_matches(const QueryFilter *filter, const ExpenseChunk *chunk, int row);
+void print_command_message(const char *kind, const char *text);
+
+// Result sets
+int parse_order_option(ResultOrder *order, const char *option, const char *value);
+int select_ordered(const QueryFilter *filter, const ResultOrder *order, int cursor_slot, OutputBuffer *out, int format);
+int write_by_date(const QueryFilter *filter, const ResultOrder *order, int cursor_slot, OutputBuffer *out, int format);
+ResultRow result_row(const ResultSet *set, int slot);
+int result_before(const ResultRow *a, const ResultRow *b);
+int keep_result(void *context, int slot);
+void result_sift_down(ResultRow *rows, int count, int index);
+int compare_result_rows(const void *a, const void *b);
+
+// Import
+int command_import(int argc, char *argv[]);
+int import_expenses(FILE *file, const char *name, int format, int max_reports, ImportStats *stats);
+const char *import_row(char *text[5], int *failed);
+void copy_truncated(char *field, size_t size, const char *text);
+int format_by_name(const char *name);
+char *read_line(LineReader *reader, int *overlong);
+int split_csv_line(char *line, char *fields[], int max_fields);
+int read_csv_header(char *fields[], int count, int columns[5]);
+const char *parse_json_expense(char *line, char *text[5]);
+char *parse_json_string(char **cursor);
+int skip_json_value(char **cursor);
+int parse_hex4(const char *text, unsigned int *code);
+int put_utf8(unsigned int code, char *out);
+
+// Export
+int command_export(int argc, char *argv[]);
+int output_open(OutputBuffer *out, FILE *file);
+int output_close(OutputBuffer *out);
+void output_flush(OutputBuffer *out);
+void output_text(OutputBuffer *out, const char *text);
+void write_record(OutputBuffer *out, int format, const ExpenseChunk *chunk, int row);
+char *put_text(char *p, const char *text);
+char *put_integer(char *p, int value);
+char *put_amount(char *p, Money amount);
+char *put_csv_field(char *p, const char *text);
+char *put_json_string(char *p, const char *text);
+
+// Server
+int run_server();
+int connect_server();
+int send_request(int server, int argc, char *argv[], int output);
+void socket_file_path(char *path, size_t size);
+#ifndef _WIN32
+int socket_address(const char *path, struct sockaddr_un *address);
+void accept_client();
+int receive_request(ServerClient *client);
+void serve_request(ServerClient *client);
+int run_client_command(ServerClient *client, int argc, char *argv[], int line, int change);
+void close_client(ServerClient *client);
+void close_other_clients(const ServerClient *client);
+void stop_server(int signal);
+#endif
+int command_changes_store(int argc, char *argv[]);
+void warm_store();
+
+// Benchmarks
+int run_benchmark(int argc, char *argv[]);
+int bench_layout(int rows);
+int bench_date_range(int rows);
+int bench_delete(int rows);
+int bench_ids(int operations);
+int bench_journal(int rows);
+int bench_startup(int rows);
+int bench_import(int rows);
+int bench_export(int rows);
+int bench_stats(int rows);
+int check_aggregates(int scan_only);
+int bench_report(int rows);
+int bench_search(int rows);
+int bench_scan(int rows);
+int bench_parallel(int rows);
+int bench_amounts(int rows);
+int bench_results(int rows);
+int bench_currency(int rows);
+int compare_currency_report(int from, int to, int currency, double *seconds);
+int bench_server(int rows);
+#ifndef _WIN32
+double run_load_test(LoadClient *clients, int count);
+void *run_load_client(void *context);
+int add_latency(double **values, int *count, int *capacity, double seconds);
+int merge_latencies(LoadClient *clients, int count, int adds, double **values);
+double percentile(const double *sorted, int count, int percent);
+int compare_seconds(const void *a, const void *b);
+#endif
+int bench_suite(int rows, int argc, char *argv[]);
+int run_suite(const LedgerShape *shape, int rows, int format, FILE *sink);
+int suite_query(QueryFilter *filter, FILE *sink);
+void print_suite_result(const LedgerShape *shape, int rows, int format, const char *operation, int count, double seconds);
+int output_matches(FILE *a, FILE *b);
+void summarize_store(void (*kernel)(const ExpenseChunk *, int, const AmountFilter *, AmountSummary *),
+                     const AmountFilter *filter, AmountSummary *summary);
+int check_rollups();
+unsigned int store_fingerprint();
+double now_seconds();
+void generate_synthetic_expense(int id, unsigned int *state, Expense *expense);
+void generate_shaped_expense(const LedgerShape *shape, int id, unsigned int *state, Expense *expense);
+unsigned int synthetic_random(unsigned int *state);
 
 // Display functions
 void print_success(const char *text);
@@ -62,10 +1126,35 @@ void print_error(const char *text);
 void print_warning(const char *text);
 void print_info(const char *text);
 
-int main() {
+int main(int argc, char *argv[]) {
     int choice;
     
+    if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+        return run_benchmark(argc - 2, argv + 2);
+    }
+    if (argc > 1 && strcmp(argv[1], "--convert") == 0) {
+        return convert_data_file(argc - 2, argv + 2);
+    }
+    if (argc > 1 && strcmp(argv[1], "--serve") == 0) {
+        if (argc == 2) return run_server();
+        fprintf(stderr, "Usage: expense --serve\n");
+        return 1;
+    }
+    if (argc > 1 && strncmp(argv[1], "--", 2) != 0) {
+        return run_command(argc - 1, argv + 1);
+    }
+    
     enable_colors();
+    
+    // The menu works on a copy of the store of its own, and saving it would
+    // undo the server's changes
+    int server = connect_server();
+    if (server >= 0) {
+        close(server);
+        print_error("A server is running on this ledger! Use commands while it runs.");
+        return 1;
+    }
+    
     clear_screen();
     
     // Welcome banner
@@ -146,6 +1235,8 @@ int main() {
                 printf("     %sThank you for using Expense Tracker! Goodbye!%s                    \n", COLOR_GREEN, COLOR_RESET);
                 printf("                                                                              \n");
                 printf("==============================================================================\n\n");
+                journal_close();
+                free_expenses();
                 exit(0);
             default:
                 print_error("Invalid choice! Please enter a number between 1-9.");
@@ -174,14 +1265,13 @@ void display_menu() {
 }
 
 void add_expense() {
-    if (expense_count >= MAX_EXPENSES) {
-        print_error("Expense tracker is full! Cannot add more expenses.");
+    Expense new_expense;
+    new_expense.id = allocate_expense_id();
+    if (new_expense.id == 0) {
+        print_error("No expense IDs left! Cannot add more expenses.");
         return;
     }
     
-    Expense new_expense;
-    new_expense.id = expense_count + 1;
-    
     // Get date
     while (1) {
         printf("%sEnter date (YYYY-MM-DD) or 'today' for current date:%s ", COLOR_CYAN, COLOR_RESET);
@@ -199,20 +1289,22 @@ void add_expense() {
         }
     }
     
-    // Get amount
+    // Get amount, and the currency after it if it is not the base one. The
+    // whole line is read, so the category prompt need not clear it.
     while (1) {
-        printf("%sEnter amount:%s ", COLOR_CYAN, COLOR_RESET);
-        if (scanf("%f", &new_expense.amount) == 1 && new_expense.amount > 0) {
-            break;
-        } else {
+        printf("%sEnter amount (add a currency code if not in %s):%s ", COLOR_CYAN, BASE_CURRENCY_SYMBOL, COLOR_RESET);
+        char amount_input[64] = "";
+        scanf("%31s", amount_input);
+        read_rest_of_line(amount_input, sizeof(amount_input));
+        if (!parse_amount(amount_input, &new_expense.amount, new_expense.currency)) {
             print_error("Invalid amount! Please enter a positive number.");
-            clear_input_buffer();
+        } else if (check_currency(new_expense.currency)) {
+            break;
         }
     }
     
     // Get category
     printf("%sEnter category:%s ", COLOR_CYAN, COLOR_RESET);
-    clear_input_buffer();
     fgets(new_expense.category, MAX_CATEGORY_LENGTH, stdin);
     new_expense.category[strcspn(new_expense.category, "\n")] = 0;
     
@@ -221,13 +1313,18 @@ void add_expense() {
     fgets(new_expense.description, MAX_DESCRIPTION_LENGTH, stdin);
     new_expense.description[strcspn(new_expense.description, "\n")] = 0;
     
-    expenses[expense_count] = new_expense;
-    expense_count++;
+    if (!append_expense(&new_expense)) {
+        print_error("Out of memory! Cannot add more expenses.");
+        return;
+    }
+    journal_record(JOURNAL_ADD, &new_expense);
+    journal_commit();
     
     printf("\n==============================================================================\n");
     printf("  %sSUCCESS! Expense added successfully!%s\n", COLOR_GREEN, COLOR_RESET);
     printf("  %sExpense ID: %d%s\n", COLOR_YELLOW, new_expense.id, COLOR_RESET);
     printf("==============================================================================\n");
+    check_budgets(&new_expense, NULL);
 }
 
 void view_all_expenses() {
@@ -242,18 +1339,19 @@ void view_all_expenses() {
     printf("%-5s %-12s %-15s %-20s %-30s\n", "ID", "Date", "Amount", "Category", "Description");
     printf("----------------------------------------------------------------------------------\n");
     
-    float total = 0;
-    for (int i = 0; i < expense_count; i++) {
-        printf("%-5d %-12s %-15.2f %-20s %-30s\n",
-               expenses[i].id,
-               expenses[i].date,
-               expenses[i].amount,
-               expenses[i].category,
-               expenses[i].description);
-        total += expenses[i].amount;
+    Money total = 0;
+    for (int c = 0; c < chunk_count; c++) {
+        ExpenseChunk *chunk = expense_chunks[c];
+        int rows = chunk_rows(c);
+        for (int j = 0; j < rows; j++) {
+            if (chunk->deleted[j]) continue;
+            print_expense_row(chunk, j);
+            total += base_amount(chunk, j);
+        }
     }
+    char text[MONEY_TEXT_SIZE];
     printf("==================================================================================\n");
-    printf("  %sTOTAL EXPENSES: TK %.2f%s\n", COLOR_GREEN, total, COLOR_RESET);
+    printf("  %sTOTAL EXPENSES: %s %s%s\n", COLOR_GREEN, BASE_CURRENCY_SYMBOL, format_money(total, text), COLOR_RESET);
     printf("==================================================================================\n");
 }
 
@@ -275,24 +1373,33 @@ void view_by_category() {
     printf("%-5s %-12s %-15s %-30s\n", "ID", "Date", "Amount", "Description");
     printf("------------------------------------------------------------------------------\n");
     
-    float category_total = 0;
+    Money category_total = 0;
     int found = 0;
+    char date[11];
+    char amount[AMOUNT_TEXT_SIZE];
     
-    for (int i = 0; i < expense_count; i++) {
-        if (strcasecmp(expenses[i].category, category) == 0) {
-            printf("%-5d %-12s %-15.2f %-30s\n",
-                   expenses[i].id,
-                   expenses[i].date,
-                   expenses[i].amount,
-                   expenses[i].description);
-            category_total += expenses[i].amount;
-            found = 1;
-        }
+    // Only the records on the category's slot list are visited
+    if (!require_indexes()) return;
+    int id = find_category(category);
+    SlotList *list = id >= 0 ? &category_slots[id] : NULL;
+    if (list != NULL) slot_list_sort(list);
+    for (int k = 0; list != NULL && k < list->count; k++) {
+        ExpenseChunk *chunk = chunk_of(list->slots[k]);
+        int row = list->slots[k] % EXPENSE_CHUNK_SIZE;
+        if (chunk->deleted[row] || chunk->categories[row] != id) continue;
+        format_date(chunk->dates[row], date);
+        printf("%-5d %-12s %-15s %-30s\n",
+               chunk->ids[row],
+               date,
+               format_amount(chunk->amounts[row], chunk->currencies[row], amount),
+               description_text(chunk->descriptions[row]));
+        category_total += base_amount(chunk, row);
+        found = 1;
     }
     
     if (found) {
         printf("==============================================================================\n");
-        printf("  %sCATEGORY TOTAL: TK %.2f%s\n", COLOR_GREEN, category_total, COLOR_RESET);
+        printf("  %sCATEGORY TOTAL: %s %s%s\n", COLOR_GREEN, BASE_CURRENCY_SYMBOL, format_money(category_total, amount), COLOR_RESET);
         printf("==============================================================================\n");
     } else {
         printf("==============================================================================\n");
@@ -329,26 +1436,36 @@ void view_by_date_range() {
     printf("%-5s %-12s %-15s %-20s %-30s\n", "ID", "Date", "Amount", "Category", "Description");
     printf("----------------------------------------------------------------------------------\n");
     
-    float period_total = 0;
+    int start, end;
+    parse_date(start_date, &start);
+    parse_date(end_date, &end);
+    Money period_total = 0;
     int found = 0;
     
-    for (int i = 0; i < expense_count; i++) {
-        if (strcmp(expenses[i].date, start_date) >= 0 && 
-            strcmp(expenses[i].date, end_date) <= 0) {
-            printf("%-5d %-12s %-15.2f %-20s %-30s\n",
-                   expenses[i].id,
-                   expenses[i].date,
-                   expenses[i].amount,
-                   expenses[i].category,
-                   expenses[i].description);
-            period_total += expenses[i].amount;
+    // Walk the date index day by day, skipping pages with no expenses
+    if (!require_indexes()) return;
+    for (int day = start; day <= end; day++) {
+        SlotList *page = date_pages[(day - FIRST_INDEXED_DAY) / DATE_PAGE_DAYS];
+        if (page == NULL) {
+            day += DATE_PAGE_DAYS - 1 - (day - FIRST_INDEXED_DAY) % DATE_PAGE_DAYS;
+            continue;
+        }
+        SlotList *list = &page[(day - FIRST_INDEXED_DAY) % DATE_PAGE_DAYS];
+        slot_list_sort(list);
+        for (int k = 0; k < list->count; k++) {
+            ExpenseChunk *chunk = chunk_of(list->slots[k]);
+            int row = list->slots[k] % EXPENSE_CHUNK_SIZE;
+            if (chunk->deleted[row] || chunk->dates[row] != day) continue;
+            print_expense_row(chunk, row);
+            period_total += base_amount(chunk, row);
             found = 1;
         }
     }
     
     if (found) {
         printf("==================================================================================\n");
-        printf("  %sPERIOD TOTAL: TK %.2f%s\n", COLOR_GREEN, period_total, COLOR_RESET);
+        char text[MONEY_TEXT_SIZE];
+        printf("  %sPERIOD TOTAL: %s %s%s\n", COLOR_GREEN, BASE_CURRENCY_SYMBOL, format_money(period_total, text), COLOR_RESET);
         printf("==================================================================================\n");
     } else {
         printf("==================================================================================\n");
@@ -375,26 +1492,16 @@ void search_expenses() {
     printf("%-5s %-12s %-15s %-20s %-30s\n", "ID", "Date", "Amount", "Category", "Description");
     printf("----------------------------------------------------------------------------------\n");
     
-    float search_total = 0;
-    int found = 0;
-    
-    for (int i = 0; i < expense_count; i++) {
-        if (strstr(expenses[i].description, search_term) != NULL ||
-            strstr(expenses[i].category, search_term) != NULL) {
-            printf("%-5d %-12s %-15.2f %-20s %-30s\n",
-                   expenses[i].id,
-                   expenses[i].date,
-                   expenses[i].amount,
-                   expenses[i].category,
-                   expenses[i].description);
-            search_total += expenses[i].amount;
-            found = 1;
-        }
-    }
+    // The text is found anywhere in a description or category, as typed;
+    // words and prefixes are left to `--match`
+    Money search_total = 0;
+    int found = search_by_scan(search_term, &search_total);
+    if (found < 0) return;
     
-    if (found) {
+    if (found > 0) {
         printf("==================================================================================\n");
-        printf("  %sSEARCH TOTAL: TK %.2f%s\n", COLOR_GREEN, search_total, COLOR_RESET);
+        char text[MONEY_TEXT_SIZE];
+        printf("  %sSEARCH TOTAL: %s %s%s\n", COLOR_GREEN, BASE_CURRENCY_SYMBOL, format_money(search_total, text), COLOR_RESET);
         printf("==================================================================================\n");
     } else {
         printf("==================================================================================\n");
@@ -403,6 +1510,29 @@ void search_expenses() {
     }
 }
 
+// Prints the live expenses whose description or category contains
+// `search_term`, ignoring case, adding their amounts in the base currency to
+// *total. Returns how many there were, or -1 (after saying why) if memory is
+// exhausted.
+int search_by_scan(const char *search_term, Money *total) {
+    TextScan scan;
+    if (!begin_text_scan(&scan, search_term)) return -1;
+    
+    int slots[TEXT_SCAN_BATCH];
+    int found = 0, count;
+    while ((count = next_text_matches(&scan, slots, TEXT_SCAN_BATCH)) > 0) {
+        for (int k = 0; k < count; k++) {
+            ExpenseChunk *chunk = chunk_of(slots[k]);
+            int row = slots[k] % EXPENSE_CHUNK_SIZE;
+            print_expense_row(chunk, row);
+            *total += base_amount(chunk, row);
+        }
+        found += count;
+    }
+    end_text_scan(&scan);
+    return found;
+}
+
 void modify_expense() {
     if (expense_count == 0) {
         print_warning("No expenses recorded.");
@@ -417,68 +1547,77 @@ void modify_expense() {
         return;
     }
     
-    int found = -1;
-    for (int i = 0; i < expense_count; i++) {
-        if (expenses[i].id == id) {
-            found = i;
-            break;
-        }
-    }
-    
+    int found = find_expense_by_id(id);
     if (found == -1) {
         print_error("Expense with specified ID not found.");
         return;
     }
     
+    Expense expense, old;
+    Expense *e = &expense;
+    char amount_text[AMOUNT_TEXT_SIZE];
+    read_expense(found, e);
+    old = expense;
     printf("\n%sCurrent expense details:%s\n", COLOR_CYAN, COLOR_RESET);
-    printf("Date: %s\n", expenses[found].date);
-    printf("Amount: TK %.2f\n", expenses[found].amount);
-    printf("Category: %s\n", expenses[found].category);
-    printf("Description: %s\n", expenses[found].description);
+    printf("Date: %s\n", e->date);
+    printf("Amount: %s %s\n", currency_symbol(e->currency), format_money(e->amount, amount_text));
+    printf("Category: %s\n", e->category);
+    printf("Description: %s\n", e->description);
     
     printf("\n%sEnter new details (press Enter to keep current value):%s\n", COLOR_YELLOW, COLOR_RESET);
     
     // Get new date
     char new_date[20];
-    printf("New date (YYYY-MM-DD) [%s]: ", expenses[found].date);
+    printf("New date (YYYY-MM-DD) [%s]: ", e->date);
     clear_input_buffer();
     fgets(new_date, sizeof(new_date), stdin);
     new_date[strcspn(new_date, "\n")] = 0;
     if (strlen(new_date) > 0 && validate_date(new_date)) {
-        strncpy(expenses[found].date, new_date, sizeof(expenses[found].date) - 1);
+        copy_truncated(e->date, sizeof(e->date), new_date);
     }
     
-    // Get new amount
-    char amount_input[20];
-    printf("New amount [%.2f]: ", expenses[found].amount);
+    // Get new amount; without a currency code it stays in the same currency
+    char amount_input[64];
+    printf("New amount [%s]: ", format_amount(e->amount, find_currency(e->currency), amount_text));
     fgets(amount_input, sizeof(amount_input), stdin);
     amount_input[strcspn(amount_input, "\n")] = 0;
     if (strlen(amount_input) > 0) {
-        float new_amount = atof(amount_input);
-        if (new_amount > 0) {
-            expenses[found].amount = new_amount;
+        Money new_amount;
+        char new_currency[4];
+        if (parse_amount(amount_input, &new_amount, new_currency) &&
+            (new_currency[0] == '\0' || check_currency(new_currency))) {
+            e->amount = new_amount;
+            if (new_currency[0] != '\0') strcpy(e->currency, new_currency);
         }
     }
     
     // Get new category
     char new_category[MAX_CATEGORY_LENGTH];
-    printf("New category [%s]: ", expenses[found].category);
+    printf("New category [%s]: ", e->category);
     fgets(new_category, sizeof(new_category), stdin);
     new_category[strcspn(new_category, "\n")] = 0;
     if (strlen(new_category) > 0) {
-        strncpy(expenses[found].category, new_category, sizeof(expenses[found].category) - 1);
+        copy_truncated(e->category, sizeof(e->category), new_category);
     }
     
     // Get new description
     char new_description[MAX_DESCRIPTION_LENGTH];
-    printf("New description [%s]: ", expenses[found].description);
+    printf("New description [%s]: ", e->description);
     fgets(new_description, sizeof(new_description), stdin);
     new_description[strcspn(new_description, "\n")] = 0;
     if (strlen(new_description) > 0) {
-        strncpy(expenses[found].description, new_description, sizeof(expenses[found].description) - 1);
+        copy_truncated(e->description, sizeof(e->description), new_description);
+    }
+    
+    if (!write_expense(found, e)) {
+        print_error("Out of memory! Expense was not modified.");
+        return;
     }
+    journal_record(JOURNAL_MODIFY, e);
+    journal_commit();
     
     print_success("Expense modified successfully!");
+    check_budgets(e, &old);
 }
 
 void delete_expense() {
@@ -495,25 +1634,22 @@ void delete_expense() {
         return;
     }
     
-    int found = -1;
-    for (int i = 0; i < expense_count; i++) {
-        if (expenses[i].id == id) {
-            found = i;
-            break;
-        }
-    }
-    
+    int found = find_expense_by_id(id);
     if (found == -1) {
         print_error("Expense with specified ID not found.");
         return;
     }
     
+    Expense expense;
+    Expense *e = &expense;
+    char amount_text[MONEY_TEXT_SIZE];
+    read_expense(found, e);
     printf("\n%sExpense to delete:%s\n", COLOR_RED, COLOR_RESET);
-    printf("ID: %d\n", expenses[found].id);
-    printf("Date: %s\n", expenses[found].date);
-    printf("Amount: TK %.2f\n", expenses[found].amount);
-    printf("Category: %s\n", expenses[found].category);
-    printf("Description: %s\n", expenses[found].description);
+    printf("ID: %d\n", e->id);
+    printf("Date: %s\n", e->date);
+    printf("Amount: %s %s\n", currency_symbol(e->currency), format_money(e->amount, amount_text));
+    printf("Category: %s\n", e->category);
+    printf("Description: %s\n", e->description);
     
     printf("\n%sAre you sure you want to delete this expense? (y/n):%s ", COLOR_RED, COLOR_RESET);
     clear_input_buffer();
@@ -521,11 +1657,9 @@ void delete_expense() {
     scanf("%c", &confirm);
     
     if (confirm == 'y' || confirm == 'Y') {
-        // Shift all elements after the found expense
-        for (int i = found; i < expense_count - 1; i++) {
-            expenses[i] = expenses[i + 1];
-        }
-        expense_count--;
+        remove_expense_at(found);
+        journal_record(JOURNAL_DELETE, e);
+        journal_commit();
         print_success("Expense deleted successfully!");
     } else {
         print_warning("Deletion cancelled.");
@@ -538,192 +1672,8560 @@ void show_statistics() {
         return;
     }
     
+    // The aggregates are kept current as expenses change, so the dashboard
+    // costs a step per category rather than passes over the store
+    if (!require_aggregates()) return;
+    int highest = heap_top(&highest_amounts);
+    int lowest = heap_top(&lowest_amounts);
+    
+    // Shares in tenths of a percent that add up to exactly 100.0%: each is
+    // rounded down and the tenths left over go to the largest remainders.
+    // Totals too large to multiply by 1000 are scaled down first.
+    int *tenths = malloc((category_count + 1) * sizeof(int));
+    Money *remainders = malloc((category_count + 1) * sizeof(Money));
+    if (tenths == NULL || remainders == NULL) {
+        free(tenths);
+        free(remainders);
+        print_error("Out of memory! Cannot show statistics.");
+        return;
+    }
+    Money divisor = amount_total, scale = 1;
+    while (divisor > LLONG_MAX / 1000) {
+        divisor /= 1000;
+        scale *= 1000;
+    }
+    int left = 1000;
+    for (int k = 0; k < category_count; k++) {
+        Money share = category_totals[k].count > 0 && divisor > 0 ? category_totals[k].total / scale * 1000 : 0;
+        tenths[k] = divisor > 0 ? (int)(share / divisor) : 0;
+        remainders[k] = category_totals[k].count > 0 && divisor > 0 ? share % divisor : -1;
+        left -= tenths[k];
+    }
+    for (; left > 0; left--) {
+        int largest = -1;
+        for (int k = 0; k < category_count; k++) {
+            if (remainders[k] >= 0 && (largest < 0 || remainders[k] > remainders[largest])) largest = k;
+        }
+        if (largest < 0) break;
+        tenths[largest]++;
+        remainders[largest] = -1;
+    }
+    
+    char total_text[MONEY_TEXT_SIZE], average_text[MONEY_TEXT_SIZE];
     printf("\n==================================================================================\n");
     printf("                      %sEXPENSE STATISTICS DASHBOARD%s\n", COLOR_BLUE, COLOR_RESET);
     printf("==================================================================================\n");
     
-    // Total expenses
-    float total = 0;
-    for (int i = 0; i < expense_count; i++) {
-        total += expenses[i].amount;
-    }
-    
     printf("\n");
-    printf("  %sTotal Expenses:%s    TK %.2f\n", COLOR_CYAN, COLOR_RESET, total);
-    printf("  %sAverage Expense:%s   TK %.2f\n", COLOR_CYAN, COLOR_RESET, total / expense_count);
+    printf("  %sTotal Expenses:%s    %s %s\n", COLOR_CYAN, COLOR_RESET, BASE_CURRENCY_SYMBOL, format_money(amount_total, total_text));
+    printf("  %sAverage Expense:%s   %s %s\n", COLOR_CYAN, COLOR_RESET, BASE_CURRENCY_SYMBOL,
+           format_money(rounded_average(amount_total, expense_count), average_text));
     printf("  %sTotal Entries:%s     %d\n", COLOR_CYAN, COLOR_RESET, expense_count);
     printf("\n");
     printf("==================================================================================\n");
     printf("                      %sCATEGORY BREAKDOWN%s\n", COLOR_MAGENTA, COLOR_RESET);
     printf("==================================================================================\n");
     
-    // Find unique categories and their totals
-    char categories[MAX_EXPENSES][MAX_CATEGORY_LENGTH];
-    float category_totals[MAX_EXPENSES] = {0};
-    int category_count = 0;
-    
-    for (int i = 0; i < expense_count; i++) {
-        int found = 0;
-        for (int j = 0; j < category_count; j++) {
-            if (strcasecmp(categories[j], expenses[i].category) == 0) {
-                category_totals[j] += expenses[i].amount;
-                found = 1;
-                break;
-            }
-        }
-        if (!found) {
-            strcpy(categories[category_count], expenses[i].category);
-            category_totals[category_count] = expenses[i].amount;
-            category_count++;
-        }
-    }
-    
-    // Display category breakdown
-    for (int i = 0; i < category_count; i++) {
-        float percentage = (category_totals[i] / total) * 100;
-        printf("  %-20s: TK %-10.2f (%5.1f%%)\n", 
-               categories[i], category_totals[i], percentage);
-    }
-    
-    // Find highest and lowest expense
-    Expense highest = expenses[0];
-    Expense lowest = expenses[0];
-    for (int i = 1; i < expense_count; i++) {
-        if (expenses[i].amount > highest.amount) {
-            highest = expenses[i];
-        }
-        if (expenses[i].amount < lowest.amount) {
-            lowest = expenses[i];
-        }
+    for (int k = 0; k < category_count; k++) {
+        if (category_totals[k].count == 0) continue;
+        
+        printf("  %-20s: %s %-10s (%3d.%d%%)\n", category_names[k], BASE_CURRENCY_SYMBOL,
+               format_money(category_totals[k].total, total_text), tenths[k] / 10, tenths[k] % 10);
     }
+    free(tenths);
+    free(remainders);
     
+    // The extremes are compared in the base currency; one in another
+    // currency is shown in its own as well
+    const char *labels[2] = {"Highest Expense:", "Lowest Expense:"};
+    const char *colors[2] = {COLOR_RED, COLOR_GREEN};
+    int extremes[2] = {highest, lowest};
     printf("\n");
     printf("==================================================================================\n");
-    printf("  %sHighest Expense:%s TK %.2f\n", COLOR_RED, COLOR_RESET, highest.amount);
-    printf("     Category: %s, Description: %s\n", highest.category, highest.description);
-    printf("\n");
-    printf("  %sLowest Expense:%s  TK %.2f\n", COLOR_GREEN, COLOR_RESET, lowest.amount);
-    printf("     Category: %s, Description: %s\n", lowest.category, lowest.description);
+    for (int e = 0; e < 2; e++) {
+        ExpenseChunk *chunk = chunk_of(extremes[e]);
+        int row = extremes[e] % EXPENSE_CHUNK_SIZE;
+        char amount_text[AMOUNT_TEXT_SIZE];
+        if (e == 1) printf("\n");
+        printf("  %s%s%s %s%s %s", colors[e], labels[e], COLOR_RESET, e == 1 ? " " : "", BASE_CURRENCY_SYMBOL,
+               format_money(base_amount(chunk, row), total_text));
+        if (chunk->currencies[row] != 0) printf(" (%s)", format_amount(chunk->amounts[row], chunk->currencies[row], amount_text));
+        printf("\n");
+        printf("     Category: %s, Description: %s\n",
+               category_names[chunk->categories[row]], description_text(chunk->descriptions[row]));
+    }
     printf("==================================================================================\n");
 }
 
 void save_to_file() {
-    FILE *file = fopen(FILENAME, "wb");
-    if (file == NULL) {
-        print_error("Could not save data to file!");
-        return;
-    }
-    
-    // Save expense count first
-    if (fwrite(&expense_count, sizeof(int), 1, file) != 1) {
-        print_error("Error writing expense count!");
-        fclose(file);
-        return;
+    if (checkpoint_data()) {
+        print_success("Data saved successfully!");
     }
+}
+
+// Writes every live record to a new data file, swaps it in for the old one
+// and starts a fresh journal. Returns 0, leaving the old file and journal in
+// place, if anything fails.
+int checkpoint_data() {
+    if (!save_data_file(data_path, checkpoint_sequence + 1)) return 0;
     
-    // Save all expenses
-    for (int i = 0; i < expense_count; i++) {
-        if (fwrite(&expenses[i], sizeof(Expense), 1, file) != 1) {
-            print_error("Error writing expense data!");
-            fclose(file);
-            return;
-        }
+    checkpoint_sequence++;
+    // The rollups go with it, so the next load need not scan to rebuild
+    // them. They are only a summary; if they cannot be saved, that load
+    // rebuilds them.
+    if (!rollups_ready) rollups_ready = rebuild_rollups();
+    if (rollups_ready) save_rollups(checkpoint_sequence);
+    if (!journal_reset()) {
+        print_warning("Could not start a new journal; changes will be saved on exit.");
     }
-    
-    fclose(file);
-    print_success("Data saved successfully!");
+    return 1;
 }
 
+// Loads the data file, replays the journal on top of it and goes on
+// journaling. An intact journal is appended to, so that a session that makes
+// one change (or a single command) does not rewrite the data file; a torn or
+// long journal is folded into the data file straight away.
 void load_from_file() {
-    FILE *file = fopen(FILENAME, "rb");
-    if (file == NULL) {
-        print_warning("No previous data found. Starting fresh.");
-        return;
+    int loaded = read_data_file();
+    load_rates();
+    
+    // A store loaded in place came from a checkpoint, which never writes
+    // duplicate ids, so it is not indexed just to check
+    int renumbered = indexes_ready ? renumber_duplicate_ids() : 0;
+    if (renumbered > 0) {
+        char message[80];
+        snprintf(message, sizeof(message), "Gave new IDs to %d expenses with duplicate or missing IDs.", renumbered);
+        print_warning(message);
     }
     
-    // Read expense count
-    if (fread(&expense_count, sizeof(int), 1, file) != 1) {
-        print_warning("Error reading data file. Starting fresh.");
-        fclose(file);
-        expense_count = 0;
-        return;
+    // Rollups saved with the data file are read back before the journal is
+    // replayed over them; an empty store starts with empty ones
+    if (loaded) {
+        load_rollups();
+    } else {
+        rollups_ready = 1;
     }
+    load_budgets();
     
-    // Read all expenses
-    for (int i = 0; i < expense_count; i++) {
-        if (fread(&expenses[i], sizeof(Expense), 1, file) != 1) {
-            print_error("Error reading expense data!");
-            fclose(file);
-            expense_count = i;
-            return;
-        }
+    int intact;
+    int replayed = replay_journal(&intact);
+    if (replayed > 0 && !batch_mode) {
+        printf("%sRecovered %d unsaved changes from the journal.%s\n", COLOR_YELLOW, replayed, COLOR_RESET);
     }
     
-    fclose(file);
-    printf("%sData loaded successfully! (%d expenses)%s\n", COLOR_GREEN, expense_count, COLOR_RESET);
+    int opened;
+    if (renumbered > 0 || (replayed > 0 && !intact) ||
+        (replayed >= JOURNAL_CHECKPOINT_ENTRIES && replayed > expense_count / 2)) {
+        opened = checkpoint_data();
+    } else {
+        opened = intact ? journal_resume(replayed) : journal_reset();
+    }
+    if (!opened) {
+        print_warning("Could not open the journal; changes will be saved on exit.");
+    }
+    
+    if (!batch_mode && (loaded || replayed > 0)) {
+        printf("%sData loaded successfully! (%d expenses)%s\n", COLOR_GREEN, expense_count, COLOR_RESET);
+    }
 }
 
-int validate_date(const char *date) {
-    if (strlen(date) != 10) return 0;
-    if (date[4] != '-' || date[7] != '-') return 0;
+// Reads the data file into the store. Returns 1 if it was read, 0 (after
+// saying why) if there was none or it could not be read.
+int read_data_file() {
+    checkpoint_sequence = 0;
     
-    for (int i = 0; i < 10; i++) {
-        if (i == 4 || i == 7) continue;
-        if (!isdigit(date[i])) return 0;
+    FILE *file = fopen(data_path, "rb");
+    if (file == NULL) {
+        // Commands run one at a time against a store kept in the journal
+        // until the first checkpoint, so a missing file is not news there
+        if (!batch_mode) print_warning("No previous data found. Starting fresh.");
+        return 0;
     }
     
-    return 1;
-}
+    char magic[8];
+    if (fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+        memcmp(magic, DATA_FILE_MAGIC, sizeof(magic)) == 0) {
+        fclose(file);
+        return map_data_file();
+    }
+    rewind(file);
+    return read_legacy_file(file);
+}
+
+// Data files
+// Writes the live records to `path` through a temporary file that is synced
+// and renamed over it, so a crash leaves either the old file or the new one.
+// Returns 0 (after saying why) if anything fails.
+int save_data_file(const char *path, int sequence) {
+    char temp_path[FILENAME_MAX];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    FILE *file = fopen(temp_path, "wb");
+    if (file == NULL) {
+        print_error("Could not save data to file!");
+        return 0;
+    }
+    
+    int written = write_data_file(file, sequence) && sync_file(file);
+    fclose(file);
+    if (!written) {
+        print_error("Error writing expense data!");
+        remove(temp_path);
+        return 0;
+    }
+    
+    #ifdef _WIN32
+    int replaced = MoveFileExA(temp_path, path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+    #else
+    int replaced = rename(temp_path, path) == 0;
+    #endif
+    if (!replaced) {
+        print_error("Could not save data to file!");
+        remove(temp_path);
+        return 0;
+    }
+    return 1;
+}
+
+// Writes the live records as a column data file, laid out as described at
+// DataFileHeader. Returns 0 on a write error.
+int write_data_file(FILE *file, int sequence) {
+    DataFileHeader header;
+    memset(&header, 0, sizeof(header));
+    header.version = DATA_FILE_VERSION;
+    header.count = expense_count;
+    header.next_id = next_expense_id;
+    header.checkpoint_sequence = sequence;
+    header.category_count = category_count;
+    header.currency_count = currency_count;
+    
+    // The header is written last, once the offsets are known
+    unsigned char bytes[DATA_FILE_HEADER_SIZE];
+    memset(bytes, 0, sizeof(bytes));
+    if (fwrite(bytes, 1, sizeof(bytes), file) != sizeof(bytes)) return 0;
+    DataWriter writer = {file, 0, 0, NULL, 0, 0, 0};
+    
+    // Columns, one chunk of live values per write
+    unsigned int values[EXPENSE_CHUNK_SIZE];
+    unsigned long long amounts[EXPENSE_CHUNK_SIZE];
+    unsigned char currencies[EXPENSE_CHUNK_SIZE];
+    int block = -1;
+    size_t used = 0;
+    for (int k = 0; k < 6; k++) {
+        if (k < 5) header.column_offsets[k] = DATA_FILE_HEADER_SIZE + writer.position;
+        for (int c = 0; c < chunk_count; c++) {
+            ExpenseChunk *chunk = expense_chunks[c];
+            int rows = chunk_rows(c);
+            int n = 0;
+            for (int j = 0; j < rows; j++) {
+                if (chunk->deleted[j]) continue;
+                if (k == 0) memcpy(&values[n], &chunk->ids[j], sizeof(int));
+                else if (k == 1) memcpy(&values[n], &chunk->dates[j], sizeof(int));
+                else if (k == 2) amounts[n] = (unsigned long long)chunk->amounts[j];
+                else if (k == 3) memcpy(&values[n], &chunk->categories[j], sizeof(int));
+                else if (k == 4) values[n] = pack_description(strlen(description_text(chunk->descriptions[j])) + 1, &block, &used);
+                else currencies[n] = chunk->currencies[j];
+                n++;
+            }
+            if (k == 2) data_write_longs(&writer, amounts, n);
+            else if (k == 5) data_write(&writer, currencies, n);
+            else data_write_words(&writer, values, n);
+        }
+    }
+    
+    header.names_offset = DATA_FILE_HEADER_SIZE + writer.position;
+    for (int k = 0; k < category_count; k++) {
+        data_write(&writer, category_names[k], strlen(category_names[k]) + 1);
+    }
+    for (int k = 0; k < currency_count; k++) {
+        data_write(&writer, currency_list[k].code, strlen(currency_list[k].code) + 1);
+    }
+    
+    // Description text, packed exactly as the offsets above assumed; the
+    // gap at the end of a block is zero-filled
+    static const char zeros[MAX_DESCRIPTION_LENGTH];
+    header.text_offset = DATA_FILE_HEADER_SIZE + writer.position;
+    block = -1;
+    long long text_written = 0;
+    for (int slot = 0; slot < slot_count; slot++) {
+        ExpenseChunk *chunk = chunk_of(slot);
+        int row = slot % EXPENSE_CHUNK_SIZE;
+        if (chunk->deleted[row]) continue;
+        
+        const char *text = description_text(chunk->descriptions[row]);
+        size_t length = strlen(text) + 1;
+        unsigned int offset = pack_description(length, &block, &used);
+        data_write(&writer, zeros, offset - text_written);
+        data_write(&writer, text, length);
+        text_written = offset + length;
+    }
+    header.description_blocks = block + 1;
+    
+    // CRCs of the finished blocks and of the partial last one
+    if (writer.position % DATA_FILE_CRC_BLOCK != 0) data_finish_block(&writer);
+    header.crc_offset = DATA_FILE_HEADER_SIZE + writer.position;
+    header.file_size = header.crc_offset + 4LL * writer.crc_count;
+    
+    unsigned char *table = malloc(4 * (size_t)writer.crc_count + 1);
+    if (table == NULL) writer.failed = 1;
+    for (int b = 0; table != NULL && b < writer.crc_count; b++) {
+        put_le32(table + 4 * b, writer.crcs[b]);
+    }
+    if (table != NULL) {
+        header.crc_table_crc = crc32(0, table, 4 * (size_t)writer.crc_count);
+        if (fwrite(table, 4, writer.crc_count, file) != (size_t)writer.crc_count) writer.failed = 1;
+    }
+    free(table);
+    free(writer.crcs);
+    
+    encode_header(&header, bytes);
+    return !writer.failed && fseek(file, 0, SEEK_SET) == 0 &&
+           fwrite(bytes, 1, sizeof(bytes), file) == sizeof(bytes);
+}
+
+// Writes bytes after the header, finishing a block's CRC each time a
+// DATA_FILE_CRC_BLOCK boundary is reached. Errors are collected in `failed`.
+void data_write(DataWriter *writer, const void *bytes, size_t length) {
+    const unsigned char *next = bytes;
+    while (length > 0) {
+        size_t room = DATA_FILE_CRC_BLOCK - writer->position % DATA_FILE_CRC_BLOCK;
+        size_t n = length < room ? length : room;
+        if (fwrite(next, 1, n, writer->file) != n) writer->failed = 1;
+        writer->crc = crc32(writer->crc, next, n);
+        writer->position += n;
+        next += n;
+        length -= n;
+        if (n == room) data_finish_block(writer);
+    }
+}
+
+// Files the CRC of the block written so far and starts the next one
+void data_finish_block(DataWriter *writer) {
+    if (writer->crc_count == writer->crc_capacity) {
+        int new_capacity = writer->crc_capacity == 0 ? 64 : writer->crc_capacity * 2;
+        unsigned int *grown = realloc(writer->crcs, new_capacity * sizeof(unsigned int));
+        if (grown == NULL) {
+            writer->failed = 1;
+            return;
+        }
+        writer->crcs = grown;
+        writer->crc_capacity = new_capacity;
+    }
+    writer->crcs[writer->crc_count++] = writer->crc;
+    writer->crc = 0;
+}
+
+// Writes 32-bit values little-endian. Swaps them in place on big-endian hosts.
+void data_write_words(DataWriter *writer, unsigned int *words, int count) {
+    if (!host_is_little_endian()) swap_words(words, count);
+    data_write(writer, words, (size_t)count * 4);
+}
+
+// Writes 64-bit values little-endian. Swaps them in place on big-endian hosts.
+void data_write_longs(DataWriter *writer, unsigned long long *longs, int count) {
+    if (!host_is_little_endian()) swap_longs(longs, count);
+    data_write(writer, longs, (size_t)count * 8);
+}
+
+// Writes the live records in the original format: a count, the records as
+// LegacyExpense structs, then tagged values that older versions never read.
+// Amounts are converted to the base currency, which that format assumes,
+// and rounded to the nearest float. Returns 0 on a write error.
+int write_legacy_file(FILE *file, int sequence) {
+    if (fwrite(&expense_count, sizeof(int), 1, file) != 1) return 0;
+    
+    LegacyExpense *buffer = calloc(EXPENSE_CHUNK_SIZE, sizeof(LegacyExpense));
+    if (buffer == NULL) return 0;
+    for (int c = 0; c < chunk_count; c++) {
+        ExpenseChunk *chunk = expense_chunks[c];
+        int rows = chunk_rows(c);
+        int n = 0;
+        for (int j = 0; j < rows; j++) {
+            if (chunk->deleted[j]) continue;
+            Expense expense;
+            read_expense(c * EXPENSE_CHUNK_SIZE + j, &expense);
+            expense_to_legacy(&expense, &buffer[n++]);
+        }
+        if (fwrite(buffer, sizeof(LegacyExpense), n, file) != (size_t)n) {
+            free(buffer);
+            return 0;
+        }
+    }
+    free(buffer);
+    
+    return fwrite(ID_TRAILER_TAG, 1, 4, file) == 4 &&
+           fwrite(&next_expense_id, sizeof(int), 1, file) == 1 &&
+           fwrite(SEQUENCE_TRAILER_TAG, 1, 4, file) == 4 &&
+           fwrite(&sequence, sizeof(int), 1, file) == 1;
+}
+
+// Places a string of `length` bytes (NUL included) in an arena being filled
+// block by block, starting a new block when it does not fit the current one.
+// Start with `block` at -1. Returns the string's offset.
+unsigned int pack_description(size_t length, int *block, size_t *used) {
+    if (*block < 0 || *used + length > DESCRIPTION_BLOCK_SIZE) {
+        (*block)++;
+        *used = 0;
+    }
+    unsigned int offset = (unsigned int)*block * DESCRIPTION_BLOCK_SIZE + *used;
+    *used += length;
+    return offset;
+}
+
+// Reads a file in the original format: a count, the records as
+// LegacyExpense structs, then tagged values. Closes the file. Returns 1 if it
+// was read, 0 (after saying why) if not.
+int read_legacy_file(FILE *file) {
+    // Read expense count
+    int count;
+    if (fread(&count, sizeof(int), 1, file) != 1 || count < 0) {
+        print_warning("Error reading data file. Starting fresh.");
+        fclose(file);
+        return 0;
+    }
+    
+    LegacyExpense *buffer = malloc(EXPENSE_CHUNK_SIZE * sizeof(LegacyExpense));
+    if (buffer == NULL || !reserve_expenses(count)) {
+        print_error("Out of memory while loading expenses!");
+        free(buffer);
+        fclose(file);
+        return 0;
+    }
+    
+    // Read all expenses, one chunk of records per read
+    while (expense_count < count) {
+        int n = count - expense_count;
+        if (n > EXPENSE_CHUNK_SIZE) n = EXPENSE_CHUNK_SIZE;
+        
+        size_t got = fread(buffer, sizeof(LegacyExpense), n, file);
+        for (size_t j = 0; j < got; j++) {
+            Expense expense;
+            expense_from_legacy(&buffer[j], &expense);
+            if (!append_expense(&expense)) {
+                print_error("Out of memory while loading expenses!");
+                free(buffer);
+                fclose(file);
+                return 0;
+            }
+        }
+        if (got != (size_t)n) {
+            print_error("Error reading expense data!");
+            free(buffer);
+            fclose(file);
+            return 0;
+        }
+    }
+    free(buffer);
+    
+    // Tagged values follow the records. Files from older versions end after
+    // the records; their next id is worked out from the ids seen while loading
+    char tag[4];
+    int value;
+    while (fread(tag, 1, 4, file) == 4 && fread(&value, sizeof(int), 1, file) == 1) {
+        if (memcmp(tag, ID_TRAILER_TAG, 4) == 0) {
+            if (value > next_expense_id) next_expense_id = value;
+        } else if (memcmp(tag, SEQUENCE_TRAILER_TAG, 4) == 0) {
+            checkpoint_sequence = value;
+        }
+    }
+    fclose(file);
+    return 1;
+}
+
+// Copies a record of the original format, amount converted to paisa. Older
+// files may hold unterminated text fields; they are cut short.
+void expense_from_legacy(const LegacyExpense *old, Expense *expense) {
+    memset(expense, 0, sizeof(*expense));
+    expense->id = old->id;
+    memcpy(expense->date, old->date, sizeof(expense->date) - 1);
+    expense->amount = money_from_float(old->amount);
+    memcpy(expense->category, old->category, MAX_CATEGORY_LENGTH - 1);
+    memcpy(expense->description, old->description, MAX_DESCRIPTION_LENGTH - 1);
+}
+
+void expense_to_legacy(const Expense *expense, LegacyExpense *old) {
+    memset(old, 0, sizeof(*old));
+    old->id = expense->id;
+    memcpy(old->date, expense->date, sizeof(old->date));
+    old->amount = (float)((double)expense_base_amount(expense) / MONEY_SCALE);
+    memcpy(old->category, expense->category, MAX_CATEGORY_LENGTH);
+    memcpy(old->description, expense->description, MAX_DESCRIPTION_LENGTH);
+}
+
+// Loads a column data file in place: full chunks and the description blocks
+// point into a private mapping of the file; only the category names,
+// currency codes and the last, partial chunk are copied. The records of a
+// file from an older version are all copied, with float amounts converted
+// to paisa and, without a currency column, in the base currency. Every
+// block is checked against its CRC first. Returns 1 if it was loaded, 0
+// (after saying why) if not.
+int map_data_file() {
+    size_t size;
+    char *map = map_file(data_path, &size);
+    if (map == NULL) {
+        print_warning("Error reading data file. Starting fresh.");
+        return 0;
+    }
+    
+    DataFileHeader header;
+    int status = check_data_file(map, size, &header);
+    if (status != 1) {
+        unmap_file(map, size);
+        if (status == 0) {
+            quarantine_data_file();
+        } else {
+            print_warning("Data file is from a newer version. Starting fresh.");
+        }
+        return 0;
+    }
+    if (!host_is_little_endian()) {
+        for (int k = 0; k < 5; k++) {
+            char *column = map + header.column_offsets[k];
+            if (data_column_width(header.version, k) == 8) swap_longs((unsigned long long *)column, header.count);
+            else swap_words((unsigned int *)column, header.count);
+        }
+    }
+    data_map = map;
+    data_map_size = size;
+    
+    // Category and currency ids in the file are positions in its lists; the
+    // base currency always comes first
+    const char *name = map + header.names_offset;
+    int names = header.category_count + header.currency_count;
+    for (int k = 0; k < names; k++) {
+        int id = k < header.category_count ? intern_category(name) : intern_currency(name);
+        if (id != (k < header.category_count ? k : k - header.category_count)) {
+            free_expenses();
+            quarantine_data_file();
+            return 0;
+        }
+        name += strlen(name) + 1;
+    }
+    if (intern_currency(BASE_CURRENCY) != 0) {
+        free_expenses();
+        print_error("Out of memory while loading expenses!");
+        return 0;
+    }
+    
+    int chunks = (header.count + EXPENSE_CHUNK_SIZE - 1) / EXPENSE_CHUNK_SIZE;
+    chunk_capacity = chunks < 16 ? 16 : chunks;
+    expense_chunks = malloc(chunk_capacity * sizeof(ExpenseChunk *));
+    description_block_capacity = header.description_blocks < 16 ? 16 : header.description_blocks;
+    description_blocks = malloc(description_block_capacity * sizeof(char *));
+    mapped_tombstones = calloc(header.count + 1, 1);
+    if (expense_chunks == NULL || description_blocks == NULL || mapped_tombstones == NULL) {
+        free_expenses();
+        print_error("Out of memory while loading expenses!");
+        return 0;
+    }
+    
+    for (int c = 0; c < chunks; c++) {
+        long long first = (long long)c * EXPENSE_CHUNK_SIZE;
+        int *ids = (int *)(map + header.column_offsets[0]) + first;
+        int *dates = (int *)(map + header.column_offsets[1]) + first;
+        Money *amounts = (Money *)(map + header.column_offsets[2]) + first;
+        float *float_amounts = (float *)(map + header.column_offsets[2]) + first;
+        int *categories = (int *)(map + header.column_offsets[3]) + first;
+        unsigned int *descriptions = (unsigned int *)(map + header.column_offsets[4]) + first;
+        unsigned char *currencies = (unsigned char *)(map + data_column_offset(header.version, 5, header.count)) + first;
+        
+        // Appends go past the end of the last chunk, so it gets its own columns
+        ExpenseChunk *chunk;
+        int rows = header.count - (int)first;
+        if (rows >= EXPENSE_CHUNK_SIZE && header.version == DATA_FILE_VERSION) {
+            chunk = malloc(sizeof(ExpenseChunk));
+            if (chunk != NULL) {
+                chunk->ids = ids;
+                chunk->dates = dates;
+                chunk->amounts = amounts;
+                chunk->categories = categories;
+                chunk->descriptions = descriptions;
+                chunk->currencies = currencies;
+                chunk->deleted = mapped_tombstones + first;
+            }
+        } else {
+            if (rows > EXPENSE_CHUNK_SIZE) rows = EXPENSE_CHUNK_SIZE;
+            chunk = allocate_chunk();
+            if (chunk != NULL) {
+                memcpy(chunk->ids, ids, rows * sizeof(int));
+                memcpy(chunk->dates, dates, rows * sizeof(int));
+                if (header.version >= 4) {
+                    memcpy(chunk->amounts, amounts, rows * sizeof(Money));
+                } else {
+                    for (int j = 0; j < rows; j++) chunk->amounts[j] = money_from_float(float_amounts[j]);
+                }
+                memcpy(chunk->categories, categories, rows * sizeof(int));
+                memcpy(chunk->descriptions, descriptions, rows * sizeof(unsigned int));
+                if (header.version >= 5) memcpy(chunk->currencies, currencies, rows);
+                else memset(chunk->currencies, 0, rows);
+                memset(chunk->deleted, 0, rows);
+            }
+        }
+        if (chunk == NULL) {
+            free_expenses();
+            print_error("Out of memory while loading expenses!");
+            return 0;
+        }
+        expense_chunks[chunk_count++] = chunk;
+    }
+    
+    // New text goes to fresh blocks; the last mapped one may end with the file
+    for (int b = 0; b < header.description_blocks; b++) {
+        description_blocks[b] = map + header.text_offset + (long long)b * DESCRIPTION_BLOCK_SIZE;
+    }
+    description_block_count = header.description_blocks;
+    description_mapped_blocks = header.description_blocks;
+    description_mapped_used = header.description_blocks > 0 ?
+        (size_t)(header.crc_offset - header.text_offset - (long long)(header.description_blocks - 1) * DESCRIPTION_BLOCK_SIZE) : 0;
+    description_block_used = DESCRIPTION_BLOCK_SIZE;
+    
+    slot_count = header.count;
+    expense_count = header.count;
+    next_expense_id = header.next_id;
+    checkpoint_sequence = header.checkpoint_sequence;
+    indexes_ready = 0;
+    return 1;
+}
+
+// Decodes the header of a mapped data file and checks the whole file: the
+// header and block CRCs, that the sections fit the file and that every
+// category id, currency id and description offset points inside it. Returns
+// 1 if the file is sound, -1 if it is from a newer version, 0 if it is
+// damaged.
+int check_data_file(const char *map, size_t size, DataFileHeader *header) {
+    if (size < DATA_FILE_HEADER_SIZE || !decode_header((const unsigned char *)map, header)) return 0;
+    if (header->version > DATA_FILE_VERSION) return -1;
+    if (header->version < 3) return 0;
+    
+    long long count = header->count;
+    long long body = header->crc_offset - DATA_FILE_HEADER_SIZE;
+    long long blocks = (body + DATA_FILE_CRC_BLOCK - 1) / DATA_FILE_CRC_BLOCK;
+    long long text_size = header->crc_offset - header->text_offset;
+    int columns = header->version >= 5 ? 6 : 5;
+    if (header->version < 5) header->currency_count = 0;
+    int valid = count >= 0 &&
+                header->category_count >= 0 && header->description_blocks >= 0 &&
+                header->currency_count >= 0 && header->currency_count <= MAX_CURRENCIES &&
+                header->next_id > 0 && body >= 0 &&
+                header->names_offset == data_column_offset(header->version, columns, count) &&
+                header->text_offset >= header->names_offset + header->category_count + 4LL * header->currency_count &&
+                text_size >= 0 &&
+                text_size <= (long long)header->description_blocks * DESCRIPTION_BLOCK_SIZE &&
+                header->file_size == header->crc_offset + 4 * blocks &&
+                header->file_size == (long long)size;
+    for (int k = 0; k < 5; k++) {
+        valid = valid && header->column_offsets[k] == data_column_offset(header->version, k, count);
+    }
+    if (!valid) return 0;
+    
+    const unsigned char *table = (const unsigned char *)map + header->crc_offset;
+    if (crc32(0, table, 4 * blocks) != header->crc_table_crc) return 0;
+    for (long long b = 0; b < blocks; b++) {
+        long long start = DATA_FILE_HEADER_SIZE + b * DATA_FILE_CRC_BLOCK;
+        long long length = body - b * DATA_FILE_CRC_BLOCK;
+        if (length > DATA_FILE_CRC_BLOCK) length = DATA_FILE_CRC_BLOCK;
+        if (crc32(0, map + start, length) != get_le32(table + 4 * b)) return 0;
+    }
+    
+    // The names must be NUL-terminated and short enough to intern, and the
+    // currency codes three letters
+    const char *name = map + header->names_offset;
+    const char *names_end = map + header->text_offset;
+    for (int k = 0; k < header->category_count + header->currency_count; k++) {
+        const char *end = memchr(name, 0, names_end - name);
+        if (end == NULL || end - name >= MAX_CATEGORY_LENGTH) return 0;
+        if (k >= header->category_count && end - name != 3) return 0;
+        name = end + 1;
+    }
+    
+    // Category ids, currency ids and description offsets index memory
+    // directly later
+    const unsigned char *categories = (const unsigned char *)map + header->column_offsets[3];
+    const unsigned char *descriptions = (const unsigned char *)map + header->column_offsets[4];
+    const unsigned char *currencies = (const unsigned char *)map + data_column_offset(header->version, 5, count);
+    for (long long i = 0; i < count; i++) {
+        unsigned int category = get_le32(categories + 4 * i);
+        unsigned int offset = get_le32(descriptions + 4 * i);
+        if (category >= (unsigned int)header->category_count || offset >= text_size ||
+            (columns == 6 && currencies[i] >= header->currency_count) ||
+            memchr(map + header->text_offset + offset, 0, text_size - offset) == NULL) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Bytes per value in a column of a data file of the given version
+int data_column_width(int version, int column) {
+    if (column == 5) return 1;
+    return column == 2 && version >= 4 ? 8 : 4;
+}
+
+// Where a column starts in a data file holding `count` records; the column
+// after the last (5, or 6 from version 5 on) is where the names follow
+long long data_column_offset(int version, int column, long long count) {
+    long long offset = DATA_FILE_HEADER_SIZE;
+    for (int k = 0; k < column; k++) offset += data_column_width(version, k) * count;
+    return offset;
+}
+
+// Moves a damaged data file aside, so that saving does not overwrite what
+// might still be recovered from it, and says so
+void quarantine_data_file() {
+    char damaged_path[FILENAME_MAX];
+    char message[FILENAME_MAX + 64];
+    snprintf(damaged_path, sizeof(damaged_path), "%s.damaged", data_path);
+    remove(damaged_path);
+    if (rename(data_path, damaged_path) == 0) {
+        snprintf(message, sizeof(message), "Data file is damaged; it was moved to %s. Starting fresh.", damaged_path);
+    } else {
+        snprintf(message, sizeof(message), "Data file is damaged. Starting fresh.");
+    }
+    print_error(message);
+}
+
+// expense --convert <input> [output]: rewrites a data file in any format
+// this version reads, such as the original record format, in the current
+// format. Converts in place unless an output is given.
+int convert_data_file(int argc, char *argv[]) {
+    if (argc < 1) {
+        fprintf(stderr, "Usage: expense --convert <input> [output]\n");
+        return 1;
+    }
+    
+    FILE *input = fopen(argv[0], "rb");
+    if (input == NULL) {
+        fprintf(stderr, "Cannot open %s\n", argv[0]);
+        return 1;
+    }
+    fclose(input);
+    
+    data_path = argv[0];
+    if (!read_data_file()) return 1;
+    int renumbered = indexes_ready ? renumber_duplicate_ids() : 0;
+    
+    const char *output = argc > 1 ? argv[1] : argv[0];
+    int saved = save_data_file(output, checkpoint_sequence);
+    if (saved) {
+        printf("Converted %d expenses to %s", expense_count, output);
+        if (renumbered > 0) printf(" (%d given new IDs)", renumbered);
+        printf("\n");
+    }
+    free_expenses();
+    data_path = FILENAME;
+    return !saved;
+}
+
+// Maps a whole file privately: written pages become private copies and the
+// file itself never changes. Windows builds read the file into memory
+// instead, since a mapped file there could not be replaced at a checkpoint.
+// Returns NULL if the file cannot be opened, is empty or cannot be mapped.
+char *map_file(const char *path, size_t *size) {
+    #ifdef _WIN32
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) return NULL;
+    char *map = NULL;
+    long length = fseek(file, 0, SEEK_END) == 0 ? ftell(file) : -1;
+    if (length > 0 && fseek(file, 0, SEEK_SET) == 0 && (map = malloc(length)) != NULL &&
+        fread(map, 1, length, file) != (size_t)length) {
+        free(map);
+        map = NULL;
+    }
+    fclose(file);
+    *size = length > 0 ? (size_t)length : 0;
+    return map;
+    #else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    void *map = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+    *size = info.st_size;
+    return map;
+    #endif
+}
+
+void unmap_file(char *map, size_t size) {
+    #ifdef _WIN32
+    (void)size;
+    free(map);
+    #else
+    munmap(map, size);
+    #endif
+}
+
+void encode_header(const DataFileHeader *header, unsigned char *bytes) {
+    memset(bytes, 0, DATA_FILE_HEADER_SIZE);
+    memcpy(bytes, DATA_FILE_MAGIC, 8);
+    put_le32(bytes + 8, header->version);
+    put_le32(bytes + 12, DATA_FILE_HEADER_SIZE);
+    put_le32(bytes + 16, header->count);
+    put_le32(bytes + 20, header->next_id);
+    put_le32(bytes + 24, header->checkpoint_sequence);
+    put_le32(bytes + 28, header->category_count);
+    put_le32(bytes + 32, header->description_blocks);
+    put_le32(bytes + 36, DATA_FILE_CRC_BLOCK);
+    for (int k = 0; k < 5; k++) {
+        put_le64(bytes + 40 + 8 * k, header->column_offsets[k]);
+    }
+    put_le64(bytes + 80, header->names_offset);
+    put_le64(bytes + 88, header->text_offset);
+    put_le64(bytes + 96, header->crc_offset);
+    put_le64(bytes + 104, header->file_size);
+    put_le32(bytes + 112, header->crc_table_crc);
+    put_le32(bytes + 116, header->currency_count);
+    put_le32(bytes + DATA_FILE_HEADER_SIZE - 4, crc32(0, bytes, DATA_FILE_HEADER_SIZE - 4));
+}
+
+// Returns 0 unless the bytes hold a data file header with a matching CRC
+int decode_header(const unsigned char *bytes, DataFileHeader *header) {
+    if (memcmp(bytes, DATA_FILE_MAGIC, 8) != 0 ||
+        get_le32(bytes + DATA_FILE_HEADER_SIZE - 4) != crc32(0, bytes, DATA_FILE_HEADER_SIZE - 4) ||
+        get_le32(bytes + 12) != DATA_FILE_HEADER_SIZE || get_le32(bytes + 36) != DATA_FILE_CRC_BLOCK) {
+        return 0;
+    }
+    header->version = (int)get_le32(bytes + 8);
+    header->count = (int)get_le32(bytes + 16);
+    header->next_id = (int)get_le32(bytes + 20);
+    header->checkpoint_sequence = (int)get_le32(bytes + 24);
+    header->category_count = (int)get_le32(bytes + 28);
+    header->description_blocks = (int)get_le32(bytes + 32);
+    for (int k = 0; k < 5; k++) {
+        header->column_offsets[k] = get_le64(bytes + 40 + 8 * k);
+    }
+    header->names_offset = get_le64(bytes + 80);
+    header->text_offset = get_le64(bytes + 88);
+    header->crc_offset = get_le64(bytes + 96);
+    header->file_size = get_le64(bytes + 104);
+    header->crc_table_crc = get_le32(bytes + 112);
+    header->currency_count = (int)get_le32(bytes + 116);
+    return 1;
+}
+
+// CRC-32 (the zlib polynomial), continuing from `crc`; start from 0. Reads
+// eight bytes per step through eight derived tables.
+unsigned int crc32(unsigned int crc, const void *bytes, size_t length) {
+    static unsigned int table[8][256];
+    static int table_ready = 0;
+    if (!table_ready) {
+        for (unsigned int n = 0; n < 256; n++) {
+            unsigned int c = n;
+            for (int k = 0; k < 8; k++) c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[0][n] = c;
+        }
+        for (unsigned int n = 0; n < 256; n++) {
+            for (int t = 1; t < 8; t++) {
+                table[t][n] = (table[t - 1][n] >> 8) ^ table[0][table[t - 1][n] & 0xFF];
+            }
+        }
+        table_ready = 1;
+    }
+    
+    const unsigned char *next = bytes;
+    crc = ~crc;
+    while (length >= 8) {
+        unsigned int low = crc ^ get_le32(next);
+        unsigned int high = get_le32(next + 4);
+        crc = table[7][low & 0xFF] ^ table[6][(low >> 8) & 0xFF] ^
+              table[5][(low >> 16) & 0xFF] ^ table[4][low >> 24] ^
+              table[3][high & 0xFF] ^ table[2][(high >> 8) & 0xFF] ^
+              table[1][(high >> 16) & 0xFF] ^ table[0][high >> 24];
+        next += 8;
+        length -= 8;
+    }
+    while (length-- > 0) {
+        crc = table[0][(crc ^ *next++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+void put_le32(unsigned char *bytes, unsigned int value) {
+    bytes[0] = value & 0xFF;
+    bytes[1] = (value >> 8) & 0xFF;
+    bytes[2] = (value >> 16) & 0xFF;
+    bytes[3] = (value >> 24) & 0xFF;
+}
+
+void put_le64(unsigned char *bytes, long long value) {
+    put_le32(bytes, (unsigned int)((unsigned long long)value & 0xFFFFFFFFu));
+    put_le32(bytes + 4, (unsigned int)((unsigned long long)value >> 32));
+}
+
+unsigned int get_le32(const unsigned char *bytes) {
+    return (unsigned int)bytes[0] | (unsigned int)bytes[1] << 8 |
+           (unsigned int)bytes[2] << 16 | (unsigned int)bytes[3] << 24;
+}
+
+long long get_le64(const unsigned char *bytes) {
+    return (long long)((unsigned long long)get_le32(bytes) | (unsigned long long)get_le32(bytes + 4) << 32);
+}
+
+int host_is_little_endian() {
+    const unsigned int one = 1;
+    return *(const unsigned char *)&one == 1;
+}
+
+void swap_words(unsigned int *words, long long count) {
+    for (long long i = 0; i < count; i++) {
+        unsigned int w = words[i];
+        words[i] = (w >> 24) | ((w >> 8) & 0xFF00u) | ((w << 8) & 0xFF0000u) | (w << 24);
+    }
+}
+
+void swap_longs(unsigned long long *longs, long long count) {
+    for (long long i = 0; i < count; i++) {
+        unsigned int low = (unsigned int)longs[i];
+        unsigned int high = (unsigned int)(longs[i] >> 32);
+        swap_words(&low, 1);
+        swap_words(&high, 1);
+        longs[i] = (unsigned long long)low << 32 | high;
+    }
+}
+
+// Journal
+// Appends one change to the journal. It is durable once journal_commit()
+// returns. Returns 0 if there is no journal or the write failed.
+int journal_record(int op, const Expense *expense) {
+    if (journal_file == NULL) return 0;
+    
+    JournalEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.op = op;
+    entry.expense = *expense;
+    entry.checksum = journal_checksum(&entry, offsetof(JournalEntry, checksum));
+    if (fwrite(&entry, sizeof(entry), 1, journal_file) != 1) {
+        print_warning("Could not write to the journal; changes will be saved on exit.");
+        return 0;
+    }
+    journal_entries++;
+    journal_pending++;
+    return 1;
+}
+
+// Syncs the entries recorded since the last commit, so a batch of changes
+// costs one sync. Folds the journal into the data file once it holds more
+// entries than half the live records, which keeps each checkpoint paid for
+// by the changes before it. Returns 0 if the sync failed.
+int journal_commit() {
+    if (journal_file == NULL || journal_pending == 0) return 1;
+    
+    journal_pending = 0;
+    if (!sync_file(journal_file)) {
+        print_warning("Could not sync the journal; changes will be saved on exit.");
+        return 0;
+    }
+    if (journal_entries >= JOURNAL_CHECKPOINT_ENTRIES && journal_entries > expense_count / 2) {
+        checkpoint_data();
+    }
+    return 1;
+}
+
+// Starts an empty journal for the current checkpoint. Returns 0 if it
+// could not be created.
+int journal_reset() {
+    journal_close();
+    
+    journal_file = fopen(journal_path, "wb");
+    if (journal_file == NULL) return 0;
+    if (fwrite(JOURNAL_TAG, 1, 4, journal_file) != 4 ||
+        fwrite(&checkpoint_sequence, sizeof(int), 1, journal_file) != 1 ||
+        !sync_file(journal_file)) {
+        journal_close();
+        return 0;
+    }
+    return 1;
+}
+
+// Reopens the journal left by the last session to add to it. It already
+// holds `entries` changes since the checkpoint. Returns 0 if it could not be
+// opened.
+int journal_resume(int entries) {
+    journal_close();
+    
+    journal_file = fopen(journal_path, "ab");
+    if (journal_file == NULL) return 0;
+    journal_entries = entries;
+    return 1;
+}
+
+void journal_close() {
+    if (journal_file != NULL) {
+        fclose(journal_file);
+        journal_file = NULL;
+    }
+    journal_entries = 0;
+    journal_pending = 0;
+}
+
+// Applies the journal left by the last session to the loaded store, up to
+// the first torn or damaged entry. A journal from another checkpoint is
+// ignored. Sets `intact` if the journal belongs to the loaded checkpoint and
+// every entry in it was applied, so more can be appended to it; a journal in
+// an older format never is. Returns the number of entries applied.
+int replay_journal(int *intact) {
+    *intact = 0;
+    FILE *file = fopen(journal_path, "rb");
+    if (file == NULL) return 0;
+    
+    // Journals of older versions are told apart by their tag
+    const char *tags[3] = {LEGACY_JOURNAL_TAG, SINGLE_CURRENCY_JOURNAL_TAG, JOURNAL_TAG};
+    char tag[4];
+    int sequence, version = 0;
+    if (fread(tag, 1, 4, file) == 4) {
+        for (int k = 0; k < 3; k++) {
+            if (memcmp(tag, tags[k], 4) == 0) version = k + 1;
+        }
+    }
+    if (version == 0 || fread(&sequence, sizeof(int), 1, file) != 1 || sequence != checkpoint_sequence) {
+        fclose(file);
+        return 0;
+    }
+    
+    int applied = 0;
+    JournalEntry entry;
+    while (read_journal_entry(file, version, &entry)) {
+        int slot = find_expense_by_id(entry.expense.id);
+        int ok = 1;
+        if (entry.op == JOURNAL_ADD && slot == -1) {
+            ok = append_expense(&entry.expense);
+        } else if (entry.op == JOURNAL_MODIFY && slot != -1) {
+            ok = write_expense(slot, &entry.expense);
+        } else if (entry.op == JOURNAL_DELETE && slot != -1) {
+            remove_expense_at(slot);
+        }
+        if (!ok) {
+            print_error("Out of memory while replaying the journal!");
+            fclose(file);
+            return applied;
+        }
+        applied++;
+    }
+    
+    // Anything past the last applied entry is a torn or damaged tail
+    *intact = version == 3 && fseek(file, 0, SEEK_END) == 0 &&
+              ftell(file) == (long)(4 + sizeof(int) + applied * sizeof(JournalEntry));
+    fclose(file);
+    return applied;
+}
+
+// Reads the next entry of a journal, converting one of an older version: 1
+// for float amounts, 2 for amounts without a currency, 3 for the current
+// one. Returns 0 at the end of the journal or at a torn or damaged entry.
+int read_journal_entry(FILE *file, int version, JournalEntry *entry) {
+    if (version == 3) {
+        return fread(entry, sizeof(*entry), 1, file) == 1 &&
+               entry->checksum == journal_checksum(entry, offsetof(JournalEntry, checksum));
+    }
+    if (version == 2) {
+        SingleCurrencyJournalEntry single;
+        if (fread(&single, sizeof(single), 1, file) != 1 ||
+            single.checksum != journal_checksum(&single, offsetof(SingleCurrencyJournalEntry, checksum))) {
+            return 0;
+        }
+        memset(entry, 0, sizeof(*entry));
+        entry->op = single.op;
+        entry->expense.id = single.expense.id;
+        memcpy(entry->expense.date, single.expense.date, sizeof(entry->expense.date));
+        entry->expense.amount = single.expense.amount;
+        memcpy(entry->expense.category, single.expense.category, MAX_CATEGORY_LENGTH);
+        memcpy(entry->expense.description, single.expense.description, MAX_DESCRIPTION_LENGTH);
+        return 1;
+    }
+    
+    LegacyJournalEntry old;
+    if (fread(&old, sizeof(old), 1, file) != 1 ||
+        old.checksum != journal_checksum(&old, offsetof(LegacyJournalEntry, checksum))) {
+        return 0;
+    }
+    entry->op = old.op;
+    expense_from_legacy(&old.expense, &entry->expense);
+    return 1;
+}
+
+// FNV-1a over the first `length` bytes of an entry: the op and the record
+unsigned int journal_checksum(const void *entry, size_t length) {
+    const unsigned char *bytes = entry;
+    unsigned int hash = 2166136261u;
+    for (size_t k = 0; k < length; k++) {
+        hash = (hash ^ bytes[k]) * 16777619u;
+    }
+    return hash;
+}
+
+// Flushes a stream and asks the OS to put it on disk. Returns 0 on failure.
+int sync_file(FILE *file) {
+    if (fflush(file) != 0) return 0;
+    #ifdef _WIN32
+    return _commit(_fileno(file)) == 0;
+    #else
+    return fsync(fileno(file)) == 0;
+    #endif
+}
+
+// Expense store
+ExpenseChunk *chunk_of(int index) {
+    return expense_chunks[index / EXPENSE_CHUNK_SIZE];
+}
+
+// Number of slots used in the given chunk
+int chunk_rows(int chunk) {
+    int rows = slot_count - chunk * EXPENSE_CHUNK_SIZE;
+    return rows > EXPENSE_CHUNK_SIZE ? EXPENSE_CHUNK_SIZE : rows;
+}
+
+// Makes sure chunks exist for at least `count` slots. Returns 0 if memory
+// is exhausted.
+int reserve_expenses(int count) {
+    int needed = (count + EXPENSE_CHUNK_SIZE - 1) / EXPENSE_CHUNK_SIZE;
+    
+    if (needed > chunk_capacity) {
+        int new_capacity = chunk_capacity == 0 ? 16 : chunk_capacity;
+        while (new_capacity < needed) new_capacity *= 2;
+        ExpenseChunk **grown = realloc(expense_chunks, new_capacity * sizeof(ExpenseChunk *));
+        if (grown == NULL) return 0;
+        expense_chunks = grown;
+        chunk_capacity = new_capacity;
+    }
+    
+    while (chunk_count < needed) {
+        expense_chunks[chunk_count] = allocate_chunk();
+        if (expense_chunks[chunk_count] == NULL) return 0;
+        chunk_count++;
+    }
+    
+    return 1;
+}
+
+// Allocates a chunk and its columns in one block, so one free() releases both
+ExpenseChunk *allocate_chunk() {
+    size_t row_bytes = 4 * sizeof(int) + sizeof(Money) + 2;
+    ExpenseChunk *chunk = malloc(sizeof(ExpenseChunk) + EXPENSE_CHUNK_SIZE * row_bytes);
+    if (chunk == NULL) return NULL;
+    
+    char *columns = (char *)(chunk + 1);
+    chunk->ids = (int *)columns;
+    chunk->dates = chunk->ids + EXPENSE_CHUNK_SIZE;
+    chunk->amounts = (Money *)(chunk->dates + EXPENSE_CHUNK_SIZE);
+    chunk->categories = (int *)(chunk->amounts + EXPENSE_CHUNK_SIZE);
+    chunk->descriptions = (unsigned int *)(chunk->categories + EXPENSE_CHUNK_SIZE);
+    chunk->currencies = (unsigned char *)(chunk->descriptions + EXPENSE_CHUNK_SIZE);
+    chunk->deleted = chunk->currencies + EXPENSE_CHUNK_SIZE;
+    return chunk;
+}
+
+// Appends a record to the end of the store. Returns 0 if memory is exhausted.
+int append_expense(const Expense *expense) {
+    if (!reserve_expenses(slot_count + 1)) return 0;
+    
+    ExpenseChunk *chunk = chunk_of(slot_count);
+    int row = slot_count % EXPENSE_CHUNK_SIZE;
+    
+    int day;
+    parse_date(expense->date, &day);
+    int category = intern_category(expense->category);
+    int currency = intern_currency(expense->currency);
+    if (category < 0 || currency < 0) return 0;
+    if (!store_description(expense->description, &chunk->descriptions[row])) return 0;
+    if (indexes_ready) {
+        if (!date_index_add(day, slot_count)) return 0;
+        if (!slot_list_add(&category_slots[category], slot_count)) return 0;
+        if (!id_index_put(expense->id, slot_count)) return 0;
+    }
+    
+    chunk->ids[row] = expense->id;
+    chunk->dates[row] = day;
+    chunk->amounts[row] = expense->amount;
+    chunk->categories[row] = category;
+    chunk->currencies[row] = currency;
+    chunk->deleted[row] = 0;
+    if (expense->id >= next_expense_id) {
+        next_expense_id = expense->id == INT_MAX ? INT_MAX : expense->id + 1;
+    }
+    slot_count++;
+    expense_count++;
+    if (aggregates_ready) {
+        aggregate_expense(slot_count - 1, 1);
+        aggregate_amount(slot_count - 1);
+    }
+    if (rollups_ready) rollup_expense(slot_count - 1, 1);
+    if (day_trees_ready) day_tree_update(slot_count - 1, 1);
+    if (text_index_ready && index_description(slot_count - 1) < 0) free_text_index();
+    return 1;
+}
+
+// Overwrites the record in the given slot, keeping its id. Returns 0 if
+// memory is exhausted. May compact the store, which renumbers slots.
+int write_expense(int index, const Expense *expense) {
+    ExpenseChunk *chunk = chunk_of(index);
+    int row = index % EXPENSE_CHUNK_SIZE;
+    
+    int day;
+    parse_date(expense->date, &day);
+    int category = intern_category(expense->category);
+    int currency = intern_currency(expense->currency);
+    if (category < 0 || currency < 0) return 0;
+    
+    // Unchanged descriptions keep their text; changed ones are appended to the
+    // arena and the old text is left behind until the next compaction
+    unsigned int description = chunk->descriptions[row];
+    if (strcmp(description_text(description), expense->description) != 0 &&
+        !store_description(expense->description, &description)) {
+        return 0;
+    }
+    int described_anew = description != chunk->descriptions[row];
+    if ((described_anew || category != chunk->categories[row]) && !slot_list_add(&restated_slots, index)) return 0;
+    
+    // File the slot under its new day and category; the old entries go stale
+    if (indexes_ready && day != chunk->dates[row]) {
+        if (!date_index_add(day, index)) return 0;
+        garbage_count++;
+    }
+    if (indexes_ready && category != chunk->categories[row]) {
+        if (!slot_list_add(&category_slots[category], index)) return 0;
+        garbage_count++;
+    }
+    if (text_index_ready && described_anew) {
+        garbage_count += count_tokens(description_text(chunk->descriptions[row]));
+    }
+    
+    // The amount heaps order records by their amount in the base currency
+    Money old_amount = base_amount(chunk, row);
+    if (aggregates_ready) aggregate_expense(index, -1);
+    if (rollups_ready) rollup_expense(index, -1);
+    if (day_trees_ready) day_tree_update(index, -1);
+    chunk->dates[row] = day;
+    chunk->amounts[row] = expense->amount;
+    chunk->categories[row] = category;
+    chunk->currencies[row] = currency;
+    chunk->descriptions[row] = description;
+    if (aggregates_ready) {
+        aggregate_expense(index, 1);
+        if (base_amount(chunk, row) != old_amount) {
+            aggregate_amount(index);
+            garbage_count += 2;
+        }
+    }
+    if (rollups_ready) rollup_expense(index, 1);
+    if (day_trees_ready) day_tree_update(index, 1);
+    if (text_index_ready && described_anew && index_description(index) < 0) free_text_index();
+    
+    compact_if_needed();
+    return 1;
+}
+
+void read_expense(int index, Expense *expense) {
+    ExpenseChunk *chunk = chunk_of(index);
+    int row = index % EXPENSE_CHUNK_SIZE;
+    
+    expense->id = chunk->ids[row];
+    format_date(chunk->dates[row], expense->date);
+    expense->amount = chunk->amounts[row];
+    strcpy(expense->currency, currency_code(chunk->currencies[row]));
+    strcpy(expense->category, category_names[chunk->categories[row]]);
+    strcpy(expense->description, description_text(chunk->descriptions[row]));
+}
+
+// Deletes the record in the given slot by marking a tombstone. May compact
+// the store, which renumbers slots.
+void remove_expense_at(int index) {
+    ExpenseChunk *chunk = chunk_of(index);
+    int row = index % EXPENSE_CHUNK_SIZE;
+    
+    if (chunk->deleted[row]) return;
+    if (aggregates_ready) aggregate_expense(index, -1);
+    if (rollups_ready) rollup_expense(index, -1);
+    if (day_trees_ready) day_tree_update(index, -1);
+    chunk->deleted[row] = 1;
+    if (indexes_ready) id_index_remove(chunk->ids[row]);
+    expense_count--;
+    garbage_count++;
+    
+    compact_if_needed();
+}
+
+// Returns the slot holding the given id, or -1 if there is none
+int find_expense_by_id(int id) {
+    if (!require_indexes()) return -1;
+    return id_index_get(id);
+}
+
+// Builds the indexes of a store loaded in place, the first time they are
+// needed. Returns 0 if memory is exhausted.
+int require_indexes() {
+    if (indexes_ready) return 1;
+    if (!rebuild_indexes()) {
+        print_error("Out of memory while indexing expenses!");
+        return 0;
+    }
+    indexes_ready = 1;
+    return 1;
+}
+
+// Hands out the next expense id, or 0 once every positive int has been used
+int allocate_expense_id() {
+    if (next_expense_id == INT_MAX) return 0;
+    return next_expense_id++;
+}
+
+// Gives a fresh id to every live record whose id is not positive or is
+// already held by an earlier record, as older versions could write after a
+// delete. Returns the number of records renumbered.
+int renumber_duplicate_ids() {
+    int renumbered = 0;
+    for (int slot = 0; slot < slot_count; slot++) {
+        ExpenseChunk *chunk = chunk_of(slot);
+        int row = slot % EXPENSE_CHUNK_SIZE;
+        if (chunk->deleted[row]) continue;
+        if (chunk->ids[row] > 0 && id_index_get(chunk->ids[row]) == slot) continue;
+        
+        int id = allocate_expense_id();
+        if (id == 0 || !id_index_put(id, slot)) break;
+        chunk->ids[row] = id;
+        renumbered++;
+    }
+    return renumbered;
+}
+
+int slot_is_live(int slot) {
+    return !chunk_of(slot)->deleted[slot % EXPENSE_CHUNK_SIZE];
+}
+
+// Compacts once dead slots and stale index entries outnumber live records,
+// so each compaction is paid for by as many deletes and modifies as it
+// has records to move.
+void compact_if_needed() {
+    if (garbage_count > COMPACTION_THRESHOLD && garbage_count > expense_count) {
+        if (!compact_expenses()) {
+            print_warning("Out of memory while compacting the expense store.");
+        }
+    }
+}
+
+// Squeezes deleted slots out of the store, keeping live records in order,
+// rewrites the description arena without abandoned text and rebuilds the
+// indexes. Returns 0 if memory is exhausted: with the store untouched if the
+// new arena could not be made, or else with the records moved and the
+// indexes dropped, to be rebuilt when next needed.
+int compact_expenses() {
+    // Work out how many arena blocks the live descriptions need
+    int block = -1;
+    size_t used = 0;
+    for (int slot = 0; slot < slot_count; slot++) {
+        ExpenseChunk *chunk = chunk_of(slot);
+        int row = slot % EXPENSE_CHUNK_SIZE;
+        if (!chunk->deleted[row]) {
+            pack_description(strlen(description_text(chunk->descriptions[row])) + 1, &block, &used);
+        }
+    }
+    int blocks_needed = block + 1;
+    
+    int capacity = blocks_needed < 16 ? 16 : blocks_needed;
+    char **blocks = malloc(capacity * sizeof(char *));
+    if (blocks == NULL) return 0;
+    for (int b = 0; b < blocks_needed; b++) {
+        blocks[b] = calloc(1, DESCRIPTION_BLOCK_SIZE);
+        if (blocks[b] == NULL) {
+            while (b-- > 0) free(blocks[b]);
+            free(blocks);
+            return 0;
+        }
+    }
+    
+    // Move live records down and copy their text into the new arena
+    int live = 0;
+    block = -1;
+    for (int slot = 0; slot < slot_count; slot++) {
+        ExpenseChunk *from = chunk_of(slot);
+        int f = slot % EXPENSE_CHUNK_SIZE;
+        if (from->deleted[f]) continue;
+        
+        const char *text = description_text(from->descriptions[f]);
+        size_t length = strlen(text) + 1;
+        unsigned int offset = pack_description(length, &block, &used);
+        memcpy(blocks[block] + offset % DESCRIPTION_BLOCK_SIZE, text, length);
+        
+        ExpenseChunk *to = chunk_of(live);
+        int t = live % EXPENSE_CHUNK_SIZE;
+        to->ids[t] = from->ids[f];
+        to->dates[t] = from->dates[f];
+        to->amounts[t] = from->amounts[f];
+        to->categories[t] = from->categories[f];
+        to->currencies[t] = from->currencies[f];
+        to->descriptions[t] = offset;
+        to->deleted[t] = 0;
+        live++;
+    }
+    
+    for (int b = description_mapped_blocks; b < description_block_count; b++) {
+        free(description_blocks[b]);
+    }
+    free(description_blocks);
+    description_blocks = blocks;
+    description_block_count = blocks_needed;
+    description_block_capacity = capacity;
+    description_block_used = blocks_needed > 0 ? (int)used : 0;
+    description_mapped_blocks = 0;
+    description_mapped_used = 0;
+    
+    // Release chunks that are now empty
+    slot_count = live;
+    while (chunk_count > 0 && slot_count <= (chunk_count - 1) * EXPENSE_CHUNK_SIZE) {
+        chunk_count--;
+        free(expense_chunks[chunk_count]);
+    }
+    
+    garbage_count = 0;
+    restated_slots.count = 0;
+    restated_slots.unsorted = 0;
+    if (aggregates_ready && !rebuild_aggregates()) aggregates_ready = 0;
+    if (text_index_ready && !rebuild_text_index()) free_text_index();
+    if (indexes_ready && !rebuild_indexes()) {
+        indexes_ready = 0;
+        return 0;
+    }
+    return 1;
+}
+
+void free_expenses() {
+    for (int c = 0; c < chunk_count; c++) {
+        free(expense_chunks[c]);
+    }
+    free(expense_chunks);
+    expense_chunks = NULL;
+    chunk_count = 0;
+    chunk_capacity = 0;
+    slot_count = 0;
+    expense_count = 0;
+    garbage_count = 0;
+    next_expense_id = 1;
+    
+    free_date_index();
+    
+    free(id_table);
+    id_table = NULL;
+    id_table_size = 0;
+    id_table_used = 0;
+    
+    for (int k = 0; k < category_count; k++) {
+        free(category_slots[k].slots);
+    }
+    free_aggregates();
+    free_rollups();
+    free_budgets();
+    free_day_trees();
+    free_text_index();
+    free(restated_slots.slots);
+    restated_slots = (SlotList){NULL, 0, 0, 0};
+    free(category_names);
+    free(category_slots);
+    free(category_totals);
+    free(category_table);
+    category_names = NULL;
+    category_slots = NULL;
+    category_totals = NULL;
+    category_table = NULL;
+    category_count = 0;
+    category_capacity = 0;
+    category_table_size = 0;
+    free_currencies();
+    
+    for (int b = description_mapped_blocks; b < description_block_count; b++) {
+        free(description_blocks[b]);
+    }
+    free(description_blocks);
+    description_blocks = NULL;
+    description_block_count = 0;
+    description_block_capacity = 0;
+    description_block_used = 0;
+    description_mapped_blocks = 0;
+    description_mapped_used = 0;
+    
+    if (data_map != NULL) {
+        unmap_file(data_map, data_map_size);
+        data_map = NULL;
+        data_map_size = 0;
+    }
+    free(mapped_tombstones);
+    mapped_tombstones = NULL;
+    indexes_ready = 1;
+}
+
+// Returns the id of the category with this name, ignoring case, adding it if
+// needed. Returns -1 if memory is exhausted.
+int intern_category(const char *name) {
+    int id = find_category(name);
+    if (id >= 0) return id;
+    
+    if (category_count == category_capacity) {
+        int new_capacity = category_capacity == 0 ? 16 : category_capacity * 2;
+        char (*grown)[MAX_CATEGORY_LENGTH] = realloc(category_names, new_capacity * sizeof(*grown));
+        if (grown == NULL) return -1;
+        category_names = grown;
+        SlotList *grown_slots = realloc(category_slots, new_capacity * sizeof(SlotList));
+        if (grown_slots == NULL) return -1;
+        category_slots = grown_slots;
+        CategoryTotal *grown_totals = realloc(category_totals, new_capacity * sizeof(CategoryTotal));
+        if (grown_totals == NULL) return -1;
+        category_totals = grown_totals;
+        category_capacity = new_capacity;
+    }
+    
+    // Keep the table at most half full
+    if ((category_count + 1) * 2 > category_table_size && !grow_category_table()) return -1;
+    
+    id = category_count++;
+    strncpy(category_names[id], name, MAX_CATEGORY_LENGTH - 1);
+    category_names[id][MAX_CATEGORY_LENGTH - 1] = 0;
+    memset(&category_slots[id], 0, sizeof(SlotList));
+    memset(&category_totals[id], 0, sizeof(CategoryTotal));
+    
+    unsigned int bucket = category_hash(name) & (category_table_size - 1);
+    while (category_table[bucket] >= 0) {
+        bucket = (bucket + 1) & (category_table_size - 1);
+    }
+    category_table[bucket] = id;
+    return id;
+}
+
+// Returns the id of the category with this name, ignoring case, or -1
+int find_category(const char *name) {
+    if (category_table_size == 0) return -1;
+    
+    unsigned int bucket = category_hash(name) & (category_table_size - 1);
+    while (category_table[bucket] >= 0) {
+        if (strcasecmp(category_names[category_table[bucket]], name) == 0) {
+            return category_table[bucket];
+        }
+        bucket = (bucket + 1) & (category_table_size - 1);
+    }
+    return -1;
+}
+
+// FNV-1a over the lowercased name, limited to the stored length
+unsigned int category_hash(const char *name) {
+    unsigned int hash = 2166136261u;
+    for (int i = 0; i < MAX_CATEGORY_LENGTH - 1 && name[i]; i++) {
+        hash ^= (unsigned char)tolower((unsigned char)name[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Doubles the hash table and reinserts every category
+int grow_category_table() {
+    int new_size = category_table_size == 0 ? 32 : category_table_size * 2;
+    int *table = malloc(new_size * sizeof(int));
+    if (table == NULL) return 0;
+    
+    for (int b = 0; b < new_size; b++) table[b] = -1;
+    for (int k = 0; k < category_count; k++) {
+        unsigned int bucket = category_hash(category_names[k]) & (new_size - 1);
+        while (table[bucket] >= 0) {
+            bucket = (bucket + 1) & (new_size - 1);
+        }
+        table[bucket] = k;
+    }
+    
+    free(category_table);
+    category_table = table;
+    category_table_size = new_size;
+    return 1;
+}
+
+// Copies a description into the arena and returns its offset. Strings never
+// straddle blocks, so an offset always resolves to one contiguous string.
+// Blocks start zero-filled, so the room a full block leaves holds no text.
+int store_description(const char *text, unsigned int *offset) {
+    size_t length = strnlen(text, MAX_DESCRIPTION_LENGTH - 1);
+    
+    if (description_block_count == 0 ||
+        description_block_used + length + 1 > DESCRIPTION_BLOCK_SIZE) {
+        if (description_block_count == description_block_capacity) {
+            int new_capacity = description_block_capacity == 0 ? 16 : description_block_capacity * 2;
+            char **grown = realloc(description_blocks, new_capacity * sizeof(char *));
+            if (grown == NULL) return 0;
+            description_blocks = grown;
+            description_block_capacity = new_capacity;
+        }
+        description_blocks[description_block_count] = calloc(1, DESCRIPTION_BLOCK_SIZE);
+        if (description_blocks[description_block_count] == NULL) return 0;
+        description_block_count++;
+        description_block_used = 0;
+    }
+    
+    char *dest = description_blocks[description_block_count - 1] + description_block_used;
+    memcpy(dest, text, length);
+    dest[length] = 0;
+    
+    *offset = (unsigned int)(description_block_count - 1) * DESCRIPTION_BLOCK_SIZE + description_block_used;
+    description_block_used += length + 1;
+    return 1;
+}
+
+const char *description_text(unsigned int offset) {
+    return description_blocks[offset / DESCRIPTION_BLOCK_SIZE] + offset % DESCRIPTION_BLOCK_SIZE;
+}
+
+// Converts a YYYY-MM-DD date into days since 1970-01-01. Returns 1 if the
+// text is a real calendar date; otherwise *day still receives the nearest
+// day the fields add up to (e.g. 2023-02-30 becomes 2023-03-02), which keeps
+// records from older files usable.
+int parse_date(const char *date, int *day) {
+    int valid = strlen(date) == 10 && date[4] == '-' && date[7] == '-';
+    int year = 0, month = 0, day_of_month = 0;
+    
+    for (int i = 0; i < 10 && date[i]; i++) {
+        if (i == 4 || i == 7) continue;
+        if (!isdigit((unsigned char)date[i])) {
+            valid = 0;
+            break;
+        }
+        int digit = date[i] - '0';
+        if (i < 4) year = year * 10 + digit;
+        else if (i < 7) month = month * 10 + digit;
+        else day_of_month = day_of_month * 10 + digit;
+    }
+    
+    static const int month_days[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    int leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+    if (year < 1 || month < 1 || month > 12 || day_of_month < 1 ||
+        day_of_month > month_days[month > 0 && month <= 12 ? month - 1 : 0] + (month == 2 && leap)) {
+        valid = 0;
+    }
+    
+    *day = days_from_civil(year, month, day_of_month);
+    return valid;
+}
+
+// Days since 1970-01-01 in the proleptic Gregorian calendar. Out-of-range
+// months and days roll over into the neighbouring months.
+int days_from_civil(int year, int month, int day) {
+    year += (month - 1) / 12;
+    month = (month - 1) % 12 + 1;
+    if (month < 1) {
+        month += 12;
+        year--;
+    }
+    year -= month <= 2;
+    int era = (year >= 0 ? year : year - 399) / 400;
+    int year_of_era = year - era * 400;
+    int day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + day_of_era - 719468;
+}
+
+void format_date(int day, char *buffer) {
+    int y, month, day_of_month;
+    civil_from_days(day, &y, &month, &day_of_month);
+    unsigned int year = y < 0 ? 0 : (unsigned int)y % 10000;
+    unsigned int m = month, d = day_of_month;
+    
+    // Digit by digit; exports format a date per record
+    buffer[0] = '0' + year / 1000;
+    buffer[1] = '0' + year / 100 % 10;
+    buffer[2] = '0' + year / 10 % 10;
+    buffer[3] = '0' + year % 10;
+    buffer[4] = '-';
+    buffer[5] = '0' + m / 10 % 10;
+    buffer[6] = '0' + m % 10;
+    buffer[7] = '-';
+    buffer[8] = '0' + d / 10 % 10;
+    buffer[9] = '0' + d % 10;
+    buffer[10] = '\0';
+}
+
+// The calendar date of a day counted from 1970-01-01; the inverse of
+// days_from_civil()
+void civil_from_days(int day, int *year, int *month, int *day_of_month) {
+    int z = day + 719468;
+    int era = (z >= 0 ? z : z - 146096) / 146097;
+    int day_of_era = z - era * 146097;
+    int year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    int day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    int mp = (5 * day_of_year + 2) / 153;
+    *day_of_month = day_of_year - (153 * mp + 2) / 5 + 1;
+    *month = mp < 10 ? mp + 3 : mp - 9;
+    *year = year_of_era + era * 400 + (*month <= 2);
+}
+
+// Reads an amount in taka, such as "12", "12.5" or "-0.75", as exact paisa.
+// Leading blanks are skipped. Digits past the second decimal are only
+// accepted as zeros, since they could not be kept. Returns 0 if the text is
+// not such an amount or has more than MAX_MONEY_DIGITS digits of taka.
+int parse_money(const char *text, Money *amount) {
+    const char *p = text;
+    while (*p == ' ' || *p == '\t') p++;
+    int negative = *p == '-';
+    if (*p == '-' || *p == '+') p++;
+    
+    Money whole = 0;
+    int digits = 0, whole_digits = 0;
+    for (; isdigit((unsigned char)*p); p++, digits++) {
+        whole = whole * 10 + (*p - '0');
+        if (whole > 0 && ++whole_digits > MAX_MONEY_DIGITS) return 0;
+    }
+    Money fraction = 0;
+    if (*p == '.') {
+        p++;
+        for (int decimals = 0; isdigit((unsigned char)*p); p++, digits++, decimals++) {
+            if (decimals < 2) fraction += (*p - '0') * (decimals == 0 ? 10 : 1);
+            else if (*p != '0') return 0;
+        }
+    }
+    if (digits == 0 || *p != '\0') return 0;
+    
+    *amount = (whole * MONEY_SCALE + fraction) * (negative ? -1 : 1);
+    return 1;
+}
+
+// Writes an amount as taka with two decimals into a buffer of
+// MONEY_TEXT_SIZE bytes. Returns the buffer, for use in printf() arguments.
+char *format_money(Money amount, char *buffer) {
+    *put_amount(buffer, amount) = '\0';
+    return buffer;
+}
+
+// Writes an amount as format_money() does, followed by its currency's code
+// unless that is the base currency, into a buffer of AMOUNT_TEXT_SIZE bytes.
+// Returns the buffer.
+char *format_amount(Money amount, int currency, char *buffer) {
+    char *end = put_amount(buffer, amount);
+    if (currency > 0) {
+        *end++ = ' ';
+        memcpy(end, currency_code(currency), 3);
+        end += 3;
+    }
+    *end = '\0';
+    return buffer;
+}
+
+// The amount a float in taka from an older file or journal was shown as.
+// printf("%.2f") rounds the float's exact value, and a float times 100 is
+// exact as a double, so the paisa only need rounding, half to even as
+// printf rounds. Amounts too large to keep become 0.
+Money money_from_float(float amount) {
+    double cents = (double)amount * MONEY_SCALE;
+    if (!(cents > -1e17 && cents < 1e17)) return 0;
+    
+    Money whole = (Money)cents;
+    double fraction = cents - (double)whole;
+    if (fraction > 0.5 || (fraction == 0.5 && whole % 2 != 0)) whole++;
+    if (fraction < -0.5 || (fraction == -0.5 && whole % 2 != 0)) whole--;
+    return whole;
+}
+
+// The average of `count` amounts totalling `total`, to the nearest paisa
+// (halves away from zero)
+Money rounded_average(Money total, int count) {
+    if (count <= 0) return 0;
+    Money quotient = total / count, remainder = total % count;
+    if (2 * (remainder < 0 ? -remainder : remainder) >= count) quotient += total < 0 ? -1 : 1;
+    return quotient;
+}
+
+// Prints one record in the five-column table layout shared by the views
+void print_expense_row(const ExpenseChunk *chunk, int row) {
+    char date[11];
+    char amount[AMOUNT_TEXT_SIZE];
+    format_date(chunk->dates[row], date);
+    printf("%-5d %-12s %-15s %-20s %-30s\n",
+           chunk->ids[row],
+           date,
+           format_amount(chunk->amounts[row], chunk->currencies[row], amount),
+           category_names[chunk->categories[row]],
+           description_text(chunk->descriptions[row]));
+}
+
+int validate_date(const char *date) {
+    int day;
+    return parse_date(date, &day);
+}
+
+// Date index
+// Returns the slot list for a day, allocating its page when `create` is set.
+// Returns NULL for days outside the indexed range, for days on unallocated
+// pages when not creating, and when memory is exhausted.
+SlotList *date_index_list(int day, int create) {
+    if (day < FIRST_INDEXED_DAY || day > LAST_INDEXED_DAY) return NULL;
+    
+    int page = (day - FIRST_INDEXED_DAY) / DATE_PAGE_DAYS;
+    if (date_pages[page] == NULL) {
+        if (!create) return NULL;
+        date_pages[page] = calloc(DATE_PAGE_DAYS, sizeof(SlotList));
+        if (date_pages[page] == NULL) return NULL;
+    }
+    return &date_pages[page][(day - FIRST_INDEXED_DAY) % DATE_PAGE_DAYS];
+}
+
+// Records that `slot` is dated `day`. Returns 0 if memory is exhausted. Days
+// outside the indexed range (possible only in damaged files) are not indexed.
+int date_index_add(int day, int slot) {
+    if (day < FIRST_INDEXED_DAY || day > LAST_INDEXED_DAY) return 1;
+    
+    SlotList *list = date_index_list(day, 1);
+    return list != NULL && slot_list_add(list, slot);
+}
+
+// Rebuilds the date index, the category slot lists and the id index from the
+// columns. Lists are emptied rather than freed, so after a compaction, which
+// only shrinks them, this cannot run out of memory.
+int rebuild_indexes() {
+    for (int page = 0; page < DATE_PAGE_COUNT; page++) {
+        if (date_pages[page] == NULL) continue;
+        for (int d = 0; d < DATE_PAGE_DAYS; d++) {
+            date_pages[page][d].count = 0;
+            date_pages[page][d].unsorted = 0;
+        }
+    }
+    for (int k = 0; k < category_count; k++) {
+        category_slots[k].count = 0;
+        category_slots[k].unsorted = 0;
+    }
+    if (id_table != NULL) {
+        memset(id_table, 0, id_table_size * sizeof(IdBucket));
+    }
+    id_table_used = 0;
+    
+    for (int c = 0; c < chunk_count; c++) {
+        ExpenseChunk *chunk = expense_chunks[c];
+        int rows = chunk_rows(c);
+        for (int j = 0; j < rows; j++) {
+            if (chunk->deleted[j]) continue;
+            int slot = c * EXPENSE_CHUNK_SIZE + j;
+            if (!date_index_add(chunk->dates[j], slot)) return 0;
+            if (!slot_list_add(&category_slots[chunk->categories[j]], slot)) return 0;
+            if (!id_index_put(chunk->ids[j], slot)) return 0;
+        }
+    }
+    return 1;
+}
+
+void free_date_index() {
+    for (int page = 0; page < DATE_PAGE_COUNT; page++) {
+        if (date_pages[page] == NULL) continue;
+        for (int d = 0; d < DATE_PAGE_DAYS; d++) {
+            free(date_pages[page][d].slots);
+        }
+        free(date_pages[page]);
+        date_pages[page] = NULL;
+    }
+}
+
+// Appends a slot to a list. Appending a new highest slot keeps the list
+// sorted; anything else marks it for sorting on its next read. Returns 0 if
+// memory is exhausted.
+int slot_list_add(SlotList *list, int slot) {
+    if (list->count == list->capacity) {
+        int new_capacity = list->capacity == 0 ? 4 : list->capacity * 2;
+        int *grown = realloc(list->slots, new_capacity * sizeof(int));
+        if (grown == NULL) return 0;
+        list->slots = grown;
+        list->capacity = new_capacity;
+    }
+    
+    if (list->count > 0 && list->slots[list->count - 1] >= slot) {
+        list->unsorted = 1;
+    }
+    list->slots[list->count++] = slot;
+    return 1;
+}
+
+// Sorts a list marked by slot_list_add and drops duplicate entries. Stale
+// entries are left for readers to filter and for compaction to remove.
+void slot_list_sort(SlotList *list) {
+    if (!list->unsorted) return;
+    
+    qsort(list->slots, list->count, sizeof(int), compare_slots);
+    int kept = 0;
+    for (int k = 0; k < list->count; k++) {
+        if (kept == 0 || list->slots[kept - 1] != list->slots[k]) {
+            list->slots[kept++] = list->slots[k];
+        }
+    }
+    list->count = kept;
+    list->unsorted = 0;
+}
+
+int compare_slots(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+// Id index
+//
+// Open addressing with linear probing; id 0 marks a free bucket.
+unsigned int id_hash(int id) {
+    unsigned int h = (unsigned int)id * 2654435761u;
+    return h ^ (h >> 16);
+}
+
+// Maps an id to its slot. A duplicate id (possible only in files written by
+// older versions) keeps its first slot, and id 0 is never indexed. Returns
+// 0 if memory is exhausted.
+int id_index_put(int id, int slot) {
+    if (id == 0) return 1;
+    
+    if ((id_table_used + 1) * 2 > id_table_size) {
+        int new_size = id_table_size == 0 ? 1024 : id_table_size * 2;
+        IdBucket *table = calloc(new_size, sizeof(IdBucket));
+        if (table == NULL) return 0;
+        
+        unsigned int mask = new_size - 1;
+        for (int b = 0; b < id_table_size; b++) {
+            if (id_table[b].id == 0) continue;
+            unsigned int h = id_hash(id_table[b].id) & mask;
+            while (table[h].id != 0) h = (h + 1) & mask;
+            table[h] = id_table[b];
+        }
+        free(id_table);
+        id_table = table;
+        id_table_size = new_size;
+    }
+    
+    unsigned int mask = id_table_size - 1;
+    unsigned int h = id_hash(id) & mask;
+    while (id_table[h].id != 0) {
+        if (id_table[h].id == id) return 1;
+        h = (h + 1) & mask;
+    }
+    id_table[h].id = id;
+    id_table[h].slot = slot;
+    id_table_used++;
+    return 1;
+}
+
+// Returns the slot holding the id, or -1 if there is none
+int id_index_get(int id) {
+    if (id_table_size == 0 || id == 0) return -1;
+    
+    unsigned int mask = id_table_size - 1;
+    for (unsigned int h = id_hash(id) & mask; id_table[h].id != 0; h = (h + 1) & mask) {
+        if (id_table[h].id == id) return id_table[h].slot;
+    }
+    return -1;
+}
+
+// Removes an id, shifting later buckets of its probe run back into the hole
+// so lookups never stop short of an entry
+void id_index_remove(int id) {
+    if (id_table_size == 0 || id == 0) return;
+    
+    unsigned int mask = id_table_size - 1;
+    unsigned int hole = id_hash(id) & mask;
+    while (id_table[hole].id != id) {
+        if (id_table[hole].id == 0) return;
+        hole = (hole + 1) & mask;
+    }
+    
+    for (unsigned int next = (hole + 1) & mask; id_table[next].id != 0; next = (next + 1) & mask) {
+        unsigned int home = id_hash(id_table[next].id) & mask;
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            id_table[hole] = id_table[next];
+            hole = next;
+        }
+    }
+    id_table[hole].id = 0;
+    id_table_used--;
+}
+
+// Statistics aggregates
+// Builds the aggregates the first time they are needed. Returns 0 (after
+// saying why) if memory is exhausted.
+int require_aggregates() {
+    if (aggregates_ready) return 1;
+    if (!rebuild_aggregates()) {
+        print_error("Out of memory! Cannot compute statistics.");
+        return 0;
+    }
+    aggregates_ready = 1;
+    return 1;
+}
+
+// Recomputes the aggregates with one parallel scan of the amount and
+// category columns, heapifying both heaps at the end. Returns 0 if memory is
+// exhausted.
+int rebuild_aggregates() {
+    amount_total = 0;
+    if (category_count > 0) memset(category_totals, 0, category_count * sizeof(CategoryTotal));
+    highest_amounts.count = 0;
+    lowest_amounts.count = 0;
+    if (!heap_reserve(&highest_amounts, slot_count) || !heap_reserve(&lowest_amounts, expense_count)) {
+        return 0;
+    }
+    
+    // Each chunk puts its heap entries at its own place; they are then
+    // closed up in slot order
+    int threads = scan_threads_for(chunk_count);
+    AggregateScan scan = {NULL, category_stride(), NULL};
+    scan.categories = calloc((size_t)threads * scan.stride, sizeof(CategoryTotal));
+    scan.live = malloc(((size_t)chunk_count + 1) * sizeof(int));
+    if (scan.categories == NULL || scan.live == NULL) {
+        free(scan.categories);
+        free(scan.live);
+        return 0;
+    }
+    run_parallel(chunk_count, threads, aggregate_chunk, &scan);
+    
+    for (int t = 0; t < threads; t++) {
+        const CategoryTotal *part = scan.categories + (size_t)t * scan.stride;
+        for (int k = 0; k < category_count; k++) {
+            category_totals[k].total += part[k].total;
+            category_totals[k].count += part[k].count;
+            amount_total += part[k].total;
+        }
+    }
+    for (int c = 0; c < chunk_count; c++) {
+        memmove(highest_amounts.entries + highest_amounts.count, highest_amounts.entries + (size_t)c * EXPENSE_CHUNK_SIZE,
+                scan.live[c] * sizeof(HeapEntry));
+        highest_amounts.count += scan.live[c];
+    }
+    memcpy(lowest_amounts.entries, highest_amounts.entries, highest_amounts.count * sizeof(HeapEntry));
+    lowest_amounts.count = highest_amounts.count;
+    heapify_amounts(threads);
+    
+    free(scan.categories);
+    free(scan.live);
+    return 1;
+}
+
+// Adds the record in `slot` to the totals (sign 1) or takes it out (sign -1)
+void aggregate_expense(int slot, int sign) {
+    ExpenseChunk *chunk = chunk_of(slot);
+    int row = slot % EXPENSE_CHUNK_SIZE;
+    CategoryTotal *category = &category_totals[chunk->categories[row]];
+    
+    Money amount = base_amount(chunk, row);
+    amount_total += sign * amount;
+    category->total += sign * amount;
+    category->count += sign;
+}
+
+// Files the record in `slot` under its amount in the base currency in both
+// heaps. If memory runs out the aggregates are dropped, to be rebuilt when
+// next needed.
+void aggregate_amount(int slot) {
+    HeapEntry entry = {base_amount(chunk_of(slot), slot % EXPENSE_CHUNK_SIZE), slot};
+    AmountHeap *heaps[2] = {&highest_amounts, &lowest_amounts};
+    
+    for (int h = 0; h < 2; h++) {
+        if (!heap_reserve(heaps[h], heaps[h]->count + 1)) {
+            aggregates_ready = 0;
+            return;
+        }
+        heaps[h]->entries[heaps[h]->count++] = entry;
+        heap_sift_up(heaps[h], heaps[h]->count - 1);
+    }
+}
+
+void free_aggregates() {
+    free(highest_amounts.entries);
+    free(lowest_amounts.entries);
+    highest_amounts.entries = lowest_amounts.entries = NULL;
+    highest_amounts.count = lowest_amounts.count = 0;
+    highest_amounts.capacity = lowest_amounts.capacity = 0;
+    amount_total = 0;
+    aggregates_ready = 0;
+}
+
+// Makes room for `count` entries. Returns 0 if memory is exhausted.
+int heap_reserve(AmountHeap *heap, int count) {
+    if (count <= heap->capacity) return 1;
+    
+    int new_capacity = heap->capacity == 0 ? 64 : heap->capacity;
+    while (new_capacity < count) new_capacity *= 2;
+    HeapEntry *grown = realloc(heap->entries, new_capacity * sizeof(HeapEntry));
+    if (grown == NULL) return 0;
+    heap->entries = grown;
+    heap->capacity = new_capacity;
+    return 1;
+}
+
+// Returns the slot of the highest (or lowest) live expense, first dropping
+// entries for records since deleted or given another amount. Returns -1 if
+// the heap is empty.
+int heap_top(AmountHeap *heap) {
+    while (heap->count > 0) {
+        HeapEntry *top = &heap->entries[0];
+        if (slot_is_live(top->slot) && base_amount(chunk_of(top->slot), top->slot % EXPENSE_CHUNK_SIZE) == top->amount) {
+            return top->slot;
+        }
+        heap->entries[0] = heap->entries[--heap->count];
+        heap_sift_down(heap, 0);
+    }
+    return -1;
+}
+
+void heap_sift_up(AmountHeap *heap, int index) {
+    HeapEntry entry = heap->entries[index];
+    while (index > 0) {
+        int parent = (index - 1) / 2;
+        if (!heap_before(heap, &entry, &heap->entries[parent])) break;
+        heap->entries[index] = heap->entries[parent];
+        index = parent;
+    }
+    heap->entries[index] = entry;
+}
+
+void heap_sift_down(AmountHeap *heap, int index) {
+    HeapEntry entry = heap->entries[index];
+    while (1) {
+        int child = 2 * index + 1;
+        if (child >= heap->count) break;
+        if (child + 1 < heap->count && heap_before(heap, &heap->entries[child + 1], &heap->entries[child])) {
+            child++;
+        }
+        if (!heap_before(heap, &heap->entries[child], &entry)) break;
+        heap->entries[index] = heap->entries[child];
+        index = child;
+    }
+    heap->entries[index] = entry;
+}
+
+// Heap order: by amount, and on equal amounts the earlier slot first, so
+// the dashboard names the same expense a scan in slot order would
+int heap_before(const AmountHeap *heap, const HeapEntry *a, const HeapEntry *b) {
+    if (a->amount != b->amount) {
+        return heap->highest ? a->amount > b->amount : a->amount < b->amount;
+    }
+    return a->slot < b->slot;
+}
+
+// Monthly rollups
+// Builds the rollups the first time they are needed. Returns 0 (after
+// saying why) if memory is exhausted.
+int require_rollups() {
+    if (rollups_ready) return 1;
+    if (!rebuild_rollups()) {
+        print_error("Out of memory! Cannot total expenses by month.");
+        return 0;
+    }
+    rollups_ready = 1;
+    return 1;
+}
+
+// Recomputes the rollups with one scan of the date, amount, category and
+// currency columns. Records added in date order often share a day, so the
+// month is only worked out again when the day changes. Returns 0, with no
+// rollups left, if memory is exhausted.
+int rebuild_rollups() {
+    free_rollups();
+    int month = 0, last_day = INT_MIN;
+    for (int c = 0; c < chunk_count; c++) {
+        ExpenseChunk *chunk = expense_chunks[c];
+        int rows = chunk_rows(c);
+        for (int j = 0; j < rows; j++) {
+            if (chunk->deleted[j]) continue;
+            int day = chunk->dates[j];
+            if (day != last_day) {
+                month = month_of_day(day);
+                last_day = day;
+            }
+            RollupCell *cell = rollup_cell(month, chunk->categories[j], chunk->currencies[j]);
+            if (cell == NULL) {
+                free_rollups();
+                return 0;
+            }
+            cell->total += chunk->amounts[j];
+            cell->count++;
+        }
+    }
+    return 1;
+}
+
+// Adds the record in `slot` to its month's cell (sign 1) or takes it out
+// (sign -1). A month's running total moves by the change in the cell's
+// converted total, so it always adds up the cells as converted. If memory
+// runs out the rollups are dropped, to be rebuilt when next needed.
+void rollup_expense(int slot, int sign) {
+    ExpenseChunk *chunk = chunk_of(slot);
+    int row = slot % EXPENSE_CHUNK_SIZE;
+    RollupCell *cell = rollup_cell(month_of_day(chunk->dates[row]), chunk->categories[row], chunk->currencies[row]);
+    if (cell == NULL) {
+        free_rollups();
+        return;
+    }
+    Money before = cell_total_in(cell, 0);
+    cell->total += sign * chunk->amounts[row];
+    cell->count += sign;
+    if (cell->count == 0) cell->total = 0;
+    Money *total = month_total(cell->month);
+    if (total != NULL) *total += cell_total_in(cell, 0) - before;
+}
+
+// Returns the cell for (month, category, currency), adding an empty one if
+// there is none. Returns NULL if memory is exhausted.
+RollupCell *rollup_cell(int month, int category, int currency) {
+    // Keep the table at most half full
+    if ((rollup_table_used + 1) * 2 > rollup_table_size && !grow_rollup_table()) return NULL;
+    
+    unsigned int mask = rollup_table_size - 1;
+    unsigned int bucket = rollup_hash(month, category, currency) & mask;
+    while (rollup_table[bucket].category >= 0) {
+        if (rollup_table[bucket].month == month && rollup_table[bucket].category == category &&
+            rollup_table[bucket].currency == currency) {
+            return &rollup_table[bucket];
+        }
+        bucket = (bucket + 1) & mask;
+    }
+    
+    RollupCell *cell = &rollup_table[bucket];
+    cell->month = month;
+    cell->category = category;
+    cell->currency = currency;
+    cell->count = 0;
+    cell->total = 0;
+    rollup_table_used++;
+    return cell;
+}
+
+// Returns the cell for (month, category, currency), or NULL if there is none
+RollupCell *find_rollup_cell(int month, int category, int currency) {
+    if (rollup_table_size == 0) return NULL;
+    
+    unsigned int mask = rollup_table_size - 1;
+    unsigned int bucket = rollup_hash(month, category, currency) & mask;
+    while (rollup_table[bucket].category >= 0) {
+        if (rollup_table[bucket].month == month && rollup_table[bucket].category == category &&
+            rollup_table[bucket].currency == currency) {
+            return &rollup_table[bucket];
+        }
+        bucket = (bucket + 1) & mask;
+    }
+    return NULL;
+}
+
+// A category's total for a month in the base currency: its cells in each
+// currency, each converted at the month's rate
+Money rollup_total(int month, int category) {
+    Money total = 0;
+    for (int k = 0; k < currency_count; k++) {
+        RollupCell *cell = find_rollup_cell(month, category, k);
+        if (cell != NULL) total += cell_total_in(cell, 0);
+    }
+    return total;
+}
+
+// Doubles the table and reinserts every cell
+int grow_rollup_table() {
+    int new_size = rollup_table_size == 0 ? 256 : rollup_table_size * 2;
+    RollupCell *table = malloc(new_size * sizeof(RollupCell));
+    if (table == NULL) return 0;
+    
+    for (int b = 0; b < new_size; b++) table[b].category = -1;
+    for (int b = 0; b < rollup_table_size; b++) {
+        if (rollup_table[b].category < 0) continue;
+        unsigned int bucket = rollup_hash(rollup_table[b].month, rollup_table[b].category, rollup_table[b].currency) &
+                              (new_size - 1);
+        while (table[bucket].category >= 0) {
+            bucket = (bucket + 1) & (new_size - 1);
+        }
+        table[bucket] = rollup_table[b];
+    }
+    
+    free(rollup_table);
+    rollup_table = table;
+    rollup_table_size = new_size;
+    return 1;
+}
+
+unsigned int rollup_hash(int month, int category, int currency) {
+    return id_hash(month * 1021 + category) ^ id_hash(currency);
+}
+
+void free_rollups() {
+    free(rollup_table);
+    free(month_totals);
+    rollup_table = NULL;
+    month_totals = NULL;
+    rollup_table_size = 0;
+    rollup_table_used = 0;
+    rollups_ready = 0;
+}
+
+// The month a day falls in, counted as year * 12 + month - 1
+int month_of_day(int day) {
+    int year, month, day_of_month;
+    civil_from_days(day, &year, &month, &day_of_month);
+    return year * 12 + month - 1;
+}
+
+// Reads back the rollups saved with the data file, if they were saved by
+// the checkpoint that wrote it. Returns 1 if they were; otherwise they are
+// left to be rebuilt when needed. They are only a summary of the data file,
+// so a missing or damaged copy is not worth a warning.
+//
+// The file holds a ROLLUP_HEADER_SIZE header (the magic, version,
+// checkpoint sequence, category count, expense count, cell count and the
+// CRC-32 of the cells, as little-endian 32-bit values) and then a
+// ROLLUP_CELL_SIZE entry per cell in use: month, category, currency and
+// count as 32-bit values and the total in paisa of the cell's currency as a
+// 64-bit value.
+int load_rollups() {
+    char path[FILENAME_MAX];
+    rollup_file_path(path, sizeof(path));
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) return 0;
+    
+    unsigned char header[ROLLUP_HEADER_SIZE];
+    int ok = fread(header, 1, sizeof(header), file) == sizeof(header) &&
+             memcmp(header, ROLLUP_FILE_MAGIC, 8) == 0 &&
+             get_le32(header + 8) == ROLLUP_FILE_VERSION &&
+             (int)get_le32(header + 12) == checkpoint_sequence &&
+             (int)get_le32(header + 16) == category_count &&
+             (int)get_le32(header + 20) == expense_count &&
+             get_le32(header + 24) <= (unsigned int)expense_count;
+    int count = ok ? (int)get_le32(header + 24) : 0;
+    unsigned char *cells = malloc((size_t)count * ROLLUP_CELL_SIZE + 1);
+    ok = ok && cells != NULL && fread(cells, ROLLUP_CELL_SIZE, count, file) == (size_t)count &&
+         crc32(0, cells, (size_t)count * ROLLUP_CELL_SIZE) == get_le32(header + 28);
+    fclose(file);
+    
+    free_rollups();
+    for (int k = 0; ok && k < count; k++) {
+        const unsigned char *bytes = cells + (size_t)k * ROLLUP_CELL_SIZE;
+        int category = (int)get_le32(bytes + 4);
+        int currency = (int)get_le32(bytes + 8);
+        RollupCell *cell = category >= 0 && category < category_count && currency >= 0 && currency < currency_count ?
+                           rollup_cell((int)get_le32(bytes), category, currency) : NULL;
+        if (cell == NULL) {
+            ok = 0;
+            break;
+        }
+        cell->count = (int)get_le32(bytes + 12);
+        cell->total = get_le64(bytes + 16);
+    }
+    free(cells);
+    
+    if (!ok) free_rollups();
+    rollups_ready = ok;
+    return ok;
+}
+
+// Saves the cells in use next to the data file, laid out as described at
+// load_rollups(), tagged with the checkpoint sequence the data file was
+// written with. Returns 0 if they could not be written; the file is then
+// removed.
+int save_rollups(int sequence) {
+    int count = 0;
+    for (int b = 0; b < rollup_table_size; b++) {
+        if (rollup_table[b].category >= 0 && rollup_table[b].count > 0) count++;
+    }
+    unsigned char *cells = malloc((size_t)count * ROLLUP_CELL_SIZE + 1);
+    if (cells == NULL) return 0;
+    
+    unsigned char *bytes = cells;
+    for (int b = 0; b < rollup_table_size; b++) {
+        if (rollup_table[b].category < 0 || rollup_table[b].count == 0) continue;
+        put_le32(bytes, rollup_table[b].month);
+        put_le32(bytes + 4, rollup_table[b].category);
+        put_le32(bytes + 8, rollup_table[b].currency);
+        put_le32(bytes + 12, rollup_table[b].count);
+        put_le64(bytes + 16, rollup_table[b].total);
+        bytes += ROLLUP_CELL_SIZE;
+    }
+    
+    unsigned char header[ROLLUP_HEADER_SIZE];
+    memset(header, 0, sizeof(header));
+    memcpy(header, ROLLUP_FILE_MAGIC, 8);
+    put_le32(header + 8, ROLLUP_FILE_VERSION);
+    put_le32(header + 12, sequence);
+    put_le32(header + 16, category_count);
+    put_le32(header + 20, expense_count);
+    put_le32(header + 24, count);
+    put_le32(header + 28, crc32(0, cells, (size_t)count * ROLLUP_CELL_SIZE));
+    
+    char path[FILENAME_MAX];
+    rollup_file_path(path, sizeof(path));
+    FILE *file = fopen(path, "wb");
+    int written = file != NULL && fwrite(header, 1, sizeof(header), file) == sizeof(header) &&
+                  fwrite(cells, ROLLUP_CELL_SIZE, count, file) == (size_t)count;
+    if (file != NULL && fclose(file) != 0) written = 0;
+    free(cells);
+    if (!written) remove(path);
+    return written;
+}
+
+void rollup_file_path(char *path, size_t size) {
+    snprintf(path, size, "%s%s", data_path, ROLLUP_FILE_SUFFIX);
+}
+
+void remove_rollup_file() {
+    char path[FILENAME_MAX];
+    rollup_file_path(path, sizeof(path));
+    remove(path);
+}
+
+// Adds up the rollup cells, in the base currency, into a total for each
+// month, the first time an overall budget needs them; rollup_expense()
+// keeps them current after that. Returns 0 (after saying why) if memory is
+// exhausted.
+int require_month_totals() {
+    if (!require_rollups()) return 0;
+    if (month_totals != NULL) return 1;
+    month_totals = calloc(MONTH_COUNT, sizeof(Money));
+    if (month_totals == NULL) {
+        print_error("Out of memory! Cannot total expenses by month.");
+        return 0;
+    }
+    for (int b = 0; b < rollup_table_size; b++) {
+        Money *total = month_total(rollup_table[b].month);
+        if (rollup_table[b].category >= 0 && total != NULL) *total += cell_total_in(&rollup_table[b], 0);
+    }
+    return 1;
+}
+
+// Returns the running total of a month, or NULL if the totals are not
+// built or the month is outside 0001-01..9999-12, as a legacy date's may be
+Money *month_total(int month) {
+    if (month_totals == NULL || month < 12 || month >= 12 + MONTH_COUNT) return NULL;
+    return &month_totals[month - 12];
+}
+
+// Gathers the report lines for the months from..to, by month or by year,
+// for one category or all of them (-1), in period order and by category
+// name within a period, with totals in `currency`. Only the rollup cells
+// are read, each converted at its month's rate. Returns the number of
+// lines, stored in *rows for the caller to free, or -1 if memory is
+// exhausted.
+int collect_report(int from, int to, int by_year, int category, int currency, ReportRow **rows) {
+    int *order = malloc((category_count + 1) * sizeof(int));
+    int *ranks = malloc((category_count + 1) * sizeof(int));
+    ReportRow *lines = malloc((rollup_table_used + 1) * sizeof(ReportRow));
+    if (order == NULL || ranks == NULL || lines == NULL) {
+        free(order);
+        free(ranks);
+        free(lines);
+        return -1;
+    }
+    for (int k = 0; k < category_count; k++) order[k] = k;
+    qsort(order, category_count, sizeof(int), compare_category_names);
+    for (int k = 0; k < category_count; k++) ranks[order[k]] = k;
+    
+    int count = 0;
+    long long low = LLONG_MAX, high = LLONG_MIN;
+    for (int b = 0; b < rollup_table_size; b++) {
+        RollupCell *cell = &rollup_table[b];
+        if (cell->category < 0 || cell->count == 0 || cell->month < from || cell->month > to) continue;
+        if (category >= 0 && cell->category != category) continue;
+        
+        ReportRow *line = &lines[count++];
+        line->period = by_year ? cell->month / 12 : cell->month;
+        line->month = cell->month;
+        line->category = cell->category;
+        line->key = (long long)line->period * category_count + ranks[cell->category];
+        line->currency = cell->currency;
+        line->count = cell->count;
+        line->total = cell_total_in(cell, currency);
+        if (line->key < low) low = line->key;
+        if (line->key > high) high = line->key;
+    }
+    
+    // Most periods in a report have most categories in them, so the lines
+    // are usually placed by key (and month, by year, and currency) instead
+    // of sorted
+    int stride = (by_year ? 12 : 1) * currency_count;
+    long long span = count > 0 ? (high - low + 1) * stride : 0;
+    int *places = span <= 2LL * count + 256 ? malloc(span * sizeof(int) + 1) : NULL;
+    ReportRow *placed = places != NULL ? malloc((count + 1) * sizeof(ReportRow)) : NULL;
+    if (placed != NULL) {
+        for (long long p = 0; p < span; p++) places[p] = -1;
+        for (int k = 0; k < count; k++) {
+            places[(lines[k].key - low) * stride + (by_year ? lines[k].month % 12 : 0) * currency_count + lines[k].currency] = k;
+        }
+        int n = 0;
+        for (long long p = 0; p < span; p++) {
+            if (places[p] >= 0) placed[n++] = lines[places[p]];
+        }
+        free(lines);
+        lines = placed;
+    } else {
+        qsort(lines, count, sizeof(ReportRow), compare_report_rows);
+    }
+    free(places);
+    
+    // The lines of a category and period, its months by year and its
+    // currencies, are now side by side
+    int merged = 0;
+    for (int k = 0; k < count; k++) {
+        if (merged > 0 && lines[merged - 1].key == lines[k].key) {
+            lines[merged - 1].total += lines[k].total;
+            lines[merged - 1].count += lines[k].count;
+        } else {
+            lines[merged++] = lines[k];
+        }
+    }
+    
+    free(order);
+    free(ranks);
+    *rows = lines;
+    return merged;
+}
+
+// Report order: by period and category name, then by month and currency so
+// that totals are always added up in the same order
+int compare_report_rows(const void *a, const void *b) {
+    const ReportRow *x = a, *y = b;
+    if (x->key != y->key) return x->key < y->key ? -1 : 1;
+    if (x->month != y->month) return x->month < y->month ? -1 : 1;
+    return (x->currency > y->currency) - (x->currency < y->currency);
+}
+
+int compare_category_names(const void *a, const void *b) {
+    return strcasecmp(category_names[*(const int *)a], category_names[*(const int *)b]);
+}
+
+// Currencies
+// Returns the id of the currency with this code, adding it if needed. An
+// empty code means the base currency, which is always added first, as id 0.
+// Returns -1 if MAX_CURRENCIES are in use or memory is exhausted.
+int intern_currency(const char *code) {
+    int id = find_currency(code);
+    if (id >= 0) return id;
+    
+    int base = code[0] == '\0' || strcmp(code, BASE_CURRENCY) == 0;
+    if (currency_count == 0 && !base && intern_currency(BASE_CURRENCY) < 0) return -1;
+    if (currency_count == MAX_CURRENCIES) return -1;
+    if (currency_count == currency_capacity) {
+        int new_capacity = currency_capacity == 0 ? 8 : currency_capacity * 2;
+        Currency *grown = realloc(currency_list, new_capacity * sizeof(Currency));
+        if (grown == NULL) return -1;
+        currency_list = grown;
+        currency_capacity = new_capacity;
+    }
+    
+    id = currency_count++;
+    memset(&currency_list[id], 0, sizeof(Currency));
+    memcpy(currency_list[id].code, base ? BASE_CURRENCY : code, 3);
+    return id;
+}
+
+// Returns the id of the currency with this code (empty for the base
+// currency), or -1. There are few enough currencies to look through.
+int find_currency(const char *code) {
+    if (code[0] == '\0' || strcmp(code, BASE_CURRENCY) == 0) return currency_count > 0 ? 0 : -1;
+    for (int k = 1; k < currency_count; k++) {
+        if (strcmp(currency_list[k].code, code) == 0) return k;
+    }
+    return -1;
+}
+
+const char *currency_code(int currency) {
+    return currency > 0 && currency < currency_count ? currency_list[currency].code : BASE_CURRENCY;
+}
+
+// How an amount in a currency is labelled: the base currency by its
+// symbol, any other by its code
+const char *currency_symbol(const char *code) {
+    return code[0] == '\0' || strcmp(code, BASE_CURRENCY) == 0 ? BASE_CURRENCY_SYMBOL : code;
+}
+
+// Reads a currency code: three letters in either case, or the base
+// currency's symbol, with blanks around it. Writes the code, in capitals,
+// into `code` (4 bytes). Returns 0 if the text is not a code.
+int parse_currency(const char *text, char *code) {
+    const char *p = text;
+    while (*p == ' ' || *p == '\t') p++;
+    int length = 0;
+    while (length < 4 && isalpha((unsigned char)p[length])) length++;
+    const char *end = p + length;
+    while (*end == ' ' || *end == '\t') end++;
+    if (*end != '\0') return 0;
+    
+    if (length == 2 && strncasecmp(p, BASE_CURRENCY_SYMBOL, 2) == 0) {
+        strcpy(code, BASE_CURRENCY);
+        return 1;
+    }
+    if (length != 3) return 0;
+    for (int k = 0; k < 3; k++) code[k] = toupper((unsigned char)p[k]);
+    code[3] = '\0';
+    return 1;
+}
+
+// Reads an amount with an optional currency code after it, such as "12.50",
+// "12.50USD" or "12.50 usd". `currency` (4 bytes) receives the code, or ""
+// if there is none. Returns 0 unless the amount is above zero and what
+// follows it, if anything, is a code.
+int parse_amount(const char *text, Money *amount, char *currency) {
+    const char *p = text;
+    while (*p == ' ' || *p == '\t') p++;
+    const char *end = p;
+    while (*end != '\0' && *end != ' ' && *end != '\t' && !isalpha((unsigned char)*end)) end++;
+    
+    char number[MONEY_TEXT_SIZE];
+    if (end - p >= (long)sizeof(number)) return 0;
+    memcpy(number, p, end - p);
+    number[end - p] = '\0';
+    if (!parse_money(number, amount) || *amount <= 0) return 0;
+    
+    while (*end == ' ' || *end == '\t') end++;
+    if (*end == '\0') {
+        currency[0] = '\0';
+        return 1;
+    }
+    return parse_currency(end, currency);
+}
+
+// Whether amounts in a currency can be converted: the base currency always,
+// any other once a rate for it has been loaded
+int currency_has_rates(const char *code) {
+    if (code[0] == '\0' || strcmp(code, BASE_CURRENCY) == 0) return 1;
+    int id = find_currency(code);
+    return id > 0 && currency_list[id].rate_count > 0;
+}
+
+// Says so and returns 0 if a new amount cannot be in a currency, as there is
+// no rate to convert it at
+int check_currency(const char *code) {
+    if (currency_has_rates(code)) return 1;
+    char path[FILENAME_MAX], message[FILENAME_MAX + 64];
+    rate_file_path(path, sizeof(path));
+    snprintf(message, sizeof(message), "No exchange rate for %s! Add one to %s.", code, path);
+    print_error(message);
+    return 0;
+}
+
+// The rate amounts in a currency convert at in a month, in RATE_SCALE parts
+// of the base currency per unit; par for the base currency and for one
+// without rates. Only reads the cache, so scan threads may call it.
+long long month_rate(int currency, int month) {
+    if (currency <= 0 || currency >= currency_count || currency_list[currency].month_count == 0) {
+        return RATE_SCALE;
+    }
+    const Currency *entry = &currency_list[currency];
+    int index = month - entry->first_month;
+    if (index < 0) index = 0;
+    if (index >= entry->month_count) index = entry->month_count - 1;
+    return entry->month_rates[index];
+}
+
+// An amount in currency `from` in currency `to`, at their rates for the
+// month, by way of the base currency
+Money convert_amount(Money amount, int from, int to, int month) {
+    if (from == to) return amount;
+    Money base = from == 0 ? amount : scale_money(amount, month_rate(from, month), RATE_SCALE);
+    return to == 0 ? base : scale_money(base, RATE_SCALE, month_rate(to, month));
+}
+
+// amount * multiply / divide to the nearest paisa, halves away from zero.
+// The product is split so that it does not overflow for rates of up to
+// MAX_RATE_DIGITS digits.
+Money scale_money(Money amount, long long multiply, long long divide) {
+    Money magnitude = amount < 0 ? -amount : amount;
+    Money scaled = magnitude / divide * multiply + (magnitude % divide * multiply + divide / 2) / divide;
+    return amount < 0 ? -scaled : scaled;
+}
+
+// A record's amount in the base currency
+Money base_amount(const ExpenseChunk *chunk, int row) {
+    int currency = chunk->currencies[row];
+    if (currency == 0) return chunk->amounts[row];
+    return convert_amount(chunk->amounts[row], currency, 0, month_of_day(chunk->dates[row]));
+}
+
+Money slot_base_amount(int slot) {
+    return base_amount(chunk_of(slot), slot % EXPENSE_CHUNK_SIZE);
+}
+
+Money expense_base_amount(const Expense *expense) {
+    int day, currency = find_currency(expense->currency);
+    if (currency <= 0) return expense->amount;
+    parse_date(expense->date, &day);
+    return convert_amount(expense->amount, currency, 0, month_of_day(day));
+}
+
+// A rollup cell's total in a currency, converted at its month's rates
+Money cell_total_in(const RollupCell *cell, int currency) {
+    return convert_amount(cell->total, cell->currency, currency, cell->month);
+}
+
+// Whether the first `rows` rows of a chunk are all in the base currency, so
+// that their amounts add up as they are
+int chunk_in_base_currency(const ExpenseChunk *chunk, int rows) {
+    unsigned char currencies = 0;
+    for (int j = 0; j < rows; j++) currencies |= chunk->currencies[j];
+    return currencies == 0;
+}
+
+// Reads the exchange rates kept next to the data file: one per line, a
+// date, a currency code and what one unit of it was worth in the base
+// currency from that date on, apart by blanks; blank lines and lines
+// starting with '#' are skipped. A missing file means no rates. Then builds
+// the month caches and warns of each currency in use without a rate, whose
+// amounts count at par. Returns 0 (after saying why) if a line is damaged or
+// memory ran out; the rates read so far are kept.
+int load_rates() {
+    char path[FILENAME_MAX];
+    rate_file_path(path, sizeof(path));
+    FILE *file = fopen(path, "r");
+    int ok = 1;
+    if (file != NULL) {
+        char line[256];
+        while (ok && fgets(line, sizeof(line), file) != NULL) {
+            line[strcspn(line, "\r\n")] = '\0';
+            const char *p = line + strspn(line, " \t");
+            if (*p == '\0' || *p == '#') continue;
+            
+            char date[16], code[16], rate_text[32], extra[2], currency[4];
+            int day, id = -1;
+            long long rate;
+            ok = sscanf(p, "%15s %15s %31s %1s", date, code, rate_text, extra) == 3 &&
+                 parse_date(date, &day) && parse_currency(code, currency) &&
+                 strcmp(currency, BASE_CURRENCY) != 0 && parse_rate(rate_text, &rate) &&
+                 (id = intern_currency(currency)) > 0 && add_rate(id, day, rate);
+        }
+        fclose(file);
+        if (!ok) print_warning("The rate file is damaged; some rates were not loaded.");
+    }
+    
+    for (int k = 1; k < currency_count; k++) {
+        if (!build_rate_cache(k)) {
+            print_error("Out of memory! Cannot convert currencies.");
+            return 0;
+        }
+        if (currency_list[k].rate_count == 0) {
+            char message[FILENAME_MAX + 96];
+            snprintf(message, sizeof(message), "No exchange rate for %s; its amounts count at par until one is added to %s.",
+                     currency_list[k].code, path);
+            print_warning(message);
+        }
+    }
+    return ok;
+}
+
+// Adds a currency's rate from a day on, keeping its rates in date order; a
+// second rate for the same day replaces the first. The month cache is left
+// to build_rate_cache(). Returns 0 if memory is exhausted.
+int add_rate(int currency, int day, long long rate) {
+    Currency *entry = &currency_list[currency];
+    int at = entry->rate_count;
+    while (at > 0 && entry->rates[at - 1].day > day) at--;
+    if (at > 0 && entry->rates[at - 1].day == day) {
+        entry->rates[at - 1].rate = rate;
+        return 1;
+    }
+    
+    if (entry->rate_count == entry->rate_capacity) {
+        int new_capacity = entry->rate_capacity == 0 ? 16 : entry->rate_capacity * 2;
+        ExchangeRate *grown = realloc(entry->rates, new_capacity * sizeof(ExchangeRate));
+        if (grown == NULL) return 0;
+        entry->rates = grown;
+        entry->rate_capacity = new_capacity;
+    }
+    memmove(&entry->rates[at + 1], &entry->rates[at], (entry->rate_count - at) * sizeof(ExchangeRate));
+    entry->rates[at].day = day;
+    entry->rates[at].rate = rate;
+    entry->rate_count++;
+    return 1;
+}
+
+// Fills a currency's month cache, from the month of its first rate to that
+// of its last, with the last rate dated on or before each month's end.
+// Returns 0 if memory is exhausted.
+int build_rate_cache(int currency) {
+    Currency *entry = &currency_list[currency];
+    free(entry->month_rates);
+    entry->month_rates = NULL;
+    entry->month_count = 0;
+    if (entry->rate_count == 0) return 1;
+    
+    int first = month_of_day(entry->rates[0].day);
+    int count = month_of_day(entry->rates[entry->rate_count - 1].day) - first + 1;
+    long long *rates = malloc(count * sizeof(long long));
+    if (rates == NULL) return 0;
+    int next = 0;
+    for (int m = 0; m < count; m++) {
+        while (next < entry->rate_count && month_of_day(entry->rates[next].day) <= first + m) next++;
+        rates[m] = entry->rates[next - 1].rate;
+    }
+    entry->month_rates = rates;
+    entry->first_month = first;
+    entry->month_count = count;
+    return 1;
+}
+
+// Reads a rate such as "118.25" in RATE_SCALE parts. Returns 0 unless it is
+// above zero, with at most MAX_RATE_DIGITS digits before the point and six
+// after it.
+int parse_rate(const char *text, long long *rate) {
+    const char *p = text;
+    long long whole = 0, fraction = 0;
+    int digits = 0, decimals = 0;
+    for (; isdigit((unsigned char)*p); p++) {
+        if (++digits > MAX_RATE_DIGITS) return 0;
+        whole = whole * 10 + (*p - '0');
+    }
+    if (*p == '.') {
+        for (p++; isdigit((unsigned char)*p); p++) {
+            if (++decimals > 6) return 0;
+            fraction = fraction * 10 + (*p - '0');
+        }
+    }
+    if (digits + decimals == 0 || *p != '\0') return 0;
+    for (; decimals < 6; decimals++) fraction *= 10;
+    
+    *rate = whole * RATE_SCALE + fraction;
+    return *rate > 0;
+}
+
+void rate_file_path(char *path, size_t size) {
+    snprintf(path, size, "%s%s", data_path, RATE_FILE_SUFFIX);
+}
+
+void free_currencies() {
+    for (int k = 0; k < currency_count; k++) {
+        free(currency_list[k].rates);
+        free(currency_list[k].month_rates);
+    }
+    free(currency_list);
+    currency_list = NULL;
+    currency_count = 0;
+    currency_capacity = 0;
+}
+
+// Budgets
+// Reads the budgets saved next to the data file: one per line, the limit
+// and then, after a tab, the category, which is empty for the overall
+// budget. A missing file means no budgets. Returns 0 (after saying why) if
+// a line is damaged or memory ran out; the budgets read so far are kept.
+int load_budgets() {
+    free_budgets();
+    char path[FILENAME_MAX];
+    budget_file_path(path, sizeof(path));
+    FILE *file = fopen(path, "r");
+    if (file == NULL) return 1;
+    
+    char line[MONEY_TEXT_SIZE + MAX_CATEGORY_LENGTH + 8];
+    int ok = 1;
+    while (ok && fgets(line, sizeof(line), file) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        char *tab = strchr(line, '\t');
+        Money limit;
+        if (tab != NULL) *tab = '\0';
+        ok = tab != NULL && parse_money(line, &limit) && limit > 0 && set_budget(tab + 1, limit);
+    }
+    fclose(file);
+    if (!ok) print_warning("The budget file is damaged; some budgets were not loaded.");
+    return ok;
+}
+
+// Writes the budgets through a temporary file renamed over the old one, or
+// removes the file when there are none. Returns 0 (after saying why) if
+// they could not be written.
+int save_budgets() {
+    char path[FILENAME_MAX], temp_path[FILENAME_MAX + 4];
+    budget_file_path(path, sizeof(path));
+    if (budget_count == 0) {
+        remove(path);
+        return 1;
+    }
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    FILE *file = fopen(temp_path, "w");
+    int written = file != NULL;
+    for (int k = 0; written && k < budget_count; k++) {
+        char text[MONEY_TEXT_SIZE];
+        written = fprintf(file, "%s\t%s\n", format_money(budgets[k].limit, text), budgets[k].category) > 0;
+    }
+    if (file != NULL) {
+        written = written && sync_file(file);
+        if (fclose(file) != 0) written = 0;
+    }
+    
+    #ifdef _WIN32
+    written = written && MoveFileExA(temp_path, path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+    #else
+    written = written && rename(temp_path, path) == 0;
+    #endif
+    if (!written) {
+        print_error("Could not save the budgets!");
+        remove(temp_path);
+    }
+    return written;
+}
+
+void budget_file_path(char *path, size_t size) {
+    snprintf(path, size, "%s%s", data_path, BUDGET_FILE_SUFFIX);
+}
+
+// Sets the monthly limit for a category (empty for all spending), adding
+// the budget if there is none. Returns 0 if memory is exhausted.
+int set_budget(const char *category, Money limit) {
+    int index = find_budget(category);
+    if (index < 0) {
+        Budget *grown = realloc(budgets, (budget_count + 1) * sizeof(Budget));
+        if (grown == NULL) return 0;
+        budgets = grown;
+        index = budget_count++;
+        snprintf(budgets[index].category, sizeof(budgets[index].category), "%s", category);
+        if (category[0] == '\0') overall_budget = index;
+        budgeted_categories = 0;
+    }
+    budgets[index].limit = limit;
+    budgets[index].warning = limit / 100 * BUDGET_WARNING_PERCENT + limit % 100 * BUDGET_WARNING_PERCENT / 100;
+    return 1;
+}
+
+// Removes the budget for a category (empty for all spending). Returns 0 if
+// there was none.
+int clear_budget(const char *category) {
+    int index = find_budget(category);
+    if (index < 0) return 0;
+    budgets[index] = budgets[--budget_count];
+    overall_budget = find_budget("");
+    budgeted_categories = 0;
+    return 1;
+}
+
+// Returns the index of the budget for a category, ignoring case, or -1
+int find_budget(const char *category) {
+    for (int k = 0; k < budget_count; k++) {
+        if (strcasecmp(budgets[k].category, category) == 0) return k;
+    }
+    return -1;
+}
+
+// Returns the index of a category's budget, or -1. Categories are only ever
+// added, so the table is only matched up again when there are new ones.
+int category_budget(int category) {
+    if (category >= budgeted_categories) {
+        int *table = realloc(category_budgets, (category_count + 1) * sizeof(int));
+        if (table == NULL) return -1;
+        category_budgets = table;
+        for (int k = 0; k < category_count; k++) category_budgets[k] = -1;
+        for (int k = 0; k < budget_count; k++) {
+            int id = k != overall_budget ? find_category(budgets[k].category) : -1;
+            if (id >= 0) category_budgets[id] = k;
+        }
+        budgeted_categories = category_count;
+    }
+    return category_budgets[category];
+}
+
+// Alerts for the budgets `expense` counts against that adding it, or
+// changing `old` into it, took over a threshold. Only the rollup cells of
+// its month and category and the running total of its month are read;
+// amounts count in the base currency.
+void check_budgets(const Expense *expense, const Expense *old) {
+    if (budget_count == 0) return;
+    int day, category = find_category(expense->category);
+    parse_date(expense->date, &day);
+    int month = month_of_day(day);
+    int index = category >= 0 ? category_budget(category) : -1;
+    if (index < 0 && overall_budget < 0) return;
+    
+    int same_month = 0, same_category = 0;
+    if (old != NULL) {
+        int old_day;
+        parse_date(old->date, &old_day);
+        same_month = month_of_day(old_day) == month;
+        same_category = same_month && strcasecmp(old->category, expense->category) == 0;
+    }
+    Money amount = expense_base_amount(expense);
+    Money old_amount = old != NULL ? expense_base_amount(old) : 0;
+    if (index >= 0 && require_rollups()) {
+        check_budget(index, month, rollup_total(month, category), amount - (same_category ? old_amount : 0));
+    }
+    if (overall_budget >= 0 && require_month_totals() && month_total(month) != NULL) {
+        check_budget(overall_budget, month, *month_total(month), amount - (same_month ? old_amount : 0));
+    }
+}
+
+// Alerts if adding `added` took the month's `total` for a budget over its
+// limit, or else to its warning share
+void check_budget(int index, int month, Money total, Money added) {
+    const Budget *budget = &budgets[index];
+    Money before = total - added;
+    int over = before <= budget->limit && total > budget->limit;
+    if (added <= 0 || (!over && (before >= budget->warning || total < budget->warning))) return;
+    if (budget_alert_quota >= 0 && budget_alerts++ >= budget_alert_quota) return;
+    
+    char message[200], spent[MONEY_TEXT_SIZE], limit[MONEY_TEXT_SIZE];
+    const char *name = index == overall_budget ? "Overall" : budget->category;
+    format_money(total, spent);
+    format_money(budget->limit, limit);
+    if (over) {
+        snprintf(message, sizeof(message), "%s spending for %04d-%02d is over budget: %s of %s.",
+                 name, month / 12, month % 12 + 1, spent, limit);
+    } else {
+        snprintf(message, sizeof(message), "%s spending for %04d-%02d has reached %d%% of its budget: %s of %s.",
+                 name, month / 12, month % 12 + 1, BUDGET_WARNING_PERCENT, spent, limit);
+    }
+    print_warning(message);
+}
+
+void free_budgets() {
+    free(budgets);
+    free(category_budgets);
+    budgets = NULL;
+    category_budgets = NULL;
+    budget_count = 0;
+    budgeted_categories = 0;
+    overall_budget = -1;
+}
+
+// Range totals
+// Returns the tree for a category (-1 for all of them), building it, and
+// fitting the window to the expense dates first if no tree is built yet.
+// Returns NULL (after saying why) if memory is exhausted.
+DayTree *require_day_tree(int category) {
+    if (!day_trees_ready) {
+        if (!fit_day_window()) {
+            print_error("Out of memory! Cannot total expenses by date.");
+            return NULL;
+        }
+        day_trees_ready = 1;
+    }
+    if (category + 1 >= day_tree_capacity) {
+        int new_capacity = category_capacity + 1;
+        DayTree *grown = realloc(day_trees, new_capacity * sizeof(DayTree));
+        if (grown == NULL) {
+            print_error("Out of memory! Cannot total expenses by date.");
+            return NULL;
+        }
+        memset(grown + day_tree_capacity, 0, (new_capacity - day_tree_capacity) * sizeof(DayTree));
+        day_trees = grown;
+        day_tree_capacity = new_capacity;
+    }
+    
+    DayTree *tree = &day_trees[category + 1];
+    if (tree->sums == NULL && !build_day_tree(tree, category)) {
+        print_error("Out of memory! Cannot total expenses by date.");
+        return NULL;
+    }
+    return tree;
+}
+
+// Places the window over the dates of the live expenses with as much room
+// again to spare, half of it on either side, so that the trees are only
+// rebuilt once the dates spread to twice their span. Returns 0 if memory is
+// exhausted.
+int fit_day_window() {
+    free_day_trees();
+    int first = LAST_INDEXED_DAY, last = FIRST_INDEXED_DAY;
+    for (int c = 0; c < chunk_count; c++) {
+        ExpenseChunk *chunk = expense_chunks[c];
+        int rows = chunk_rows(c);
+        for (int j = 0; j < rows; j++) {
+            int day = chunk->dates[j];
+            if (chunk->deleted[j] || day < FIRST_INDEXED_DAY || day > LAST_INDEXED_DAY) continue;
+            if (day < first) first = day;
+            if (day > last) last = day;
+        }
+    }
+    if (first > last) first = last = days_from_civil(2000, 1, 1);
+    
+    int size = DAY_WINDOW_MIN_DAYS;
+    while (size < 2 * (last - first + 1)) size *= 2;
+    day_window_first = first - (size - (last - first + 1)) / 2;
+    day_window_size = size;
+    day_trees = calloc(category_capacity + 1, sizeof(DayTree));
+    if (day_trees == NULL) return 0;
+    day_tree_capacity = category_capacity + 1;
+    return 1;
+}
+
+// Builds the tree of a category (-1 for all) with one scan: the day totals
+// go into place, then each node passes its sum on to its parent. Returns 0
+// if memory is exhausted.
+int build_day_tree(DayTree *tree, int category) {
+    tree->sums = calloc(day_window_size, sizeof(Money));
+    tree->counts = calloc(day_window_size, sizeof(int));
+    if (tree->sums == NULL || tree->counts == NULL) {
+        free(tree->sums);
+        free(tree->counts);
+        tree->sums = NULL;
+        tree->counts = NULL;
+        return 0;
+    }
+    
+    for (int c = 0; c < chunk_count; c++) {
+        ExpenseChunk *chunk = expense_chunks[c];
+        int rows = chunk_rows(c);
+        for (int j = 0; j < rows; j++) {
+            if (chunk->deleted[j] || (category >= 0 && chunk->categories[j] != category)) continue;
+            unsigned int position = (unsigned int)(chunk->dates[j] - day_window_first);
+            if (position >= (unsigned int)day_window_size) continue;
+            tree->sums[position] += base_amount(chunk, j);
+            tree->counts[position]++;
+        }
+    }
+    for (int i = 1; i <= day_window_size; i++) {
+        int parent = i + (i & -i);
+        if (parent > day_window_size) continue;
+        tree->sums[parent - 1] += tree->sums[i - 1];
+        tree->counts[parent - 1] += tree->counts[i - 1];
+    }
+    return 1;
+}
+
+// Adds the record in `slot` to the trees (sign 1) or takes it out (sign -1).
+// A date outside the window drops the trees, to be rebuilt over a wider one
+// when next needed; dates outside the indexed range are never counted.
+void day_tree_update(int slot, int sign) {
+    ExpenseChunk *chunk = chunk_of(slot);
+    int row = slot % EXPENSE_CHUNK_SIZE;
+    int day = chunk->dates[row];
+    if (day < FIRST_INDEXED_DAY || day > LAST_INDEXED_DAY) return;
+    if (day < day_window_first || day - day_window_first >= day_window_size) {
+        free_day_trees();
+        return;
+    }
+    
+    Money amount = sign * base_amount(chunk, row);
+    int trees[2] = {0, chunk->categories[row] + 1};
+    for (int t = 0; t < 2; t++) {
+        if (trees[t] < day_tree_capacity && day_trees[trees[t]].sums != NULL) {
+            day_tree_add(&day_trees[trees[t]], day - day_window_first, amount, sign);
+        }
+    }
+}
+
+void day_tree_add(DayTree *tree, int position, Money amount, int count) {
+    for (int i = position + 1; i <= day_window_size; i += i & -i) {
+        tree->sums[i - 1] += amount;
+        tree->counts[i - 1] += count;
+    }
+}
+
+// Totals the expenses dated from..to (day numbers) as the difference of two
+// prefix sums
+void day_range_total(const DayTree *tree, int from, int to, Money *total, int *count) {
+    *total = 0;
+    *count = 0;
+    if (from < day_window_first) from = day_window_first;
+    if (to >= day_window_first + day_window_size) to = day_window_first + day_window_size - 1;
+    if (from > to) return;
+    
+    for (int i = to - day_window_first + 1; i > 0; i -= i & -i) {
+        *total += tree->sums[i - 1];
+        *count += tree->counts[i - 1];
+    }
+    for (int i = from - day_window_first; i > 0; i -= i & -i) {
+        *total -= tree->sums[i - 1];
+        *count -= tree->counts[i - 1];
+    }
+}
+
+void free_day_trees() {
+    for (int k = 0; k < day_tree_capacity; k++) {
+        free(day_trees[k].sums);
+        free(day_trees[k].counts);
+    }
+    free(day_trees);
+    day_trees = NULL;
+    day_tree_capacity = 0;
+    day_trees_ready = 0;
+}
+
+// Text index
+// Builds the text index the first time a search needs it. Returns 0 (after
+// saying why) if memory is exhausted.
+int require_text_index() {
+    if (text_index_ready) return 1;
+    if (!rebuild_text_index()) {
+        free_text_index();
+        print_error("Out of memory! Cannot index descriptions.");
+        return 0;
+    }
+    text_index_ready = 1;
+    return 1;
+}
+
+// Files every live record under the words of its description. Word lists
+// are emptied rather than freed, so after a compaction, which only shrinks
+// them, this cannot run out of memory. Returns 0 if memory is exhausted.
+int rebuild_text_index() {
+    for (int k = 0; k < index_term_count; k++) {
+        index_terms[k].slots.count = 0;
+        index_terms[k].slots.unsorted = 0;
+    }
+    for (int c = 0; c < chunk_count; c++) {
+        ExpenseChunk *chunk = expense_chunks[c];
+        int rows = chunk_rows(c);
+        for (int j = 0; j < rows; j++) {
+            if (!chunk->deleted[j] && index_description(c * EXPENSE_CHUNK_SIZE + j) < 0) return 0;
+        }
+    }
+    return 1;
+}
+
+// Files `slot` under every word of its description. Returns the number of
+// words, or -1 if memory is exhausted.
+int index_description(int slot) {
+    const char *cursor = description_text(chunk_of(slot)->descriptions[slot % EXPENSE_CHUNK_SIZE]);
+    char token[MAX_DESCRIPTION_LENGTH];
+    int words = 0;
+    while (next_token(&cursor, token, sizeof(token)) > 0) {
+        int term = intern_index_term(token);
+        if (term < 0) return -1;
+        SlotList *list = &index_terms[term].slots;
+        if (list->count > 0 && list->slots[list->count - 1] == slot) continue;
+        if (!slot_list_add(list, slot)) return -1;
+        words++;
+    }
+    return words;
+}
+
+// Copies the next word at *cursor (a run of letters, digits and non-ASCII
+// bytes) into `token`, lowercased and cut to fit, and moves past it.
+// Returns its length, or 0 once there are no more words.
+int next_token(const char **cursor, char *token, size_t size) {
+    const unsigned char *p = (const unsigned char *)*cursor;
+    while (*p && !isalnum(*p) && *p < 0x80) p++;
+    
+    size_t length = 0;
+    while (*p && (isalnum(*p) || *p >= 0x80)) {
+        if (length + 1 < size) token[length++] = (char)tolower(*p);
+        p++;
+    }
+    token[length] = 0;
+    *cursor = (const char *)p;
+    return (int)length;
+}
+
+// Returns the id of a word, adding it if needed, or -1 if memory is
+// exhausted
+int intern_index_term(const char *token) {
+    int id = find_index_term(token);
+    if (id >= 0) return id;
+    
+    if (index_term_count == index_term_capacity) {
+        int new_capacity = index_term_capacity == 0 ? 256 : index_term_capacity * 2;
+        IndexTerm *grown = realloc(index_terms, new_capacity * sizeof(IndexTerm));
+        if (grown == NULL) return -1;
+        index_terms = grown;
+        index_term_capacity = new_capacity;
+    }
+    
+    // Keep the table at most half full
+    if ((index_term_count + 1) * 2 > index_term_table_size && !grow_index_term_table()) return -1;
+    
+    char *text = malloc(strlen(token) + 1);
+    if (text == NULL) return -1;
+    strcpy(text, token);
+    id = index_term_count++;
+    index_terms[id].text = text;
+    memset(&index_terms[id].slots, 0, sizeof(SlotList));
+    
+    unsigned int bucket = text_hash(token) & (index_term_table_size - 1);
+    while (index_term_table[bucket] >= 0) {
+        bucket = (bucket + 1) & (index_term_table_size - 1);
+    }
+    index_term_table[bucket] = id;
+    return id;
+}
+
+// Returns the id of a word, or -1 if no description uses it
+int find_index_term(const char *token) {
+    if (index_term_table_size == 0) return -1;
+    
+    unsigned int bucket = text_hash(token) & (index_term_table_size - 1);
+    while (index_term_table[bucket] >= 0) {
+        if (strcmp(index_terms[index_term_table[bucket]].text, token) == 0) return index_term_table[bucket];
+        bucket = (bucket + 1) & (index_term_table_size - 1);
+    }
+    return -1;
+}
+
+// Doubles the hash table and reinserts every word
+int grow_index_term_table() {
+    int new_size = index_term_table_size == 0 ? 512 : index_term_table_size * 2;
+    int *table = malloc(new_size * sizeof(int));
+    if (table == NULL) return 0;
+    
+    for (int b = 0; b < new_size; b++) table[b] = -1;
+    for (int k = 0; k < index_term_count; k++) {
+        unsigned int bucket = text_hash(index_terms[k].text) & (new_size - 1);
+        while (table[bucket] >= 0) {
+            bucket = (bucket + 1) & (new_size - 1);
+        }
+        table[bucket] = k;
+    }
+    
+    free(index_term_table);
+    index_term_table = table;
+    index_term_table_size = new_size;
+    return 1;
+}
+
+// FNV-1a
+unsigned int text_hash(const char *text) {
+    unsigned int hash = 2166136261u;
+    for (; *text; text++) {
+        hash ^= (unsigned char)*text;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Sorts the words added since the last prefix search into the sorted word
+// list. Returns 0 if memory is exhausted.
+int sort_index_terms() {
+    if (index_term_sorted == index_term_count) return 1;
+    
+    int *order = realloc(index_term_order, (index_term_count + 1) * sizeof(int));
+    if (order == NULL) return 0;
+    index_term_order = order;
+    for (int k = 0; k < index_term_count; k++) order[k] = k;
+    qsort(order, index_term_count, sizeof(int), compare_index_terms);
+    index_term_sorted = index_term_count;
+    return 1;
+}
+
+int compare_index_terms(const void *a, const void *b) {
+    return strcmp(index_terms[*(const int *)a].text, index_terms[*(const int *)b].text);
+}
+
+void free_text_index() {
+    for (int k = 0; k < index_term_count; k++) {
+        free(index_terms[k].text);
+        free(index_terms[k].slots.slots);
+    }
+    free(index_terms);
+    free(index_term_table);
+    free(index_term_order);
+    index_terms = NULL;
+    index_term_table = NULL;
+    index_term_order = NULL;
+    index_term_count = 0;
+    index_term_capacity = 0;
+    index_term_table_size = 0;
+    index_term_sorted = 0;
+    text_index_ready = 0;
+}
+
+// Reads a search into terms. Words are all required, and OR between words
+// starts another group of them, any group being enough. A word ending in
+// '*' matches the words that start with it. Punctuation inside a word splits
+// it, as it does in descriptions.
+// Returns 0 if there are no words or more than MAX_SEARCH_TERMS.
+int parse_search(const char *text, SearchQuery *query) {
+    query->count = 0;
+    query->groups = 0;
+    int group_size = 0;
+    
+    const char *p = text;
+    while (*p) {
+        while (*p && isspace((unsigned char)*p)) p++;
+        const char *start = p;
+        while (*p && !isspace((unsigned char)*p)) p++;
+        if (p == start) break;
+        
+        char word[MAX_DESCRIPTION_LENGTH];
+        size_t length = (size_t)(p - start) < sizeof(word) ? (size_t)(p - start) : sizeof(word) - 1;
+        memcpy(word, start, length);
+        word[length] = 0;
+        if (strcmp(word, "OR") == 0) {
+            if (group_size > 0) query->groups++;
+            group_size = 0;
+            continue;
+        }
+        
+        int prefix = word[length - 1] == '*';
+        const char *cursor = word;
+        char token[MAX_DESCRIPTION_LENGTH];
+        while (next_token(&cursor, token, sizeof(token)) > 0) {
+            if (query->count == MAX_SEARCH_TERMS) return 0;
+            SearchTerm *term = &query->terms[query->count++];
+            strcpy(term->text, token);
+            term->group = query->groups;
+            term->prefix = 0;
+            group_size++;
+        }
+        if (prefix && group_size > 0) query->terms[query->count - 1].prefix = 1;
+    }
+    if (group_size > 0) query->groups++;
+    return query->count > 0;
+}
+
+// Finds the live records matching a search, in slot order. Each term's
+// slots come from the text index and the category lists; a group's are
+// intersected, starting from the shortest, and the groups' are merged.
+// Hits on restated records are then checked against the record, which
+// weeds out stale entries. Returns the number of records, with their slots
+// in *slots for the caller to free, or -1 (after saying why) if memory is
+// exhausted.
+int search_slots(const SearchQuery *query, int **slots) {
+    *slots = NULL;
+    if (!require_text_index()) return -1;
+    
+    int *found = NULL;
+    int found_count = 0;
+    for (int g = 0; g < query->groups; g++) {
+        int *lists[MAX_SEARCH_TERMS] = {NULL};
+        int counts[MAX_SEARCH_TERMS] = {0};
+        int terms = 0, shortest = 0, failed = 0;
+        for (int t = 0; t < query->count; t++) {
+            if (query->terms[t].group != g) continue;
+            counts[terms] = term_slots(&query->terms[t], &lists[terms]);
+            if (counts[terms] < 0) {
+                failed = 1;
+                break;
+            }
+            if (counts[terms] < counts[shortest]) shortest = terms;
+            terms++;
+        }
+        
+        int matched = failed ? 0 : counts[shortest];
+        for (int t = 0; !failed && t < terms; t++) {
+            if (t != shortest) matched = merge_slots(lists[shortest], matched, lists[t], counts[t], lists[shortest], 1);
+        }
+        int *merged = failed ? NULL : malloc(((size_t)found_count + matched + 1) * sizeof(int));
+        if (merged != NULL) {
+            found_count = merge_slots(found, found_count, lists[shortest], matched, merged, 0);
+            free(found);
+            found = merged;
+        }
+        for (int t = 0; t < terms; t++) free(lists[t]);
+        if (merged == NULL) {
+            free(found);
+            print_error("Out of memory! Cannot search expenses.");
+            return -1;
+        }
+    }
+    
+    slot_list_sort(&restated_slots);
+    int kept = 0, restated = 0;
+    for (int k = 0; k < found_count; k++) {
+        ExpenseChunk *chunk = chunk_of(found[k]);
+        int row = found[k] % EXPENSE_CHUNK_SIZE;
+        if (chunk->deleted[row]) continue;
+        while (restated < restated_slots.count && restated_slots.slots[restated] < found[k]) restated++;
+        if (restated < restated_slots.count && restated_slots.slots[restated] == found[k] &&
+            !record_matches_search(query, chunk, row)) {
+            continue;
+        }
+        found[kept++] = found[k];
+    }
+    *slots = found;
+    return kept;
+}
+
+// Gathers the slots filed under a term's word (or, for a prefix, under
+// every word starting with it) and those of the categories with a matching
+// word, sorted and without duplicates. Returns their number, with the
+// slots in *slots for the caller to free, or -1 if memory is exhausted.
+int term_slots(const SearchTerm *term, int **slots) {
+    *slots = NULL;
+    
+    // The words: the term's own, or the run of sorted words it starts
+    int id = -1;
+    const int *ids = &id;
+    int id_count = 0;
+    if (term->prefix) {
+        if (!sort_index_terms()) return -1;
+        int low = 0, high = index_term_count;
+        while (low < high) {
+            int middle = (low + high) / 2;
+            if (strcmp(index_terms[index_term_order[middle]].text, term->text) < 0) low = middle + 1;
+            else high = middle;
+        }
+        size_t length = strlen(term->text);
+        ids = index_term_order + low;
+        while (low + id_count < index_term_count && strncmp(index_terms[ids[id_count]].text, term->text, length) == 0) {
+            id_count++;
+        }
+    } else {
+        id = find_index_term(term->text);
+        id_count = id >= 0;
+    }
+    
+    // Count first, so the slots are gathered in a single allocation
+    size_t total = 0;
+    int sources = 0;
+    for (int k = 0; k < id_count; k++) {
+        SlotList *list = &index_terms[ids[k]].slots;
+        slot_list_sort(list);
+        total += list->count;
+        sources++;
+    }
+    int any_category = 0;
+    for (int k = 0; k < category_count && !any_category; k++) {
+        any_category = text_has_term(category_names[k], term);
+    }
+    if (any_category && !require_indexes()) return -1;
+    for (int k = 0; any_category && k < category_count; k++) {
+        if (!text_has_term(category_names[k], term)) continue;
+        slot_list_sort(&category_slots[k]);
+        total += category_slots[k].count;
+        sources++;
+    }
+    
+    // Each sorted source is merged into what has been gathered so far,
+    // swapping between two buffers
+    int *gathered = malloc((total + 1) * sizeof(int));
+    int *spare = sources > 1 ? malloc((total + 1) * sizeof(int)) : NULL;
+    if (gathered == NULL || (sources > 1 && spare == NULL)) {
+        free(gathered);
+        free(spare);
+        return -1;
+    }
+    int count = 0;
+    for (int k = 0; k < id_count + (any_category ? category_count : 0); k++) {
+        const SlotList *list = k < id_count ? &index_terms[ids[k]].slots : &category_slots[k - id_count];
+        if (k >= id_count && !text_has_term(category_names[k - id_count], term)) continue;
+        count = merge_slots(gathered, count, list->slots, list->count, spare != NULL ? spare : gathered, 0);
+        if (spare != NULL) {
+            int *swap = gathered;
+            gathered = spare;
+            spare = swap;
+        }
+    }
+    free(spare);
+    *slots = gathered;
+    return count;
+}
+
+// Merges two sorted slot lists into `out`, keeping the slots in both
+// (`intersect` set) or in either. `out` may be `a` when intersecting.
+// Returns the number of slots written.
+int merge_slots(const int *a, int a_count, const int *b, int b_count, int *out, int intersect) {
+    int i = 0, j = 0, n = 0;
+    while (i < a_count && j < b_count) {
+        if (a[i] == b[j]) {
+            out[n++] = a[i++];
+            j++;
+        } else if (a[i] < b[j]) {
+            if (intersect) i++;
+            else out[n++] = a[i++];
+        } else {
+            if (intersect) j++;
+            else out[n++] = b[j++];
+        }
+    }
+    while (!intersect && i < a_count) out[n++] = a[i++];
+    while (!intersect && j < b_count) out[n++] = b[j++];
+    return n;
+}
+
+// Checks a record against a search by reading its description and category
+int record_matches_search(const SearchQuery *query, const ExpenseChunk *chunk, int row) {
+    const char *description = description_text(chunk->descriptions[row]);
+    const char *category = category_names[chunk->categories[row]];
+    for (int g = 0; g < query->groups; g++) {
+        int matched = 1;
+        for (int t = 0; t < query->count && matched; t++) {
+            if (query->terms[t].group != g) continue;
+            matched = text_has_term(description, &query->terms[t]) || text_has_term(category, &query->terms[t]);
+        }
+        if (matched) return 1;
+    }
+    return 0;
+}
+
+// Whether a word of `text` is the term's word, or starts with it for a
+// prefix
+int text_has_term(const char *text, const SearchTerm *term) {
+    char token[MAX_DESCRIPTION_LENGTH];
+    size_t length = strlen(term->text);
+    while (next_token(&text, token, sizeof(token)) > 0) {
+        if (term->prefix ? strncmp(token, term->text, length) == 0 : strcmp(token, term->text) == 0) return 1;
+    }
+    return 0;
+}
+
+// Counts the words in a text
+int count_tokens(const char *text) {
+    char token[MAX_DESCRIPTION_LENGTH];
+    int words = 0;
+    while (next_token(&text, token, sizeof(token)) > 0) words++;
+    return words;
+}
+
+// Text scan
+// Bytes of text in an arena block. Blocks before the last are zero-filled
+// past their strings, so scanning them whole finds nothing extra.
+size_t description_block_extent(int block) {
+    if (block == description_mapped_blocks - 1) return description_mapped_used;
+    if (block == description_block_count - 1) return description_block_used;
+    return DESCRIPTION_BLOCK_SIZE;
+}
+
+// Lowercases an ASCII letter; scans compare every other byte as it is
+unsigned char fold_byte(unsigned char c) {
+    return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+// Lowercases `text` as the needle of a scan
+void fold_needle(const char *text, FoldedNeedle *needle) {
+    size_t length = strnlen(text, MAX_DESCRIPTION_LENGTH - 1);
+    for (size_t k = 0; k < length; k++) needle->text[k] = (char)fold_byte((unsigned char)text[k]);
+    needle->text[length] = 0;
+    needle->length = length;
+}
+
+// Whether `length` bytes of `text` equal the (lowercased) `folded` once
+// lowercased
+int folded_equal(const char *text, const char *folded, size_t length) {
+    for (size_t k = 0; k < length; k++) {
+        if (fold_byte((unsigned char)text[k]) != (unsigned char)folded[k]) return 0;
+    }
+    return 1;
+}
+
+// Whether `text` contains the needle, ignoring case
+int text_contains(const char *text, const FoldedNeedle *needle) {
+    if (find_folded == NULL) choose_text_kernel();
+    return find_folded(text, strlen(text), needle) != NULL;
+}
+
+// The kernels find the first place in `length` bytes of `text` where the
+// needle appears, ignoring case, or return NULL. The vector ones compare a
+// block of positions at once against the needle's first, second and last
+// bytes, OR-ing 0x20 into the text where the needle has a letter (which
+// lowercases exactly the two cases of that letter), and check the bytes in
+// between only where all three match.
+const char *find_folded_scalar(const char *text, size_t length, const FoldedNeedle *needle) {
+    size_t n = needle->length;
+    if (n == 0) return text;
+    unsigned char first = (unsigned char)needle->text[0];
+    for (size_t i = 0; i + n <= length; i++) {
+        if (fold_byte((unsigned char)text[i]) == first && folded_equal(text + i + 1, needle->text + 1, n - 1)) {
+            return text + i;
+        }
+    }
+    return NULL;
+}
+
+#ifdef TEXT_SCAN_X86
+__attribute__((target("sse2")))
+const char *find_folded_sse2(const char *text, size_t length, const FoldedNeedle *needle) {
+    size_t n = needle->length;
+    if (n == 0) return text;
+    unsigned char first = (unsigned char)needle->text[0], last = (unsigned char)needle->text[n - 1];
+    unsigned char second = (unsigned char)needle->text[n > 1];
+    const __m128i first_byte = _mm_set1_epi8((char)first);
+    const __m128i last_byte = _mm_set1_epi8((char)last);
+    const __m128i first_fold = _mm_set1_epi8(first >= 'a' && first <= 'z' ? 0x20 : 0);
+    const __m128i last_fold = _mm_set1_epi8(last >= 'a' && last <= 'z' ? 0x20 : 0);
+    const __m128i second_byte = _mm_set1_epi8((char)second);
+    const __m128i second_fold = _mm_set1_epi8(second >= 'a' && second <= 'z' ? 0x20 : 0);
+    
+    size_t i = 0;
+    for (; i + n - 1 + 16 <= length; i += 16) {
+        __m128i head = _mm_or_si128(_mm_loadu_si128((const __m128i *)(text + i)), first_fold);
+        __m128i next = _mm_or_si128(_mm_loadu_si128((const __m128i *)(text + i + (n > 1))), second_fold);
+        __m128i tail = _mm_or_si128(_mm_loadu_si128((const __m128i *)(text + i + n - 1)), last_fold);
+        __m128i matches = _mm_and_si128(_mm_cmpeq_epi8(head, first_byte), _mm_cmpeq_epi8(tail, last_byte));
+        unsigned int hits = (unsigned int)_mm_movemask_epi8(_mm_and_si128(matches, _mm_cmpeq_epi8(next, second_byte)));
+        while (hits != 0) {
+            size_t at = i + __builtin_ctz(hits);
+            if (n <= 3 || folded_equal(text + at + 2, needle->text + 2, n - 3)) return text + at;
+            hits &= hits - 1;
+        }
+    }
+    return i < length ? find_folded_scalar(text + i, length - i, needle) : NULL;
+}
+
+__attribute__((target("avx2")))
+const char *find_folded_avx2(const char *text, size_t length, const FoldedNeedle *needle) {
+    size_t n = needle->length;
+    if (n == 0) return text;
+    unsigned char first = (unsigned char)needle->text[0], last = (unsigned char)needle->text[n - 1];
+    unsigned char second = (unsigned char)needle->text[n > 1];
+    const __m256i first_byte = _mm256_set1_epi8((char)first);
+    const __m256i last_byte = _mm256_set1_epi8((char)last);
+    const __m256i first_fold = _mm256_set1_epi8(first >= 'a' && first <= 'z' ? 0x20 : 0);
+    const __m256i last_fold = _mm256_set1_epi8(last >= 'a' && last <= 'z' ? 0x20 : 0);
+    const __m256i second_byte = _mm256_set1_epi8((char)second);
+    const __m256i second_fold = _mm256_set1_epi8(second >= 'a' && second <= 'z' ? 0x20 : 0);
+    
+    size_t i = 0;
+    for (; i + n - 1 + 32 <= length; i += 32) {
+        __m256i head = _mm256_or_si256(_mm256_loadu_si256((const __m256i *)(text + i)), first_fold);
+        __m256i next = _mm256_or_si256(_mm256_loadu_si256((const __m256i *)(text + i + (n > 1))), second_fold);
+        __m256i tail = _mm256_or_si256(_mm256_loadu_si256((const __m256i *)(text + i + n - 1)), last_fold);
+        __m256i matches = _mm256_and_si256(_mm256_cmpeq_epi8(head, first_byte), _mm256_cmpeq_epi8(tail, last_byte));
+        unsigned int hits = (unsigned int)_mm256_movemask_epi8(_mm256_and_si256(matches, _mm256_cmpeq_epi8(next, second_byte)));
+        while (hits != 0) {
+            size_t at = i + __builtin_ctz(hits);
+            if (n <= 3 || folded_equal(text + at + 2, needle->text + 2, n - 3)) return text + at;
+            hits &= hits - 1;
+        }
+    }
+    return i < length ? find_folded_sse2(text + i, length - i, needle) : NULL;
+}
+#endif
+
+// Picks the widest kernel the processor supports, unless one was forced
+void choose_text_kernel() {
+    find_folded = find_folded_scalar;
+    text_kernel_name = "scalar";
+    #ifdef TEXT_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        find_folded = find_folded_avx2;
+        text_kernel_name = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        find_folded = find_folded_sse2;
+        text_kernel_name = "sse2";
+    }
+    #endif
+}
+
+// Scans the whole description arena for `text`, a block per item of a
+// parallel scan, marking the strings that contain it, and the category
+// names that do. Matching records are then handed out in slot order by
+// next_text_matches(). Returns 0 (after saying why) if memory is exhausted.
+int begin_text_scan(TextScan *scan, const char *text) {
+    if (find_folded == NULL) choose_text_kernel();
+    fold_needle(text, &scan->needle);
+    scan->next_slot = 0;
+    scan->matched = calloc((size_t)description_block_count * (DESCRIPTION_BLOCK_SIZE / 8) + 1, 1);
+    scan->category_hits = calloc(category_count > 0 ? category_count : 1, 1);
+    if (scan->matched == NULL || scan->category_hits == NULL) {
+        end_text_scan(scan);
+        print_error("Out of memory! Cannot search expenses.");
+        return 0;
+    }
+    for (int k = 0; k < category_count; k++) {
+        scan->category_hits[k] = text_contains(category_names[k], &scan->needle);
+    }
+    
+    run_parallel(description_block_count, scan_threads_for(description_block_count), scan_text_block, scan);
+    return 1;
+}
+
+// Marks the matching strings of one block. Blocks are a multiple of 8
+// bytes, so each has bytes of the bitmap to itself.
+void scan_text_block(void *context, int block, int thread) {
+    TextScan *scan = context;
+    (void)thread;
+    const char *base = description_blocks[block];
+    const char *end = base + description_block_extent(block);
+    const char *hit = base;
+    while (hit < end && (hit = find_folded(hit, end - hit, &scan->needle)) != NULL) {
+        // Mark the start of the string the hit is in, then skip the rest of it
+        const char *start = hit;
+        while (start > base && start[-1] != 0) start--;
+        size_t offset = (size_t)block * DESCRIPTION_BLOCK_SIZE + (start - base);
+        scan->matched[offset / 8] |= (unsigned char)(1 << offset % 8);
+        hit = memchr(hit, 0, end - hit);
+        if (hit == NULL) break;
+        hit++;
+    }
+}
+
+// Puts the slots of up to `capacity` more live records matching a scan
+// into `slots`. Returns how many, 0 once there are no more.
+int next_text_matches(TextScan *scan, int *slots, int capacity) {
+    int count = 0;
+    while (scan->next_slot < slot_count && count < capacity) {
+        int slot = scan->next_slot++;
+        ExpenseChunk *chunk = chunk_of(slot);
+        int row = slot % EXPENSE_CHUNK_SIZE;
+        if (!chunk->deleted[row] && text_scan_hit(scan, chunk, row)) slots[count++] = slot;
+    }
+    return count;
+}
+
+// Whether the category or description of a record contains what a scan
+// looked for; says nothing about whether the record is live
+int text_scan_hit(const TextScan *scan, const ExpenseChunk *chunk, int row) {
+    unsigned int offset = chunk->descriptions[row];
+    return scan->category_hits[chunk->categories[row]] || ((scan->matched[offset / 8] >> (offset % 8)) & 1);
+}
+
+void end_text_scan(TextScan *scan) {
+    free(scan->matched);
+    free(scan->category_hits);
+    scan->matched = NULL;
+    scan->category_hits = NULL;
+}
+
+// Amount kernels
+void summarize_amounts_scalar(const ExpenseChunk *chunk, int rows, const AmountFilter *filter, AmountSummary *summary) {
+    *summary = (AmountSummary){0, 0, 0, 0, -1, -1};
+    for (int j = 0; j < rows; j++) {
+        if (chunk->deleted[j] || chunk->dates[j] < filter->from || chunk->dates[j] > filter->to ||
+            (filter->category >= 0 && chunk->categories[j] != filter->category)) {
+            continue;
+        }
+        add_amount(summary, chunk->amounts[j], j);
+    }
+}
+
+// Counts in one more matching amount. Rows must come in ascending order.
+void add_amount(AmountSummary *summary, Money amount, int row) {
+    summary->count++;
+    summary->total += amount;
+    if (summary->highest_row < 0 || amount > summary->highest) {
+        summary->highest = amount;
+        summary->highest_row = row;
+    }
+    if (summary->lowest_row < 0 || amount < summary->lowest) {
+        summary->lowest = amount;
+        summary->lowest_row = row;
+    }
+}
+
+#ifdef TEXT_SCAN_X86
+// Each lane keeps its own count, total and extremes, updated only on a
+// strictly higher or lower amount so that it holds its first such row; the
+// lanes are then merged, ties going to the lower row, and the rows past the
+// last multiple of four are added one by one.
+__attribute__((target("avx2")))
+void summarize_amounts_avx2(const ExpenseChunk *chunk, int rows, const AmountFilter *filter, AmountSummary *summary) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i none = _mm256_set1_epi64x(-1);
+    const __m256i before = _mm256_set1_epi64x((long long)filter->from - 1);
+    const __m256i after = _mm256_set1_epi64x((long long)filter->to + 1);
+    const __m256i category = _mm256_set1_epi64x(filter->category);
+    const __m256i step = _mm256_set1_epi64x(4);
+    __m256i totals = zero, counts = zero;
+    __m256i highest = zero, lowest = zero;
+    __m256i highest_rows = none, lowest_rows = none;
+    __m256i row_numbers = _mm256_setr_epi64x(0, 1, 2, 3);
+    
+    int j = 0;
+    for (; j + 4 <= rows; j += 4) {
+        int deleted;
+        memcpy(&deleted, chunk->deleted + j, 4);
+        __m256i amounts = _mm256_loadu_si256((const __m256i *)(chunk->amounts + j));
+        __m256i dates = _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i *)(chunk->dates + j)));
+        __m256i mask = _mm256_cmpeq_epi64(_mm256_cvtepu8_epi64(_mm_cvtsi32_si128(deleted)), zero);
+        mask = _mm256_and_si256(mask, _mm256_and_si256(_mm256_cmpgt_epi64(dates, before), _mm256_cmpgt_epi64(after, dates)));
+        if (filter->category >= 0) {
+            __m256i categories = _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i *)(chunk->categories + j)));
+            mask = _mm256_and_si256(mask, _mm256_cmpeq_epi64(categories, category));
+        }
+        totals = _mm256_add_epi64(totals, _mm256_and_si256(amounts, mask));
+        counts = _mm256_sub_epi64(counts, mask);
+        
+        __m256i higher = _mm256_or_si256(_mm256_cmpgt_epi64(amounts, highest), _mm256_cmpeq_epi64(highest_rows, none));
+        higher = _mm256_and_si256(higher, mask);
+        highest = _mm256_blendv_epi8(highest, amounts, higher);
+        highest_rows = _mm256_blendv_epi8(highest_rows, row_numbers, higher);
+        __m256i lower = _mm256_or_si256(_mm256_cmpgt_epi64(lowest, amounts), _mm256_cmpeq_epi64(lowest_rows, none));
+        lower = _mm256_and_si256(lower, mask);
+        lowest = _mm256_blendv_epi8(lowest, amounts, lower);
+        lowest_rows = _mm256_blendv_epi8(lowest_rows, row_numbers, lower);
+        row_numbers = _mm256_add_epi64(row_numbers, step);
+    }
+    
+    long long lane_totals[4], lane_counts[4], lane_highest[4], lane_lowest[4], lane_highest_rows[4], lane_lowest_rows[4];
+    _mm256_storeu_si256((__m256i *)lane_totals, totals);
+    _mm256_storeu_si256((__m256i *)lane_counts, counts);
+    _mm256_storeu_si256((__m256i *)lane_highest, highest);
+    _mm256_storeu_si256((__m256i *)lane_lowest, lowest);
+    _mm256_storeu_si256((__m256i *)lane_highest_rows, highest_rows);
+    _mm256_storeu_si256((__m256i *)lane_lowest_rows, lowest_rows);
+    *summary = (AmountSummary){0, 0, 0, 0, -1, -1};
+    for (int lane = 0; lane < 4; lane++) {
+        summary->count += (int)lane_counts[lane];
+        summary->total += lane_totals[lane];
+        int row = (int)lane_highest_rows[lane];
+        if (row >= 0 && (summary->highest_row < 0 || lane_highest[lane] > summary->highest ||
+                         (lane_highest[lane] == summary->highest && row < summary->highest_row))) {
+            summary->highest = lane_highest[lane];
+            summary->highest_row = row;
+        }
+        row = (int)lane_lowest_rows[lane];
+        if (row >= 0 && (summary->lowest_row < 0 || lane_lowest[lane] < summary->lowest ||
+                         (lane_lowest[lane] == summary->lowest && row < summary->lowest_row))) {
+            summary->lowest = lane_lowest[lane];
+            summary->lowest_row = row;
+        }
+    }
+    for (; j < rows; j++) {
+        if (chunk->deleted[j] || chunk->dates[j] < filter->from || chunk->dates[j] > filter->to ||
+            (filter->category >= 0 && chunk->categories[j] != filter->category)) {
+            continue;
+        }
+        add_amount(summary, chunk->amounts[j], j);
+    }
+}
+#endif
+
+// Picks the AVX2 kernel if the processor has it
+void choose_amount_kernel() {
+    summarize_amounts = summarize_amounts_scalar;
+    amount_kernel_name = "scalar";
+    #ifdef TEXT_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        summarize_amounts = summarize_amounts_avx2;
+        amount_kernel_name = "avx2";
+    }
+    #endif
+}
+
+// Parallel scans
+// The threads a scan may use, the calling one included: the processors
+// online, unless set (up to MAX_SCAN_THREADS)
+int scan_thread_count() {
+    if (scan_threads == 0) {
+        #ifdef _WIN32
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        long processors = (long)info.dwNumberOfProcessors;
+        #else
+        long processors = sysconf(_SC_NPROCESSORS_ONLN);
+        #endif
+        scan_threads = processors < 1 ? 1 : processors > MAX_SCAN_THREADS ? MAX_SCAN_THREADS : (int)processors;
+    }
+    return scan_threads;
+}
+
+// The threads to split `items` between, starting the workers needed if
+// they are not running yet. Small stores get the calling thread alone.
+int scan_threads_for(int items) {
+    int threads = scan_thread_count();
+    if (threads > items) threads = items;
+    if (slot_count < PARALLEL_MIN_ROWS || threads < 1) threads = 1;
+    if (threads - 1 > scan_workers) start_scan_workers(threads - 1 - scan_workers);
+    return threads <= scan_workers + 1 ? threads : scan_workers + 1;
+}
+
+// Starts `count` more workers and waits until they are ready for jobs.
+// Returns how many started.
+int start_scan_workers(int count) {
+    lock_scan_pool();
+    int started = 0;
+    for (int k = 0; k < count; k++) {
+        void *thread = (void *)(size_t)(scan_workers + 1 + k);
+        #ifdef _WIN32
+        HANDLE handle = CreateThread(NULL, 0, scan_worker_main, thread, 0, NULL);
+        if (handle == NULL) break;
+        CloseHandle(handle);
+        #else
+        pthread_t handle;
+        if (pthread_create(&handle, NULL, scan_worker_main, thread) != 0) break;
+        pthread_detach(handle);
+        #endif
+        started++;
+    }
+    while (scan_workers_ready < scan_workers + started) wait_scan_signal(&scan_done);
+    scan_workers += started;
+    unlock_scan_pool();
+    return started;
+}
+
+// Runs task(context, item, thread) for every item from 0 to items - 1 on
+// `threads` threads (see scan_threads_for()), numbered from 0 for the
+// calling thread, and returns once all are done
+void run_parallel(int items, int threads, ScanTask task, void *context) {
+    if (threads <= 1) {
+        for (int item = 0; item < items; item++) task(context, item, 0);
+        return;
+    }
+    
+    lock_scan_pool();
+    scan_job = (ScanJob){task, context, items, 0, threads};
+    scan_workers_busy = scan_workers;
+    scan_generation++;
+    raise_scan_signal(&scan_wake);
+    run_scan_items(0);
+    while (scan_workers_busy > 0) wait_scan_signal(&scan_done);
+    unlock_scan_pool();
+}
+
+// Takes items of the current job until none are left. Called, and returns,
+// with the pool locked.
+void run_scan_items(int thread) {
+    ScanJob job = scan_job;
+    while (scan_job.next_item < job.items) {
+        int item = scan_job.next_item++;
+        unlock_scan_pool();
+        job.task(job.context, item, thread);
+        lock_scan_pool();
+    }
+}
+
+// A worker's life: check in, then take part in every job posted after that
+// (those that want it), reporting back after each
+void run_scan_worker(int thread) {
+    lock_scan_pool();
+    unsigned int seen = scan_generation;
+    scan_workers_ready++;
+    raise_scan_signal(&scan_done);
+    while (1) {
+        while (scan_generation == seen) wait_scan_signal(&scan_wake);
+        seen = scan_generation;
+        if (thread < scan_job.threads) run_scan_items(thread);
+        if (--scan_workers_busy == 0) raise_scan_signal(&scan_done);
+    }
+}
+
+#ifdef _WIN32
+DWORD WINAPI scan_worker_main(LPVOID thread) {
+    run_scan_worker((int)(size_t)thread);
+    return 0;
+}
+#else
+void *scan_worker_main(void *thread) {
+    run_scan_worker((int)(size_t)thread);
+    return NULL;
+}
+#endif
+
+void lock_scan_pool() {
+    #ifdef _WIN32
+    AcquireSRWLockExclusive(&scan_lock);
+    #else
+    pthread_mutex_lock(&scan_lock);
+    #endif
+}
+
+void unlock_scan_pool() {
+    #ifdef _WIN32
+    ReleaseSRWLockExclusive(&scan_lock);
+    #else
+    pthread_mutex_unlock(&scan_lock);
+    #endif
+}
+
+// Waits, with the pool locked, until `signal` is raised
+void wait_scan_signal(ScanSignal *signal) {
+    #ifdef _WIN32
+    SleepConditionVariableSRW(signal, &scan_lock, INFINITE, 0);
+    #else
+    pthread_cond_wait(signal, &scan_lock);
+    #endif
+}
+
+// Wakes every thread waiting for `signal`
+void raise_scan_signal(ScanSignal *signal) {
+    #ifdef _WIN32
+    WakeAllConditionVariable(signal);
+    #else
+    pthread_cond_broadcast(signal);
+    #endif
+}
+
+#ifndef _WIN32
+// Forgets the workers of the process this one was forked from, which did not
+// come along, so that the next parallel scan starts workers of its own
+void reset_scan_pool() {
+    pthread_mutex_init(&scan_lock, NULL);
+    pthread_cond_init(&scan_wake, NULL);
+    pthread_cond_init(&scan_done, NULL);
+    scan_workers = 0;
+    scan_workers_ready = 0;
+    scan_workers_busy = 0;
+}
+#endif
+
+// Entries between one thread's category totals and the next's, with a
+// cache line of room so that threads never write to the same line
+int category_stride() {
+    return (category_count + 3) / 4 * 4 + 4;
+}
+
+// Adds up the records `filter` selects (its category already looked up), a
+// chunk per item of a parallel scan, and a search by a parallel text scan
+// first. The chunks' parts are merged in chunk order, so ties for the
+// highest and lowest amount go to the first record, as in a scan on one
+// thread. Returns 0 (after saying why) if memory is exhausted.
+int scan_totals(const QueryFilter *filter, ScanTotals *totals) {
+    QueryFilter fields = *filter;
+    fields.search = NULL;
+    TextScan text;
+    FilterScan scan = {&fields, NULL, NULL, NULL, category_stride(), 0};
+    if (filter->search != NULL) {
+        if (!begin_text_scan(&text, filter->search)) return 0;
+        scan.text = &text;
+    }
+    
+    if (summarize_amounts == NULL) choose_amount_kernel();
+    scan.with_categories = totals->categories != NULL;
+    
+    int threads = scan_threads_for(chunk_count);
+    scan.chunks = malloc(((size_t)chunk_count + 1) * sizeof(ScanTotals));
+    scan.categories = calloc((size_t)threads * scan.stride, sizeof(CategoryTotal));
+    if (scan.chunks == NULL || scan.categories == NULL) {
+        free(scan.chunks);
+        free(scan.categories);
+        if (scan.text != NULL) end_text_scan(&text);
+        print_error("Out of memory! Cannot total expenses.");
+        return 0;
+    }
+    run_parallel(chunk_count, threads, total_chunk, &scan);
+    
+    CategoryTotal *categories = totals->categories;
+    *totals = (ScanTotals){0, 0, -1, -1, categories};
+    for (int c = 0; c < chunk_count; c++) {
+        const ScanTotals *part = &scan.chunks[c];
+        totals->count += part->count;
+        totals->total += part->total;
+        if (part->highest >= 0 && (totals->highest < 0 || slot_base_amount(part->highest) > slot_base_amount(totals->highest))) {
+            totals->highest = part->highest;
+        }
+        if (part->lowest >= 0 && (totals->lowest < 0 || slot_base_amount(part->lowest) < slot_base_amount(totals->lowest))) {
+            totals->lowest = part->lowest;
+        }
+    }
+    if (categories != NULL && category_count > 0) {
+        memset(categories, 0, category_count * sizeof(CategoryTotal));
+        for (int t = 0; t < threads; t++) {
+            const CategoryTotal *part = scan.categories + (size_t)t * scan.stride;
+            for (int k = 0; k < category_count; k++) {
+                categories[k].total += part[k].total;
+                categories[k].count += part[k].count;
+            }
+        }
+    }
+    
+    free(scan.chunks);
+    free(scan.categories);
+    if (scan.text != NULL) end_text_scan(&text);
+    return 1;
+}
+
+// Totals one chunk's selected records, in the base currency, into its part
+// and its thread's category totals. Without a search, on a chunk all in the
+// base currency, the amount kernel does the totals and the category totals
+// take a second pass over the same, still cached, rows.
+void total_chunk(void *context, int chunk_index, int thread) {
+    FilterScan *scan = context;
+    ExpenseChunk *chunk = expense_chunks[chunk_index];
+    CategoryTotal *categories = scan->categories + (size_t)thread * scan->stride;
+    ScanTotals part = {0, 0, -1, -1, NULL};
+    Money highest = 0, lowest = 0;
+    int rows = chunk_rows(chunk_index);
+    if (scan->text == NULL && chunk_in_base_currency(chunk, rows)) {
+        AmountFilter amounts = {scan->filter->from, scan->filter->to, scan->filter->category};
+        AmountSummary summary;
+        summarize_amounts(chunk, rows, &amounts, &summary);
+        part.count = summary.count;
+        part.total = summary.total;
+        if (summary.count > 0) {
+            part.highest = chunk_index * EXPENSE_CHUNK_SIZE + summary.highest_row;
+            part.lowest = chunk_index * EXPENSE_CHUNK_SIZE + summary.lowest_row;
+        }
+        scan->chunks[chunk_index] = part;
+        if (scan->with_categories) {
+            for (int j = 0; j < rows; j++) {
+                if (!query_matches(scan->filter, chunk, j)) continue;
+                categories[chunk->categories[j]].total += chunk->amounts[j];
+                categories[chunk->categories[j]].count++;
+            }
+        }
+        return;
+    }
+    for (int j = 0; j < rows; j++) {
+        if (!query_matches(scan->filter, chunk, j) || (scan->text != NULL && !text_scan_hit(scan->text, chunk, j))) {
+            continue;
+        }
+        Money amount = base_amount(chunk, j);
+        int slot = chunk_index * EXPENSE_CHUNK_SIZE + j;
+        part.count++;
+        part.total += amount;
+        if (part.highest < 0 || amount > highest) part.highest = slot, highest = amount;
+        if (part.lowest < 0 || amount < lowest) part.lowest = slot, lowest = amount;
+        categories[chunk->categories[j]].total += amount;
+        categories[chunk->categories[j]].count++;
+    }
+    scan->chunks[chunk_index] = part;
+}
+
+// Adds one chunk's live records to its thread's category totals and puts
+// their heap entries in the chunk's own stretch of the highest amount heap
+void aggregate_chunk(void *context, int chunk_index, int thread) {
+    AggregateScan *scan = context;
+    ExpenseChunk *chunk = expense_chunks[chunk_index];
+    CategoryTotal *categories = scan->categories + (size_t)thread * scan->stride;
+    HeapEntry *entries = highest_amounts.entries + (size_t)chunk_index * EXPENSE_CHUNK_SIZE;
+    int rows = chunk_rows(chunk_index), live = 0;
+    for (int j = 0; j < rows; j++) {
+        if (chunk->deleted[j]) continue;
+        Money amount = base_amount(chunk, j);
+        categories[chunk->categories[j]].total += amount;
+        categories[chunk->categories[j]].count++;
+        entries[live].amount = amount;
+        entries[live].slot = chunk_index * EXPENSE_CHUNK_SIZE + j;
+        live++;
+    }
+    scan->live[chunk_index] = live;
+}
+
+// Turns the entries of both amount heaps into heaps. The subtrees below a
+// level with a few of them per thread share nothing, so they are built in
+// parallel and the levels above them after; every entry is sifted down in
+// the same order as in a build on one thread, so the heaps come out the same.
+void heapify_amounts(int threads) {
+    int level = 0;
+    while (threads > 1 && (1 << level) < 4 * threads) level++;
+    run_parallel(1 << level, threads, heapify_subtree, &level);
+    
+    int last_parent = highest_amounts.count / 2 - 1;
+    for (int k = (1 << level) - 2; k >= 0; k--) {
+        if (k > last_parent) continue;
+        heap_sift_down(&highest_amounts, k);
+        heap_sift_down(&lowest_amounts, k);
+    }
+}
+
+// Builds both heaps' subtrees under the item'th node of the level given in
+// `context`, deepest nodes first
+void heapify_subtree(void *context, int item, int thread) {
+    (void)thread;
+    int level = *(const int *)context;
+    long long root = (1LL << level) - 1 + item;
+    long long last_parent = highest_amounts.count / 2 - 1;
+    if (root > last_parent) return;
+    
+    int depth = 0;
+    while (((root + 1) << (depth + 1)) - 1 <= last_parent) depth++;
+    for (; depth >= 0; depth--) {
+        long long first = ((root + 1) << depth) - 1;
+        long long last = first + (1LL << depth) - 1;
+        if (last > last_parent) last = last_parent;
+        for (long long k = last; k >= first; k--) {
+            heap_sift_down(&highest_amounts, (int)k);
+            heap_sift_down(&lowest_amounts, (int)k);
+        }
+    }
+}
+
+void get_current_date(char *buffer) {
+    time_t t = time(NULL);
+    struct tm *tm_info = localtime(&t);
+    strftime(buffer, 11, "%Y-%m-%d", tm_info);
+}
+
+void clear_input_buffer() {
+    int c;
+    while ((c = getchar()) != '\n' && c != EOF);
+}
+
+// Appends the rest of the input line to a word already read with scanf(),
+// dropping the newline and whatever does not fit
+void read_rest_of_line(char *buffer, size_t size) {
+    size_t length = strlen(buffer);
+    if (fgets(buffer + length, size - length, stdin) == NULL) return;
+    if (strchr(buffer + length, '\n') == NULL) clear_input_buffer();
+    buffer[strcspn(buffer, "\n")] = '\0';
+}
+
+// Clears the terminal with ANSI escapes rather than a shell command;
+// enable_colors() turns on escape processing in Windows consoles
+void clear_screen() {
+    printf("\033[2J\033[H");
+    fflush(stdout);
+}
+
+void pause_screen() {
+    printf("\n%sPress Enter to continue...%s", COLOR_CYAN, COLOR_RESET);
+    clear_input_buffer();
+    getchar();
+}
+
+void enable_colors() {
+    #ifdef _WIN32
+    // Enable ANSI color codes in Windows 10+
+    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+    DWORD mode;
+    if (GetConsoleMode(hConsole, &mode)) {
+        SetConsoleMode(hConsole, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+    }
+    #endif
+}
+
+// Command mode
+//
+// Usage: expense <command> [arguments], or `expense batch` to run commands
+// read from stdin, one per line. Changes go to the journal, which is synced
+// once at the end, so a command costs about as much as the change it makes.
+int run_command(int argc, char *argv[]) {
+    if (strcmp(argv[0], "help") == 0) {
+        print_command_usage(stdout);
+        return 0;
+    }
+    
+    batch_mode = 1;
+    
+    // With a server listening, it runs the commands on the store it holds
+    int server = connect_server();
+    if (server >= 0) {
+        int status = strcmp(argv[0], "batch") == 0 ? run_batch(server) : send_request(server, argc, argv, 1);
+        close(server);
+        return status;
+    }
+    
+    load_from_file();
+    
+    int status = strcmp(argv[0], "batch") == 0 ? run_batch(-1) : execute_command(argc, argv);
+    
+    // Without a working journal the changes are saved the way the menu
+    // saves them on exit
+    if ((journal_file == NULL || !journal_commit()) && !checkpoint_data()) {
+        status = 1;
+    }
+    journal_close();
+    free_expenses();
+    return status;
+}
+
+// Runs the commands on stdin, skipping blank lines and lines starting with
+// '#'. A failing command is reported with its line number and the rest still
+// run. Changes are synced every BATCH_COMMIT_COMMANDS commands, so a crash
+// loses at most that many. Commands go one by one to the server if
+// `server` is a connection to one (it syncs each change itself), and run
+// here if it is -1. Returns 0 if every command succeeded.
+int run_batch(int server) {
+    char line[4096];
+    char *args[MAX_COMMAND_ARGS];
+    int failed = 0;
+    int unsynced = 0;
+    
+    while (fgets(line, sizeof(line), stdin) != NULL) {
+        batch_line++;
+        if (strchr(line, '\n') == NULL && !feof(stdin)) {
+            print_error("Line too long!");
+            clear_input_buffer();
+            failed = 1;
+            continue;
+        }
+        
+        int count = split_command_line(line, args, MAX_COMMAND_ARGS);
+        if (count == 0) continue;
+        if (count < 0) {
+            print_error("Unterminated quote or too many arguments!");
+            failed = 1;
+        } else if (strcmp(args[0], "batch") == 0) {
+            print_error("A batch cannot run another batch.");
+            failed = 1;
+        } else if ((server >= 0 ? send_request(server, count, args, 1) : execute_command(count, args)) != 0) {
+            failed = 1;
+        }
+        
+        if (++unsynced == BATCH_COMMIT_COMMANDS) {
+            journal_commit();
+            unsynced = 0;
+        }
+    }
+    batch_line = 0;
+    return failed;
+}
+
+// Runs one command. Returns 0 if it succeeded.
+int execute_command(int argc, char *argv[]) {
+    const char *name = argv[0];
+    
+    if (strcmp(name, "add") == 0) return command_add(argc - 1, argv + 1);
+    if (strcmp(name, "modify") == 0) return command_modify(argc - 1, argv + 1);
+    if (strcmp(name, "delete") == 0) return command_delete(argc - 1, argv + 1);
+    if (strcmp(name, "query") == 0 || strcmp(name, "list") == 0) return command_query(argc - 1, argv + 1);
+    if (strcmp(name, "stats") == 0) return command_stats(argc - 1, argv + 1);
+    if (strcmp(name, "report") == 0) return command_report(argc - 1, argv + 1);
+    if (strcmp(name, "total") == 0) return command_total(argc - 1, argv + 1);
+    if (strcmp(name, "budget") == 0) return command_budget(argc - 1, argv + 1);
+    if (strcmp(name, "import") == 0) return command_import(argc - 1, argv + 1);
+    if (strcmp(name, "export") == 0) return command_export(argc - 1, argv + 1);
+    if (strcmp(name, "help") == 0) {
+        print_command_usage(stdout);
+        return 0;
+    }
+    
+    char message[80];
+    snprintf(message, sizeof(message), "Unknown command '%.32s'! Try 'expense help'.", name);
+    print_error(message);
+    return 1;
+}
+
+// add <date|today> <amount> <category> [description...]
+// Prints the new expense's ID.
+int command_add(int argc, char *argv[]) {
+    if (argc < 3) {
+        print_error("Usage: add <date|today> <amount> <category> [description...]");
+        return 1;
+    }
+    
+    Expense expense;
+    memset(&expense, 0, sizeof(expense));
+    if (!set_expense_field(&expense, "date", argv[0]) ||
+        !set_expense_field(&expense, "amount", argv[1]) ||
+        !set_expense_field(&expense, "category", argv[2])) {
+        return 1;
+    }
+    
+    // The remaining arguments are the words of the description
+    size_t length = 0;
+    for (int k = 3; k < argc && length < sizeof(expense.description) - 1; k++) {
+        length += snprintf(expense.description + length, sizeof(expense.description) - length,
+                           k == 3 ? "%s" : " %s", argv[k]);
+    }
+    
+    expense.id = allocate_expense_id();
+    if (expense.id == 0) {
+        print_error("No expense IDs left! Cannot add more expenses.");
+        return 1;
+    }
+    if (!append_expense(&expense)) {
+        print_error("Out of memory! Cannot add more expenses.");
+        return 1;
+    }
+    journal_record(JOURNAL_ADD, &expense);
+    check_budgets(&expense, NULL);
+    
+    printf("%d\n", expense.id);
+    return 0;
+}
+
+// modify <id> [--date D] [--amount A] [--currency CODE] [--category C]
+//        [--description TEXT]
+int command_modify(int argc, char *argv[]) {
+    if (argc < 1 || argc % 2 == 0) {
+        print_error("Usage: modify <id> [--date D] [--amount A] [--currency CODE] [--category C] [--description TEXT]");
+        return 1;
+    }
+    
+    int slot = find_command_expense(argv[0]);
+    if (slot == -1) return 1;
+    
+    Expense expense, old;
+    read_expense(slot, &expense);
+    old = expense;
+    for (int k = 1; k < argc; k += 2) {
+        const char *field = strncmp(argv[k], "--", 2) == 0 ? argv[k] + 2 : "";
+        if (!set_expense_field(&expense, field, argv[k + 1])) return 1;
+    }
+    
+    if (!write_expense(slot, &expense)) {
+        print_error("Out of memory! Expense was not modified.");
+        return 1;
+    }
+    journal_record(JOURNAL_MODIFY, &expense);
+    check_budgets(&expense, &old);
+    return 0;
+}
+
+// delete <id>
+int command_delete(int argc, char *argv[]) {
+    if (argc != 1) {
+        print_error("Usage: delete <id>");
+        return 1;
+    }
+    
+    int slot = find_command_expense(argv[0]);
+    if (slot == -1) return 1;
+    
+    Expense expense;
+    read_expense(slot, &expense);
+    remove_expense_at(slot);
+    journal_record(JOURNAL_DELETE, &expense);
+    return 0;
+}
+
+// query [--from D] [--to D] [--category C] [--search TEXT] [--match WORDS]
+//       [--sort date|amount|category] [--order asc|desc] [--limit N] [--after ID]
+// Prints the matching expenses, one per line as tab-separated fields, in
+// the order and page asked for (see select_expenses()).
+int command_query(int argc, char *argv[]) {
+    QueryFilter filter = {FIRST_INDEXED_DAY, LAST_INDEXED_DAY, 0, NULL, -1, NULL, NULL, {"", 0}};
+    ResultOrder order = {SORT_NONE, 0, 0, 0};
+    for (int k = 0; k < argc; k += 2) {
+        int parsed = k + 1 < argc ? parse_query_option(&filter, argv[k], argv[k + 1]) : 0;
+        if (parsed == 0 && k + 1 < argc) parsed = parse_order_option(&order, argv[k], argv[k + 1]);
+        if (parsed < 0) return 1;
+        if (parsed == 0) {
+            print_error("Usage: query [--from D] [--to D] [--category C] [--search TEXT] [--match WORDS] "
+                        "[--sort date|amount|category] [--order asc|desc] [--limit N] [--after ID]");
+            return 1;
+        }
+    }
+    
+    OutputBuffer out;
+    if (!output_open(&out, stdout)) return 1;
+    int ok = select_expenses(&filter, &order, &out, FORMAT_TSV);
+    return !(output_close(&out) && ok);
+}
+
+// Applies one query option (--from, --to, --category, --search or --match) to
+// `filter`. Returns 1 if it was one, 0 if it was not, or -1 (after saying
+// why) if its value is not valid.
+int parse_query_option(QueryFilter *filter, const char *option, const char *value) {
+    if (strcmp(option, "--from") == 0 || strcmp(option, "--to") == 0) {
+        if (!parse_date(value, strcmp(option, "--from") == 0 ? &filter->from : &filter->to)) {
+            print_error("Invalid date format! Please use YYYY-MM-DD format.");
+            return -1;
+        }
+        filter->by_date = 1;
+    } else if (strcmp(option, "--category") == 0) {
+        filter->category_name = value;
+    } else if (strcmp(option, "--search") == 0) {
+        filter->search = value;
+    } else if (strcmp(option, "--match") == 0) {
+        SearchQuery query;
+        if (!parse_search(value, &query)) {
+            print_error("Nothing to match, or too many words!");
+            return -1;
+        }
+        filter->match = value;
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+// Writes the expenses `filter` selects to `out`, in the order and page
+// `order` asks for (NULL or SORT_NONE with no limit and cursor for every
+// match in the order visit_expenses() finds them). Returns 0 if the indexes
+// could not be built, memory ran out or the cursor's expense is gone.
+int select_expenses(QueryFilter *filter, const ResultOrder *order, OutputBuffer *out, int format) {
+    if ((filter->by_date || filter->category_name != NULL) && !require_indexes()) return 0;
+    if (filter->category_name != NULL) {
+        filter->category = find_category(filter->category_name);
+        if (filter->category < 0) return 1;
+    }
+    if (filter->search != NULL) fold_needle(filter->search, &filter->needle);
+    
+    RecordWriter writer = {out, format, 0, -1};
+    if (order != NULL && (order->key != SORT_NONE || order->limit > 0 || order->after != 0)) {
+        int cursor_slot = -1;
+        if (order->after != 0 && (cursor_slot = find_expense_by_id(order->after)) < 0) {
+            print_error("Expense with specified ID not found.");
+            return 0;
+        }
+        // Pages come in the order the whole query would print in: by date
+        // when the date index is walked, otherwise by slot
+        ResultOrder paged = *order;
+        if (paged.key == SORT_NONE && filter->by_date && filter->match == NULL) paged.key = SORT_DATE;
+        if (paged.key != SORT_NONE) return select_ordered(filter, &paged, cursor_slot, out, format);
+        writer.start = cursor_slot + 1;
+        writer.left = order->limit > 0 ? order->limit : -1;
+        if (writer.left == 0) return 1;
+    }
+    return visit_expenses(filter, writer.start, write_visited, &writer);
+}
+
+// Hands `visit` the slots of the expenses `filter` (its category looked up
+// and search folded) selects, from slot `start` on where the walk is in
+// slot order. With words to match, the text index finds them in slot
+// order; with a date bound the date index is walked and they come in date
+// order; with only a category its slot list is walked; otherwise every slot
+// is. Returns 0 if memory ran out.
+int visit_expenses(const QueryFilter *filter, int start, SlotVisitor visit, void *context) {
+    if (filter->match != NULL) {
+        SearchQuery query;
+        int *slots;
+        parse_search(filter->match, &query);
+        int count = search_slots(&query, &slots);
+        for (int k = 0; k < count; k++) {
+            ExpenseChunk *chunk = chunk_of(slots[k]);
+            int row = slots[k] % EXPENSE_CHUNK_SIZE;
+            if (slots[k] >= start && query_matches(filter, chunk, row) && !visit(context, slots[k])) break;
+        }
+        free(slots);
+        return count >= 0;
+    } else if (filter->by_date) {
+        for (int day = filter->from; day <= filter->to; day++) {
+            SlotList *page = date_pages[(day - FIRST_INDEXED_DAY) / DATE_PAGE_DAYS];
+            if (page == NULL) {
+                day += DATE_PAGE_DAYS - 1 - (day - FIRST_INDEXED_DAY) % DATE_PAGE_DAYS;
+                continue;
+            }
+            SlotList *list = &page[(day - FIRST_INDEXED_DAY) % DATE_PAGE_DAYS];
+            slot_list_sort(list);
+            for (int k = 0; k < list->count; k++) {
+                ExpenseChunk *chunk = chunk_of(list->slots[k]);
+                int row = list->slots[k] % EXPENSE_CHUNK_SIZE;
+                if (chunk->dates[row] == day && query_matches(filter, chunk, row) && !visit(context, list->slots[k])) {
+                    return 1;
+                }
+            }
+        }
+    } else if (filter->category >= 0) {
+        SlotList *list = &category_slots[filter->category];
+        slot_list_sort(list);
+        int low = 0, high = list->count;
+        while (low < high) {
+            int middle = low + (high - low) / 2;
+            if (list->slots[middle] < start) low = middle + 1;
+            else high = middle;
+        }
+        for (int k = low; k < list->count; k++) {
+            ExpenseChunk *chunk = chunk_of(list->slots[k]);
+            int row = list->slots[k] % EXPENSE_CHUNK_SIZE;
+            if (query_matches(filter, chunk, row) && !visit(context, list->slots[k])) return 1;
+        }
+    } else if (filter->search != NULL) {
+        TextScan scan;
+        if (!begin_text_scan(&scan, filter->search)) return 0;
+        int slots[TEXT_SCAN_BATCH];
+        int count, stopped = 0;
+        while (!stopped && (count = next_text_matches(&scan, slots, TEXT_SCAN_BATCH)) > 0) {
+            for (int k = 0; k < count && !stopped; k++) {
+                ExpenseChunk *chunk = chunk_of(slots[k]);
+                int row = slots[k] % EXPENSE_CHUNK_SIZE;
+                stopped = slots[k] >= start && query_matches(filter, chunk, row) && !visit(context, slots[k]);
+            }
+        }
+        end_text_scan(&scan);
+    } else {
+        for (int c = start / EXPENSE_CHUNK_SIZE; c < chunk_count; c++) {
+            ExpenseChunk *chunk = expense_chunks[c];
+            int rows = chunk_rows(c);
+            for (int j = c == start / EXPENSE_CHUNK_SIZE ? start % EXPENSE_CHUNK_SIZE : 0; j < rows; j++) {
+                if (query_matches(filter, chunk, j) && !visit(context, c * EXPENSE_CHUNK_SIZE + j)) return 1;
+            }
+        }
+    }
+    return 1;
+}
+
+// Writes a visited record, as long as the writer has rows left
+int write_visited(void *context, int slot) {
+    RecordWriter *writer = context;
+    write_record(writer->out, writer->format, chunk_of(slot), slot % EXPENSE_CHUNK_SIZE);
+    return writer->left < 0 || --writer->left > 0;
+}
+
+// stats [--from D] [--to D] [--category C] [--search TEXT]
+// Prints `count`, `total` and `average` lines as name and value separated
+// by a tab, `highest` and `lowest` lines with the id and amount, then a
+// `category` line with the name, total and count of each category in use,
+// all in the base currency. With no options the aggregates answer; options
+// select the expenses as a query would, and a parallel scan with the amount
+// kernels adds them up.
+int command_stats(int argc, char *argv[]) {
+    QueryFilter filter = {FIRST_INDEXED_DAY, LAST_INDEXED_DAY, 0, NULL, -1, NULL, NULL, {"", 0}};
+    for (int k = 0; k < argc; k += 2) {
+        int by_words = strcmp(argv[k], "--match") == 0;
+        int parsed = k + 1 < argc && !by_words ? parse_query_option(&filter, argv[k], argv[k + 1]) : 0;
+        if (parsed < 0) return 1;
+        if (parsed == 0) {
+            print_error("Usage: stats [--from D] [--to D] [--category C] [--search TEXT]");
+            return 1;
+        }
+    }
+    
+    ScanTotals totals = {0, 0, -1, -1, NULL};
+    if (argc == 0) {
+        if (!require_aggregates()) return 1;
+        totals = (ScanTotals){expense_count, amount_total, heap_top(&highest_amounts), heap_top(&lowest_amounts), category_totals};
+    } else {
+        filter.category = filter.category_name != NULL ? find_category(filter.category_name) : -1;
+        if (filter.category_name == NULL || filter.category >= 0) {
+            totals.categories = malloc((category_count + 1) * sizeof(CategoryTotal));
+            if (totals.categories == NULL) {
+                print_error("Out of memory! Cannot total expenses.");
+                return 1;
+            }
+            if (!scan_totals(&filter, &totals)) {
+                free(totals.categories);
+                return 1;
+            }
+        }
+    }
+    
+    char text[MONEY_TEXT_SIZE];
+    printf("count\t%d\n", totals.count);
+    printf("total\t%s\n", format_money(totals.total, text));
+    printf("average\t%s\n", format_money(rounded_average(totals.total, totals.count), text));
+    int extremes[2] = {totals.highest, totals.lowest};
+    for (int e = 0; e < 2 && totals.count > 0; e++) {
+        ExpenseChunk *chunk = chunk_of(extremes[e]);
+        int row = extremes[e] % EXPENSE_CHUNK_SIZE;
+        printf("%s\t%d\t%s\n", e == 0 ? "highest" : "lowest", chunk->ids[row], format_money(base_amount(chunk, row), text));
+    }
+    for (int k = 0; k < category_count && totals.categories != NULL; k++) {
+        if (totals.categories[k].count == 0) continue;
+        printf("category\t%s\t%s\t%d\n", category_names[k], format_money(totals.categories[k].total, text), totals.categories[k].count);
+    }
+    if (argc != 0) free(totals.categories);
+    return 0;
+}
+
+// report [--from YYYY-MM] [--to YYYY-MM] [--by month|year] [--category C]
+//        [--currency CODE]
+// Prints a line for every month (or year) and category with spending in it:
+// the period as YYYY-MM (or YYYY), the category, total and count, separated
+// by tabs, in period order and by category name within a period. A bound
+// given as a year alone means its first or last month. Totals are in the
+// base currency unless another is asked for, each month's spending
+// converted at that month's rates.
+int command_report(int argc, char *argv[]) {
+    int from = INT_MIN, to = INT_MAX, by_year = 0;
+    const char *category_name = NULL;
+    char code[4] = BASE_CURRENCY;
+    for (int k = 0; k < argc; k += 2) {
+        const char *value = k + 1 < argc ? argv[k + 1] : NULL;
+        if (value != NULL && (strcmp(argv[k], "--from") == 0 || strcmp(argv[k], "--to") == 0)) {
+            int last = strcmp(argv[k], "--to") == 0;
+            if (!parse_month(value, last, last ? &to : &from)) {
+                print_error("Invalid month! Please use YYYY-MM or YYYY format.");
+                return 1;
+            }
+        } else if (value != NULL && strcmp(argv[k], "--by") == 0 &&
+                   (strcmp(value, "month") == 0 || strcmp(value, "year") == 0)) {
+            by_year = strcmp(value, "year") == 0;
+        } else if (value != NULL && strcmp(argv[k], "--category") == 0) {
+            category_name = value;
+        } else if (value != NULL && strcmp(argv[k], "--currency") == 0) {
+            if (!parse_currency(value, code)) {
+                print_error("Invalid currency! Please use a three-letter code such as USD.");
+                return 1;
+            }
+            if (!check_currency(code)) return 1;
+        } else {
+            print_error("Usage: report [--from YYYY-MM] [--to YYYY-MM] [--by month|year] [--category C] [--currency CODE]");
+            return 1;
+        }
+    }
+    if (!require_rollups()) return 1;
+    int category = category_name != NULL ? find_category(category_name) : -1;
+    if (category_name != NULL && category < 0) return 0;
+    int currency = find_currency(code);
+    
+    ReportRow *rows;
+    int count = collect_report(from, to, by_year, category, currency > 0 ? currency : 0, &rows);
+    if (count < 0) {
+        print_error("Out of memory! Cannot build the report.");
+        return 1;
+    }
+    char text[MONEY_TEXT_SIZE];
+    for (int k = 0; k < count; k++) {
+        if (by_year) printf("%04d", rows[k].period);
+        else printf("%04d-%02d", rows[k].period / 12, rows[k].period % 12 + 1);
+        printf("\t%s\t%s\t%d\n", category_names[rows[k].category], format_money(rows[k].total, text), rows[k].count);
+    }
+    free(rows);
+    return 0;
+}
+
+// Reads YYYY-MM, or YYYY for the first month of the year (the last if
+// `last` is set), as a month count. Returns 0 if the text is neither.
+int parse_month(const char *text, int last, int *month) {
+    size_t length = strlen(text);
+    if ((length != 4 && length != 7) || (length == 7 && text[4] != '-')) return 0;
+    
+    int year = 0, number = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (i == 4) continue;
+        if (!isdigit((unsigned char)text[i])) return 0;
+        if (i < 4) year = year * 10 + text[i] - '0';
+        else number = number * 10 + text[i] - '0';
+    }
+    if (length == 4) number = last ? 12 : 1;
+    if (year < 1 || number < 1 || number > 12) return 0;
+    *month = year * 12 + number - 1;
+    return 1;
+}
+
+// total [--from D] [--to D] [--category C] [--search TEXT]
+// Prints `count` and `total` lines for the expenses a query with the same
+// options would list, without listing them. Totals by date and category
+// come from the range total trees; a search takes a parallel scan.
+int command_total(int argc, char *argv[]) {
+    QueryFilter filter = {FIRST_INDEXED_DAY, LAST_INDEXED_DAY, 0, NULL, -1, NULL, NULL, {"", 0}};
+    for (int k = 0; k < argc; k += 2) {
+        int by_words = strcmp(argv[k], "--match") == 0;
+        int parsed = k + 1 < argc && !by_words ? parse_query_option(&filter, argv[k], argv[k + 1]) : 0;
+        if (parsed < 0) return 1;
+        if (parsed == 0) {
+            print_error("Usage: total [--from D] [--to D] [--category C] [--search TEXT]");
+            return 1;
+        }
+    }
+    
+    Money total = 0;
+    int count = 0;
+    filter.category = filter.category_name != NULL ? find_category(filter.category_name) : -1;
+    int known = filter.category_name == NULL || filter.category >= 0;
+    if (known && filter.search != NULL) {
+        ScanTotals totals = {0, 0, -1, -1, NULL};
+        if (!scan_totals(&filter, &totals)) return 1;
+        total = totals.total;
+        count = totals.count;
+    } else if (known) {
+        DayTree *tree = require_day_tree(filter.category);
+        if (tree == NULL) return 1;
+        day_range_total(tree, filter.from, filter.to, &total, &count);
+    }
+    char text[MONEY_TEXT_SIZE];
+    printf("count\t%d\n", count);
+    printf("total\t%s\n", format_money(total, text));
+    return 0;
+}
+
+// budget [YYYY-MM] | budget set <amount> [category] | budget clear [category]
+// Sets or clears the monthly budget for a category, or for all spending
+// without one, saving the budgets straight away. With only a month (the
+// current one by default) prints a line per budget: the category (`*` for
+// all spending), the limit and the month's spending, separated by tabs.
+int command_budget(int argc, char *argv[]) {
+    const char *usage = "Usage: budget [YYYY-MM] | budget set <amount> [category] | budget clear [category]";
+    if (argc > 0 && strcmp(argv[0], "set") == 0) {
+        Money limit;
+        if (argc != 2 && argc != 3) {
+            print_error(usage);
+            return 1;
+        }
+        if (!parse_money(argv[1], &limit) || limit <= 0) {
+            print_error("Invalid amount! Please enter a positive number.");
+            return 1;
+        }
+        if (!set_budget(argc == 3 ? argv[2] : "", limit)) {
+            print_error("Out of memory! Cannot set the budget.");
+            return 1;
+        }
+        return !save_budgets();
+    }
+    if (argc > 0 && strcmp(argv[0], "clear") == 0) {
+        if (argc > 2) {
+            print_error(usage);
+            return 1;
+        }
+        if (!clear_budget(argc == 2 ? argv[1] : "")) {
+            print_error("There is no such budget.");
+            return 1;
+        }
+        return !save_budgets();
+    }
+    
+    int month;
+    char today[11];
+    get_current_date(today);
+    today[7] = '\0';
+    if (argc > 1 || !parse_month(argc == 1 ? argv[0] : today, 0, &month)) {
+        print_error(usage);
+        return 1;
+    }
+    if (!require_rollups()) return 1;
+    for (int k = 0; k < budget_count; k++) {
+        Money spent = 0;
+        if (k == overall_budget) {
+            if (!require_month_totals()) return 1;
+            Money *month_spent = month_total(month);
+            spent = month_spent != NULL ? *month_spent : 0;
+        } else {
+            int category = find_category(budgets[k].category);
+            spent = category >= 0 ? rollup_total(month, category) : 0;
+        }
+        char limit[MONEY_TEXT_SIZE], total[MONEY_TEXT_SIZE];
+        printf("%s\t%s\t%s\n", k == overall_budget ? "*" : budgets[k].category,
+               format_money(budgets[k].limit, limit), format_money(spent, total));
+    }
+    return 0;
+}
+
+void print_command_usage(FILE *stream) {
+    fprintf(stream,
+            "Usage: expense <command> [arguments]\n"
+            "\n"
+            "  add <date|today> <amount> <category> [description...]\n"
+            "  modify <id> [--date D] [--amount A] [--currency CODE] [--category C]\n"
+            "         [--description TEXT]\n"
+            "  delete <id>\n"
+            "  query [--from D] [--to D] [--category C] [--search TEXT] [--match WORDS]\n"
+            "        [--sort date|amount|category] [--order asc|desc] [--limit N] [--after ID]\n"
+            "  list                  same as query with no filters\n"
+            "  total [--from D] [--to D] [--category C] [--search TEXT]\n"
+            "  stats [--from D] [--to D] [--category C] [--search TEXT]\n"
+            "  report [--from YYYY-MM] [--to YYYY-MM] [--by month|year] [--category C]\n"
+            "         [--currency CODE]\n"
+            "  budget [YYYY-MM]      budgets and what was spent against them\n"
+            "  budget set <amount> [category]\n"
+            "  budget clear [category]\n"
+            "  import <file|-> [--format csv|jsonl]\n"
+            "  export [--format csv|jsonl] [--output FILE] [query options]\n"
+            "  batch                 run commands from stdin, one per line\n"
+            "\n"
+            "Dates are YYYY-MM-DD. Amounts are in taka unless a currency code follows\n"
+            "them, as in 12.50USD; a currency needs a rate in the data file's .rates\n"
+            "file, one `YYYY-MM-DD CODE RATE` line per date it changed. Records print\n"
+            "as tab-separated id, date, amount, category, description and currency.\n"
+            "Errors go to stderr and the exit status is non-zero if any command failed.\n"
+            "While `expense --serve` runs in the same directory, it runs the commands.\n"
+            "\n"
+            "import reads CSV with date, amount, category, description and currency\n"
+            "columns, in that order or under a header naming them, or JSON lines with\n"
+            "those members; the currency may be left out.\n"
+            "Rejected rows are reported by line and the rest are still imported.\n"
+            "export writes the expenses a query would list (all by default) in either\n"
+            "format, with an id column or member that import ignores.\n"
+            "total prints the count and total of what a query would list.\n"
+            "stats adds its average, highest and lowest amounts and category totals.\n"
+            "total, stats and budgets count every amount in taka, at its month's rate.\n"
+            "report prints the total and count per month (or year) and category, in\n"
+            "taka or the currency asked for.\n"
+            "budget sets monthly limits on a category, or on all spending without one;\n"
+            "changes that take a month to 80%% of a limit or over it are warned about.\n"
+            "\n"
+            "--search finds text anywhere in the description or category, ignoring\n"
+            "case.\n"
+            "--match finds whole words, ignoring case: all of them, or either side of\n"
+            "an OR, and a word ending in * matches words starting with it.\n");
+}
+
+// Splits a line into arguments in place at runs of whitespace. Double quotes
+// group words, and may be empty. Returns the number of arguments, 0 for a
+// blank or comment line, or -1 for an unterminated quote or more than
+// `max_args` arguments.
+int split_command_line(char *line, char *args[], int max_args) {
+    int count = 0;
+    char *p = line;
+    
+    while (1) {
+        while (isspace((unsigned char)*p)) p++;
+        if (*p == '\0' || (count == 0 && *p == '#')) return count;
+        if (count == max_args) return -1;
+        
+        char *out = p;
+        args[count++] = out;
+        while (*p != '\0' && !isspace((unsigned char)*p)) {
+            if (*p != '"') {
+                *out++ = *p++;
+                continue;
+            }
+            for (p++; *p != '"'; ) {
+                if (*p == '\0') return -1;
+                *out++ = *p++;
+            }
+            p++;
+        }
+        
+        // The terminator may land on the separator, so step past it first
+        int more = *p != '\0';
+        if (more) p++;
+        *out = '\0';
+        if (!more) return count;
+    }
+}
+
+// Sets one field of `expense` from command text, accepting what the menu
+// accepts. Returns 0 (after saying why) if the field or value is not valid.
+int set_expense_field(Expense *expense, const char *field, const char *value) {
+    if (strcmp(field, "date") == 0) {
+        if (strcmp(value, "today") == 0) {
+            get_current_date(expense->date);
+        } else if (validate_date(value)) {
+            strcpy(expense->date, value);
+        } else {
+            print_error("Invalid date format! Please use YYYY-MM-DD format.");
+            return 0;
+        }
+    } else if (strcmp(field, "amount") == 0) {
+        // A currency code after the amount changes the currency too
+        Money amount;
+        char currency[4];
+        if (!parse_amount(value, &amount, currency)) {
+            print_error("Invalid amount! Please enter a positive number, optionally followed by a currency code.");
+            return 0;
+        }
+        if (currency[0] != '\0' && !check_currency(currency)) return 0;
+        expense->amount = amount;
+        if (currency[0] != '\0') strcpy(expense->currency, currency);
+    } else if (strcmp(field, "currency") == 0) {
+        char currency[4];
+        if (!parse_currency(value, currency)) {
+            print_error("Invalid currency! Please use a three-letter code such as USD.");
+            return 0;
+        }
+        if (!check_currency(currency)) return 0;
+        strcpy(expense->currency, currency);
+    } else if (strcmp(field, "category") == 0) {
+        snprintf(expense->category, sizeof(expense->category), "%s", value);
+    } else if (strcmp(field, "description") == 0) {
+        snprintf(expense->description, sizeof(expense->description), "%s", value);
+    } else {
+        print_error("Unknown field! Use --date, --amount, --currency, --category or --description.");
+        return 0;
+    }
+    return 1;
+}
+
+// Looks up the expense an ID argument names. Returns its slot, or -1 (after
+// saying why) if the argument is not an ID or there is no such expense.
+int find_command_expense(const char *text) {
+    char *end;
+    long id = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || id <= 0 || id > INT_MAX) {
+        print_error("Invalid ID!");
+        return -1;
+    }
+    
+    int slot = find_expense_by_id((int)id);
+    if (slot == -1) {
+        print_error("Expense with specified ID not found.");
+    }
+    return slot;
+}
+
+int query_matches(const QueryFilter *filter, const ExpenseChunk *chunk, int row) {
+    if (chunk->deleted[row]) return 0;
+    if (chunk->dates[row] < filter->from || chunk->dates[row] > filter->to) return 0;
+    if (filter->category >= 0 && chunk->categories[row] != filter->category) return 0;
+    return filter->search == NULL ||
+           text_contains(category_names[chunk->categories[row]], &filter->needle) ||
+           text_contains(description_text(chunk->descriptions[row]), &filter->needle);
+}
+
+// Result sets
+// Applies one ordering option (--sort, --order, --limit or --after) to
+// `order`. Returns 1 if it was one, 0 if it was not, or -1 (after saying
+// why) if its value is not valid.
+int parse_order_option(ResultOrder *order, const char *option, const char *value) {
+    if (strcmp(option, "--sort") == 0) {
+        const char *keys[] = {"date", "amount", "category"};
+        order->key = SORT_NONE;
+        for (int k = 0; k < 3; k++) {
+            if (strcmp(value, keys[k]) == 0) order->key = SORT_DATE + k;
+        }
+        if (order->key == SORT_NONE) {
+            print_error("Invalid sort! Please use date, amount or category.");
+            return -1;
+        }
+    } else if (strcmp(option, "--order") == 0) {
+        if (strcmp(value, "asc") != 0 && strcmp(value, "desc") != 0) {
+            print_error("Invalid order! Please use asc or desc.");
+            return -1;
+        }
+        order->descending = strcmp(value, "desc") == 0;
+    } else if (strcmp(option, "--limit") == 0 || strcmp(option, "--after") == 0) {
+        char *end;
+        long number = strtol(value, &end, 10);
+        if (end == value || *end != '\0' || number <= 0 || number > INT_MAX) {
+            print_error(strcmp(option, "--limit") == 0 ? "Invalid limit! Please give a positive number." : "Invalid ID!");
+            return -1;
+        }
+        if (strcmp(option, "--limit") == 0) order->limit = (int)number;
+        else order->after = (int)number;
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+// Writes the page `order` asks for, starting after the row in
+// `cursor_slot` (-1 for the first page). By date without words to match
+// the date index is walked from the cursor and the walk stops when the page
+// is full; otherwise every selected row after the cursor is offered to a
+// heap of the page's size, so a page of k rows out of n costs n log k and
+// only the page is sorted. Returns 0 if memory ran out.
+int select_ordered(const QueryFilter *filter, const ResultOrder *order, int cursor_slot, OutputBuffer *out, int format) {
+    if (order->key == SORT_DATE && filter->match == NULL) {
+        return write_by_date(filter, order, cursor_slot, out, format);
+    }
+    
+    ResultSet set = {filter, order, NULL, cursor_slot >= 0, {0, 0}, NULL, 0, 0, 0};
+    int *ranks = NULL, *names = NULL;
+    if (order->key == SORT_CATEGORY) {
+        ranks = malloc((category_count + 1) * sizeof(int));
+        names = malloc((category_count + 1) * sizeof(int));
+        if (ranks == NULL || names == NULL) {
+            free(ranks);
+            free(names);
+            print_error("Out of memory! Cannot sort the expenses.");
+            return 0;
+        }
+        for (int k = 0; k < category_count; k++) names[k] = k;
+        qsort(names, category_count, sizeof(int), compare_category_names);
+        for (int k = 0; k < category_count; k++) ranks[names[k]] = k;
+        free(names);
+        set.ranks = ranks;
+    }
+    if (set.has_cursor) set.cursor = result_row(&set, cursor_slot);
+    
+    int ok = visit_expenses(filter, 0, keep_result, &set) && !set.failed;
+    if (ok) {
+        qsort(set.rows, set.count, sizeof(ResultRow), compare_result_rows);
+        for (int k = 0; k < set.count; k++) {
+            write_record(out, format, chunk_of(set.rows[k].slot), set.rows[k].slot % EXPENSE_CHUNK_SIZE);
+        }
+    } else {
+        print_error("Out of memory! Cannot sort the expenses.");
+    }
+    free(set.rows);
+    free(ranks);
+    return ok;
+}
+
+// Writes a page by date, walking the date index a day at a time forwards or
+// backwards from the cursor's day (or the filter's first), each day's
+// slots in order, until the page is full or the range ends
+int write_by_date(const QueryFilter *filter, const ResultOrder *order, int cursor_slot, OutputBuffer *out, int format) {
+    if (!require_indexes()) return 0;
+    int step = order->descending ? -1 : 1;
+    int day = order->descending ? filter->to : filter->from;
+    int last = order->descending ? filter->from : filter->to;
+    int cursor_day = cursor_slot >= 0 ? chunk_of(cursor_slot)->dates[cursor_slot % EXPENSE_CHUNK_SIZE] : 0;
+    if (cursor_slot >= 0 && (order->descending ? cursor_day < day : cursor_day > day)) day = cursor_day;
+    
+    int left = order->limit > 0 ? order->limit : -1;
+    for (; left != 0 && (order->descending ? day >= last : day <= last); day += step) {
+        int offset = (day - FIRST_INDEXED_DAY) % DATE_PAGE_DAYS;
+        SlotList *page = date_pages[(day - FIRST_INDEXED_DAY) / DATE_PAGE_DAYS];
+        if (page == NULL) {
+            day += order->descending ? -offset : DATE_PAGE_DAYS - 1 - offset;
+            continue;
+        }
+        SlotList *list = &page[offset];
+        slot_list_sort(list);
+        for (int k = 0; k < list->count && left != 0; k++) {
+            int slot = list->slots[k];
+            ExpenseChunk *chunk = chunk_of(slot);
+            int row = slot % EXPENSE_CHUNK_SIZE;
+            if (cursor_slot >= 0 && day == cursor_day && slot <= cursor_slot) continue;
+            if (chunk->dates[row] != day || !query_matches(filter, chunk, row)) continue;
+            write_record(out, format, chunk, row);
+            if (left > 0) left--;
+        }
+    }
+    return 1;
+}
+
+ResultRow result_row(const ResultSet *set, int slot) {
+    ExpenseChunk *chunk = chunk_of(slot);
+    int row = slot % EXPENSE_CHUNK_SIZE;
+    long long key = 0;
+    if (set->order->key == SORT_DATE) key = chunk->dates[row];
+    else if (set->order->key == SORT_AMOUNT) key = base_amount(chunk, row);
+    else if (set->order->key == SORT_CATEGORY) key = set->ranks[chunk->categories[row]];
+    return (ResultRow){set->order->descending ? -key : key, slot};
+}
+
+int result_before(const ResultRow *a, const ResultRow *b) {
+    return a->key < b->key || (a->key == b->key && a->slot < b->slot);
+}
+
+// Offers a selected row to the result set: kept if it comes after the
+// cursor and, when the set is full, before the last row it holds
+int keep_result(void *context, int slot) {
+    ResultSet *set = context;
+    ResultRow row = result_row(set, slot);
+    if (set->has_cursor && !result_before(&set->cursor, &row)) return 1;
+    
+    int limit = set->order->limit;
+    if (limit > 0 && set->count == limit) {
+        if (result_before(&row, &set->rows[0])) {
+            set->rows[0] = row;
+            result_sift_down(set->rows, set->count, 0);
+        }
+        return 1;
+    }
+    if (set->count == set->capacity) {
+        int capacity = set->capacity > 0 ? set->capacity * 2 : 256;
+        if (limit > 0 && capacity > limit) capacity = limit;
+        ResultRow *rows = realloc(set->rows, (size_t)capacity * sizeof(ResultRow));
+        if (rows == NULL) {
+            set->failed = 1;
+            return 0;
+        }
+        set->rows = rows;
+        set->capacity = capacity;
+    }
+    set->rows[set->count++] = row;
+    if (limit > 0 && set->count == limit) {
+        for (int k = limit / 2 - 1; k >= 0; k--) result_sift_down(set->rows, set->count, k);
+    }
+    return 1;
+}
+
+// Moves a row down a heap with the last row in the order on top
+void result_sift_down(ResultRow *rows, int count, int index) {
+    while (1) {
+        int child = 2 * index + 1;
+        if (child >= count) return;
+        if (child + 1 < count && result_before(&rows[child], &rows[child + 1])) child++;
+        if (!result_before(&rows[index], &rows[child])) return;
+        ResultRow swap = rows[index];
+        rows[index] = rows[child];
+        rows[child] = swap;
+        index = child;
+    }
+}
+
+int compare_result_rows(const void *a, const void *b) {
+    return result_before(b, a) - result_before(a, b);
+}
+
+// Import
+// import <file|-> [--format csv|jsonl]
+// Adds the expenses in a CSV or JSON-lines file (see import_expenses()) and
+// saves the store once at the end. Prints how many rows were imported and
+// rejected; the exit status is 1 if any were rejected.
+int command_import(int argc, char *argv[]) {
+    if (argc != 1 && !(argc == 3 && strcmp(argv[1], "--format") == 0)) {
+        print_error("Usage: import <file|-> [--format csv|jsonl]");
+        return 1;
+    }
+    
+    const char *extension = strrchr(argv[0], '.');
+    int format = argc == 3 ? format_by_name(argv[2]) :
+                 extension != NULL && format_by_name(extension + 1) ? format_by_name(extension + 1) : FORMAT_CSV;
+    if (format == 0) {
+        print_error("Unknown format! Use csv or jsonl.");
+        return 1;
+    }
+    
+    int from_stdin = strcmp(argv[0], "-") == 0;
+    if (from_stdin && batch_line > 0) {
+        print_error("A batch cannot import from stdin.");
+        return 1;
+    }
+    FILE *file = from_stdin ? stdin : fopen(argv[0], "rb");
+    if (file == NULL) {
+        print_error("Cannot open the file to import!");
+        return 1;
+    }
+    
+    ImportStats stats;
+    int ok = import_expenses(file, from_stdin ? "stdin" : argv[0], format, IMPORT_REPORTED_ROWS, &stats);
+    if (!from_stdin) fclose(file);
+    
+    // One checkpoint makes the whole import durable; journaling every row
+    // would write each record twice
+    if (ok && stats.imported > 0 && !checkpoint_data()) ok = 0;
+    
+    printf("imported\t%lld\n", stats.imported);
+    printf("rejected\t%lld\n", stats.rejected);
+    return !ok || stats.rejected > 0;
+}
+
+// Streams expenses from a CSV or JSON-lines file into the store, giving each
+// one a new ID. A CSV file holds date, amount, category, description and
+// currency columns in that order, or in any order under a header row naming
+// them; a JSON-lines file holds one object per line with those members. Rows
+// are checked by the menu's rules; rows that fail are counted, the first
+// `max_reports` are reported by line number, and the rest of the file still
+// loads. Nothing is journaled, and the indexes are left to be rebuilt in one
+// pass by the next query. Each row is checked against the budgets as it is
+// added, and the first `max_reports` alerts are shown. Returns 0 (after
+// saying why) if the file could not be read or memory ran out, leaving the
+// rows added so far in the store.
+int import_expenses(FILE *file, const char *name, int format, int max_reports, ImportStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    LineReader reader;
+    memset(&reader, 0, sizeof(reader));
+    reader.file = file;
+    reader.buffer = malloc(IMPORT_BUFFER_SIZE + 1);
+    if (reader.buffer == NULL) {
+        print_error("Out of memory! Cannot import expenses.");
+        return 0;
+    }
+    
+    int columns[5] = {0, 1, 2, 3, 4};  // of the date, amount, category, description and currency
+    char *fields[IMPORT_MAX_FIELDS];
+    long long line_number = 0;
+    int ok = 1;
+    char *line;
+    int overlong;
+    
+    indexes_ready = 0;
+    budget_alerts = 0;
+    budget_alert_quota = max_reports;
+    while ((line = read_line(&reader, &overlong)) != NULL) {
+        line_number++;
+        if (line_number == 1 && strncmp(line, "\xEF\xBB\xBF", 3) == 0) line += 3;  // UTF-8 byte order mark
+        if (!overlong && line[strspn(line, " \t")] == '\0') continue;
+        
+        char *text[5] = {NULL, NULL, NULL, NULL, NULL};
+        const char *problem = NULL;
+        if (overlong) {
+            problem = "line too long";
+        } else if (format == FORMAT_JSON_LINES) {
+            problem = parse_json_expense(line, text);
+        } else {
+            int count = split_csv_line(line, fields, IMPORT_MAX_FIELDS);
+            if (count < 0) {
+                problem = "malformed quotes or too many fields";
+            } else if (stats->rows == 0 && stats->rejected == 0 && read_csv_header(fields, count, columns)) {
+                if (columns[0] < 0 || columns[1] < 0) {
+                    print_error("The CSV header has no date or no amount column!");
+                    ok = 0;
+                    break;
+                }
+                continue;
+            } else {
+                for (int k = 0; k < 5; k++) {
+                    text[k] = columns[k] >= 0 && columns[k] < count ? fields[columns[k]] : NULL;
+                }
+            }
+        }
+        
+        stats->rows++;
+        int failed = 0;
+        if (problem == NULL) problem = import_row(text, &failed);
+        if (failed) {
+            print_error(problem);
+            ok = 0;
+            break;
+        }
+        if (problem == NULL) {
+            stats->imported++;
+        } else if (stats->rejected++ < max_reports) {
+            char message[160];
+            snprintf(message, sizeof(message), "%.100s:%lld: %s", name, line_number, problem);
+            print_error(message);
+        }
+    }
+    
+    if (ok && ferror(file)) {
+        print_error("Could not read the file to import!");
+        ok = 0;
+    }
+    if (stats->rejected > max_reports && max_reports > 0) {
+        char message[80];
+        snprintf(message, sizeof(message), "%lld more rejected rows not shown.", stats->rejected - max_reports);
+        print_error(message);
+    }
+    if (budget_alerts > max_reports && max_reports > 0) {
+        char message[80];
+        snprintf(message, sizeof(message), "%lld more budget alerts not shown.", budget_alerts - max_reports);
+        print_warning(message);
+    }
+    budget_alert_quota = -1;
+    stats->bytes = reader.bytes;
+    free(reader.buffer);
+    return ok;
+}
+
+// Checks one imported row by the menu's rules and adds it with a new ID.
+// The currency comes from its column, or else from a code after the amount.
+// Returns NULL if it was added, otherwise what is wrong with it. Sets
+// `failed` if the store could not take it.
+const char *import_row(char *text[5], int *failed) {
+    Expense expense;
+    if (text[0] == NULL || text[0][0] == '\0') return "missing date";
+    if (!validate_date(text[0])) return "invalid date (expected YYYY-MM-DD)";
+    if (text[1] == NULL || text[1][0] == '\0') return "missing amount";
+    
+    if (!parse_amount(text[1], &expense.amount, expense.currency)) {
+        return "invalid amount (expected a positive number, at most two decimals)";
+    }
+    if (text[4] != NULL && text[4][0] != '\0' && !parse_currency(text[4], expense.currency)) {
+        return "invalid currency (expected a three-letter code)";
+    }
+    if (!currency_has_rates(expense.currency)) return "no exchange rate for the currency";
+    
+    memcpy(expense.date, text[0], sizeof(expense.date));
+    copy_truncated(expense.category, sizeof(expense.category), text[2]);
+    copy_truncated(expense.description, sizeof(expense.description), text[3]);
+    
+    expense.id = allocate_expense_id();
+    if (expense.id == 0) {
+        *failed = 1;
+        return "No expense IDs left! Cannot import more expenses.";
+    }
+    if (!append_expense(&expense)) {
+        *failed = 1;
+        return "Out of memory! Cannot import more expenses.";
+    }
+    check_budgets(&expense, NULL);
+    return NULL;
+}
+
+// Copies `text` (NULL for none) into a field of `size` bytes, cutting it
+// short as the menu's input does
+void copy_truncated(char *field, size_t size, const char *text) {
+    size_t length = text == NULL ? 0 : strlen(text);
+    if (length >= size) length = size - 1;
+    memcpy(field, text == NULL ? "" : text, length);
+    field[length] = '\0';
+}
+
+// Returns FORMAT_CSV or FORMAT_JSON_LINES for a format name or file
+// extension, or 0 if it names neither
+int format_by_name(const char *name) {
+    if (strcmp(name, "csv") == 0) return FORMAT_CSV;
+    if (strcmp(name, "jsonl") == 0 || strcmp(name, "json") == 0 || strcmp(name, "ndjson") == 0) {
+        return FORMAT_JSON_LINES;
+    }
+    return 0;
+}
+
+// Returns the next line of the file in place, without its line ending, or
+// NULL at the end. A line that does not fit in the buffer is skipped and
+// returned as what is left of it, with `overlong` set.
+char *read_line(LineReader *reader, int *overlong) {
+    while (1) {
+        char *line = reader->buffer + reader->start;
+        size_t available = reader->end - reader->start;
+        char *newline = memchr(line, '\n', available);
+        if (newline != NULL || (reader->eof && available > 0)) {
+            char *stop = newline != NULL ? newline : line + available;
+            reader->start = stop - reader->buffer + (newline != NULL);
+            if (stop > line && stop[-1] == '\r') stop--;
+            *stop = '\0';
+            *overlong = reader->overlong;
+            reader->overlong = 0;
+            return line;
+        }
+        if (reader->eof) return NULL;
+        
+        // Keep the partial line and fill the rest of the buffer
+        if (available == IMPORT_BUFFER_SIZE) {
+            reader->overlong = 1;
+            available = 0;
+        }
+        memmove(reader->buffer, line, available);
+        reader->start = 0;
+        reader->end = available;
+        size_t got = fread(reader->buffer + available, 1, IMPORT_BUFFER_SIZE - available, reader->file);
+        if (got == 0) reader->eof = 1;
+        reader->end += got;
+        reader->bytes += got;
+    }
+}
+
+// Splits a CSV line into fields in place, trimming blanks around them.
+// Quoted fields may hold commas and doubled quotes. Returns the number of
+// fields, or -1 for a malformed quoted field or more than `max_fields`.
+int split_csv_line(char *line, char *fields[], int max_fields) {
+    int count = 0;
+    char *p = line;
+    
+    while (1) {
+        if (count == max_fields) return -1;
+        while (*p == ' ' || *p == '\t') p++;
+        
+        char *out = p;
+        fields[count++] = out;
+        if (*p == '"') {
+            for (p++; *p != '"' || p[1] == '"'; ) {
+                if (*p == '\0') return -1;
+                if (*p == '"') p++;
+                *out++ = *p++;
+            }
+            p++;
+            while (*p == ' ' || *p == '\t') p++;
+            if (*p != ',' && *p != '\0') return -1;
+        } else {
+            while (*p != ',' && *p != '\0') p++;
+            out = p;
+            while (out > fields[count - 1] && (out[-1] == ' ' || out[-1] == '\t')) out--;
+        }
+        
+        // The terminator may land on the comma, so look at it first
+        int more = *p == ',';
+        *out = '\0';
+        if (!more) return count;
+        p++;
+    }
+}
+
+// Recognizes a CSV header row: one with a field named "date". Fills
+// `columns` with the positions of the date, amount, category, description
+// and currency columns (-1 where there is none). Returns 0 for a data row.
+int read_csv_header(char *fields[], int count, int columns[5]) {
+    static const char *names[5] = {"date", "amount", "category", "description", "currency"};
+    int found[5] = {-1, -1, -1, -1, -1};
+    
+    for (int f = 0; f < count; f++) {
+        for (int k = 0; k < 5; k++) {
+            if (found[k] < 0 && strcasecmp(fields[f], names[k]) == 0) found[k] = f;
+        }
+    }
+    if (found[0] < 0) return 0;
+    
+    memcpy(columns, found, sizeof(found));
+    return 1;
+}
+
+// Picks the expense members out of a JSON object on one line: "date",
+// "amount" (a number or a string), "category", "description" and
+// "currency". Other members are skipped. Strings are unescaped in place.
+// Returns NULL if the line is one well-formed object, otherwise what is
+// wrong with it.
+const char *parse_json_expense(char *line, char *text[5]) {
+    static const char *names[5] = {"date", "amount", "category", "description", "currency"};
+    char *p = line + strspn(line, " \t");
+    if (*p++ != '{') return "not a JSON object";
+    p += strspn(p, " \t");
+    
+    while (*p != '}') {
+        if (*p != '"') return "malformed JSON";
+        char *key = parse_json_string(&p);
+        if (key == NULL) return "malformed JSON string";
+        p += strspn(p, " \t");
+        if (*p++ != ':') return "malformed JSON";
+        p += strspn(p, " \t");
+        
+        int member = -1;
+        for (int k = 0; k < 5; k++) {
+            if (strcmp(key, names[k]) == 0) member = k;
+        }
+        if (*p == '"') {
+            char *value = parse_json_string(&p);
+            if (value == NULL) return "malformed JSON string";
+            if (member >= 0) text[member] = value;
+        } else if (*p == '{' || *p == '[') {
+            if (!skip_json_value(&p)) return "malformed JSON";
+        } else {
+            // A number or literal. There is always a ':' before it, so the
+            // amount slides left over that to make room for its terminator.
+            char *start = p;
+            p += strcspn(p, ",} \t");
+            if (p == start) return "malformed JSON";
+            if (member == 1) {
+                memmove(start - 1, start, p - start);
+                p[-1] = '\0';
+                text[1] = start - 1;
+            }
+        }
+        
+        p += strspn(p, " \t");
+        if (*p == ',') {
+            p++;
+            p += strspn(p, " \t");
+            if (*p == '}') return "malformed JSON";
+        } else if (*p != '}') {
+            return "malformed JSON";
+        }
+    }
+    p++;
+    if (p[strspn(p, " \t")] != '\0') return "text after the JSON object";
+    return NULL;
+}
+
+// Unescapes the JSON string that *cursor points at (its opening quote) in
+// place and moves the cursor past it. Returns the string, or NULL if it is
+// malformed.
+char *parse_json_string(char **cursor) {
+    char *start = *cursor + 1;
+    char *p = start;
+    char *out = start;
+    
+    while (*p != '"') {
+        if (*p == '\0') return NULL;
+        if (*p != '\\') {
+            *out++ = *p++;
+            continue;
+        }
+        p++;
+        switch (*p++) {
+            case '"': *out++ = '"'; break;
+            case '\\': *out++ = '\\'; break;
+            case '/': *out++ = '/'; break;
+            case 'b': *out++ = '\b'; break;
+            case 'f': *out++ = '\f'; break;
+            case 'n': *out++ = '\n'; break;
+            case 'r': *out++ = '\r'; break;
+            case 't': *out++ = '\t'; break;
+            case 'u': {
+                unsigned int code, low;
+                if (!parse_hex4(p, &code)) return NULL;
+                p += 4;
+                if (code >= 0xD800 && code < 0xDC00 && p[0] == '\\' && p[1] == 'u' &&
+                    parse_hex4(p + 2, &low) && low >= 0xDC00 && low < 0xE000) {
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                    p += 6;
+                } else if (code >= 0xD800 && code < 0xE000) {
+                    code = 0xFFFD;  // unpaired surrogate
+                }
+                out += put_utf8(code, out);
+                break;
+            }
+            default:
+                return NULL;
+        }
+    }
+    *out = '\0';
+    *cursor = p + 1;
+    return start;
+}
+
+// Moves *cursor past the JSON object or array it points at. Returns 0 if it
+// is not closed on this line.
+int skip_json_value(char **cursor) {
+    char *p = *cursor;
+    int depth = 0;
+    
+    do {
+        if (*p == '\0') return 0;
+        if (*p == '"') {
+            if (parse_json_string(&p) == NULL) return 0;
+            continue;
+        }
+        if (*p == '{' || *p == '[') depth++;
+        if (*p == '}' || *p == ']') depth--;
+        p++;
+    } while (depth > 0);
+    
+    *cursor = p;
+    return 1;
+}
+
+int parse_hex4(const char *text, unsigned int *code) {
+    *code = 0;
+    for (int k = 0; k < 4; k++) {
+        char c = text[k];
+        int digit = c >= '0' && c <= '9' ? c - '0' :
+                    c >= 'a' && c <= 'f' ? c - 'a' + 10 :
+                    c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+        if (digit < 0) return 0;
+        *code = *code << 4 | digit;
+    }
+    return 1;
+}
+
+// Writes a code point as UTF-8. Returns the number of bytes written.
+int put_utf8(unsigned int code, char *out) {
+    if (code < 0x80) {
+        out[0] = (char)code;
+        return 1;
+    }
+    if (code < 0x800) {
+        out[0] = (char)(0xC0 | code >> 6);
+        out[1] = (char)(0x80 | (code & 0x3F));
+        return 2;
+    }
+    if (code < 0x10000) {
+        out[0] = (char)(0xE0 | code >> 12);
+        out[1] = (char)(0x80 | (code >> 6 & 0x3F));
+        out[2] = (char)(0x80 | (code & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | code >> 18);
+    out[1] = (char)(0x80 | (code >> 12 & 0x3F));
+    out[2] = (char)(0x80 | (code >> 6 & 0x3F));
+    out[3] = (char)(0x80 | (code & 0x3F));
+    return 4;
+}
+
+// Export
+// export [--format csv|jsonl] [--output FILE] [--from D] [--to D]
+//        [--category C] [--search TEXT] [--sort K] [--order O] [--limit N] [--after ID]
+// Streams the expenses a query would select (all by default) to stdout or a
+// file, as CSV under a header row or as JSON lines. Either reads back with
+// import, which ignores the id.
+int command_export(int argc, char *argv[]) {
+    QueryFilter filter = {FIRST_INDEXED_DAY, LAST_INDEXED_DAY, 0, NULL, -1, NULL, NULL, {"", 0}};
+    ResultOrder order = {SORT_NONE, 0, 0, 0};
+    int format = FORMAT_CSV;
+    const char *path = NULL;
+    
+    for (int k = 0; k < argc; k += 2) {
+        const char *value = k + 1 < argc ? argv[k + 1] : NULL;
+        int parsed = value != NULL ? parse_query_option(&filter, argv[k], value) : 0;
+        if (parsed == 0 && value != NULL) parsed = parse_order_option(&order, argv[k], value);
+        if (parsed < 0) return 1;
+        if (parsed > 0) continue;
+        if (value != NULL && strcmp(argv[k], "--format") == 0 && format_by_name(value) != 0) {
+            format = format_by_name(value);
+        } else if (value != NULL && strcmp(argv[k], "--output") == 0) {
+            path = value;
+        } else {
+            print_error("Usage: export [--format csv|jsonl] [--output FILE] [query options]");
+            return 1;
+        }
+    }
+    
+    FILE *file = path != NULL ? fopen(path, "wb") : stdout;
+    if (file == NULL) {
+        print_error("Cannot create the export file!");
+        return 1;
+    }
+    
+    OutputBuffer out;
+    int ok = output_open(&out, file);
+    if (ok) {
+        if (format == FORMAT_CSV) output_text(&out, "id,date,amount,category,description,currency\n");
+        ok = select_expenses(&filter, &order, &out, format);
+        if (!output_close(&out)) {
+            print_error("Could not write the export!");
+            ok = 0;
+        }
+    }
+    if (path != NULL && fclose(file) != 0 && ok) {
+        print_error("Could not write the export!");
+        ok = 0;
+    }
+    return !ok;
+}
+
+// Starts buffering output for `file`. Returns 0 (after saying why) if
+// memory is exhausted.
+int output_open(OutputBuffer *out, FILE *file) {
+    out->file = file;
+    out->used = 0;
+    out->failed = 0;
+    out->data = malloc(EXPORT_BUFFER_SIZE);
+    if (out->data == NULL) {
+        print_error("Out of memory! Cannot write the output.");
+        return 0;
+    }
+    return 1;
+}
+
+// Writes out what is left and frees the buffer. Returns 0 if any write
+// failed.
+int output_close(OutputBuffer *out) {
+    output_flush(out);
+    if (fflush(out->file) != 0) out->failed = 1;
+    free(out->data);
+    out->data = NULL;
+    return !out->failed;
+}
+
+void output_flush(OutputBuffer *out) {
+    if (out->used > 0 && fwrite(out->data, 1, out->used, out->file) != out->used) {
+        out->failed = 1;
+    }
+    out->used = 0;
+}
+
+void output_text(OutputBuffer *out, const char *text) {
+    if (EXPORT_BUFFER_SIZE - out->used < EXPORT_RECORD_MAX) output_flush(out);
+    out->used = put_text(out->data + out->used, text) - out->data;
+}
+
+// Formats one record into the buffer: as id, date, amount, category,
+// description and currency code separated by tabs (FORMAT_TSV) or commas
+// with CSV quoting (FORMAT_CSV), or as a JSON object (FORMAT_JSON_LINES);
+// one per line
+void write_record(OutputBuffer *out, int format, const ExpenseChunk *chunk, int row) {
+    if (EXPORT_BUFFER_SIZE - out->used < EXPORT_RECORD_MAX) output_flush(out);
+    
+    char *p = out->data + out->used;
+    const char *category = category_names[chunk->categories[row]];
+    const char *description = description_text(chunk->descriptions[row]);
+    if (format == FORMAT_JSON_LINES) {
+        p = put_text(p, "{\"id\":");
+        p = put_integer(p, chunk->ids[row]);
+        p = put_text(p, ",\"date\":\"");
+        format_date(chunk->dates[row], p);
+        p = put_text(p + 10, "\",\"amount\":");
+        p = put_amount(p, chunk->amounts[row]);
+        p = put_text(p, ",\"currency\":\"");
+        p = put_text(p, currency_code(chunk->currencies[row]));
+        p = put_text(p, "\",\"category\":");
+        p = put_json_string(p, category);
+        p = put_text(p, ",\"description\":");
+        p = put_json_string(p, description);
+        p = put_text(p, "}\n");
+    } else {
+        char separator = format == FORMAT_CSV ? ',' : '\t';
+        p = put_integer(p, chunk->ids[row]);
+        *p++ = separator;
+        format_date(chunk->dates[row], p);
+        p += 10;
+        *p++ = separator;
+        p = put_amount(p, chunk->amounts[row]);
+        *p++ = separator;
+        p = format == FORMAT_CSV ? put_csv_field(p, category) : put_text(p, category);
+        *p++ = separator;
+        p = format == FORMAT_CSV ? put_csv_field(p, description) : put_text(p, description);
+        *p++ = separator;
+        p = put_text(p, currency_code(chunk->currencies[row]));
+        *p++ = '\n';
+    }
+    out->used = p - out->data;
+}
+
+// The put_ functions write at `p` without a terminator and return the end
+char *put_text(char *p, const char *text) {
+    size_t length = strlen(text);
+    memcpy(p, text, length);
+    return p + length;
+}
+
+char *put_integer(char *p, int value) {
+    char digits[12];
+    int n = 0;
+    unsigned int magnitude = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+    if (value < 0) *p++ = '-';
+    do {
+        digits[n++] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude > 0);
+    while (n > 0) *p++ = digits[--n];
+    return p;
+}
+
+// Writes an amount in paisa as taka with two decimals
+char *put_amount(char *p, Money amount) {
+    unsigned long long magnitude = amount < 0 ? 0ull - (unsigned long long)amount : (unsigned long long)amount;
+    if (amount < 0) *p++ = '-';
+    
+    char digits[24];
+    int n = 0;
+    do {
+        digits[n++] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude > 0 || n < 3);
+    while (n > 2) *p++ = digits[--n];
+    *p++ = '.';
+    *p++ = digits[1];
+    *p++ = digits[0];
+    return p;
+}
+
+// Quotes a field only when CSV needs it to: for commas, quotes, line breaks
+// and blanks at either end, which import would otherwise trim
+char *put_csv_field(char *p, const char *text) {
+    size_t length = strlen(text);
+    if (text[strcspn(text, ",\"\r\n")] == '\0' &&
+        (length == 0 || (text[0] != ' ' && text[0] != '\t' && text[length - 1] != ' ' && text[length - 1] != '\t'))) {
+        memcpy(p, text, length);
+        return p + length;
+    }
+    
+    *p++ = '"';
+    for (const char *c = text; *c != '\0'; c++) {
+        if (*c == '"') *p++ = '"';
+        *p++ = *c;
+    }
+    *p++ = '"';
+    return p;
+}
+
+char *put_json_string(char *p, const char *text) {
+    static const char hex[] = "0123456789abcdef";
+    *p++ = '"';
+    for (const unsigned char *c = (const unsigned char *)text; *c != '\0'; c++) {
+        if (*c >= 0x20 && *c != '"' && *c != '\\') {
+            *p++ = *c;
+            continue;
+        }
+        *p++ = '\\';
+        switch (*c) {
+            case '"': *p++ = '"'; break;
+            case '\\': *p++ = '\\'; break;
+            case '\n': *p++ = 'n'; break;
+            case '\r': *p++ = 'r'; break;
+            case '\t': *p++ = 't'; break;
+            default:
+                p = put_text(p, "u00");
+                *p++ = hex[*c >> 4];
+                *p++ = hex[*c & 15];
+        }
+    }
+    *p++ = '"';
+    return p;
+}
+
+// Server
+//
+// Usage: expense --serve. Serves the ledger in the current directory until
+// interrupted or terminated, then folds the journal into the data file as
+// the menu does on exit. Messages go to stderr.
+int run_server() {
+    batch_mode = 1;
+    #ifdef _WIN32
+    print_error("The server needs fork() and Unix domain sockets, which this system lacks.");
+    return 1;
+    #else
+    char path[512];
+    struct sockaddr_un address;
+    socket_file_path(path, sizeof(path));
+    if (!socket_address(path, &address)) {
+        print_error("The socket's path is too long!");
+        return 1;
+    }
+    int running = connect_server();
+    if (running >= 0) {
+        close(running);
+        print_error("A server is already running on this ledger!");
+        return 1;
+    }
+    
+    load_from_file();
+    warm_store();
+    
+    // A socket file left by a server that did not stop cleanly is replaced
+    unlink(path);
+    server_client_capacity = 16;
+    server_clients = malloc(server_client_capacity * sizeof(ServerClient));
+    server_polls = malloc((server_client_capacity + 2) * sizeof(struct pollfd));
+    server_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    server_null = open("/dev/null", O_RDWR);
+    int listening = server_clients != NULL && server_polls != NULL && server_socket >= 0 &&
+                    server_null >= 0 && pipe(server_wake) == 0 &&
+                    bind(server_socket, (struct sockaddr *)&address, sizeof(address)) == 0 &&
+                    listen(server_socket, SOMAXCONN) == 0;
+    if (!listening) print_error("Cannot listen on the socket!");
+    
+    // Children are reaped by the system, and a client that hangs up shows as
+    // a failed write rather than a signal
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &action, NULL);
+    sigaction(SIGCHLD, &action, NULL);
+    action.sa_handler = stop_server;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    
+    int failed = !listening;
+    if (listening) fprintf(stderr, "expense: serving %d expenses on %s\n", expense_count, path);
+    while (listening && !server_stopping) {
+        int count = server_client_count;
+        server_polls[0] = (struct pollfd){server_wake[0], POLLIN, 0};
+        server_polls[1] = (struct pollfd){server_socket, POLLIN, 0};
+        for (int k = 0; k < count; k++) {
+            server_polls[k + 2] = (struct pollfd){server_clients[k].socket, POLLIN, 0};
+        }
+        if (poll(server_polls, count + 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            print_error("Cannot wait for requests!");
+            failed = 1;
+            break;
+        }
+        
+        for (int k = 0; k < count; k++) {
+            if (server_polls[k + 2].revents == 0) continue;
+            int received = receive_request(&server_clients[k]);
+            if (received > 0) serve_request(&server_clients[k]);
+            if (received < 0) close_client(&server_clients[k]);
+        }
+        int kept = 0;
+        for (int k = 0; k < server_client_count; k++) {
+            if (server_clients[k].socket < 0) continue;
+            if (kept < k) server_clients[kept] = server_clients[k];
+            kept++;
+        }
+        server_client_count = kept;
+        if (server_polls[1].revents & POLLIN) accept_client();
+    }
+    
+    for (int k = 0; k < server_client_count; k++) close_client(&server_clients[k]);
+    free(server_clients);
+    free(server_polls);
+    if (listening) unlink(path);
+    if (server_socket >= 0) close(server_socket);
+    if (server_null >= 0) close(server_null);
+    for (int k = 0; k < 2; k++) {
+        if (server_wake[k] >= 0) close(server_wake[k]);
+    }
+    
+    if (!checkpoint_data()) failed = 1;
+    if (listening) fprintf(stderr, "expense: saved %d expenses and stopped\n", expense_count);
+    journal_close();
+    free_expenses();
+    return failed;
+    #endif
+}
+
+// Connects to the server listening next to the data file. Returns the
+// socket, or -1 if none is listening.
+int connect_server() {
+    #ifdef _WIN32
+    return -1;
+    #else
+    char path[512];
+    struct sockaddr_un address;
+    socket_file_path(path, sizeof(path));
+    if (!socket_address(path, &address)) return -1;
+    
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server < 0) return -1;
+    if (connect(server, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        close(server);
+        return -1;
+    }
+    return server;
+    #endif
+}
+
+// Sends a command to the server and waits for it to be done. What it prints
+// goes to `output`, its messages to stderr. An import from stdin sends a copy
+// of stdin in a temporary file, so that the server never waits on a terminal
+// or a slow pipe. Returns the command's exit status.
+int send_request(int server, int argc, char *argv[], int output) {
+    #ifdef _WIN32
+    (void)server;
+    (void)argc;
+    (void)argv;
+    (void)output;
+    return 1;
+    #else
+    char request[sizeof(RequestHeader) + SERVER_REQUEST_MAX];
+    RequestHeader header = {0, batch_line};
+    for (int k = 0; k < argc; k++) {
+        size_t length = strlen(argv[k]) + 1;
+        if (header.length + length > SERVER_REQUEST_MAX) {
+            print_error("The command is too long for the server!");
+            return 1;
+        }
+        memcpy(request + sizeof(header) + header.length, argv[k], length);
+        header.length += (int)length;
+    }
+    memcpy(request, &header, sizeof(header));
+    
+    int files[3] = {output, STDERR_FILENO, -1};
+    int file_count = 2;
+    FILE *input = NULL;
+    if (argc > 1 && strcmp(argv[0], "import") == 0 && strcmp(argv[1], "-") == 0 && batch_line == 0) {
+        char buffer[65536];
+        size_t got;
+        input = tmpfile();
+        while (input != NULL && (got = fread(buffer, 1, sizeof(buffer), stdin)) > 0) {
+            if (fwrite(buffer, 1, got, input) != got) {
+                fclose(input);
+                input = NULL;
+            }
+        }
+        if (input == NULL || fflush(input) != 0 || fseek(input, 0, SEEK_SET) != 0) {
+            print_error("Cannot copy stdin for the server!");
+            if (input != NULL) fclose(input);
+            return 1;
+        }
+        files[file_count++] = fileno(input);
+    }
+    
+    // The descriptors go with the first byte
+    char control[CMSG_SPACE(3 * sizeof(int))];
+    memset(control, 0, sizeof(control));
+    size_t length = sizeof(header) + header.length;
+    struct iovec part = {request, length};
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &part;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = CMSG_SPACE(file_count * sizeof(int));
+    struct cmsghdr *passed = CMSG_FIRSTHDR(&message);
+    passed->cmsg_level = SOL_SOCKET;
+    passed->cmsg_type = SCM_RIGHTS;
+    passed->cmsg_len = CMSG_LEN(file_count * sizeof(int));
+    memcpy(CMSG_DATA(passed), files, file_count * sizeof(int));
+    
+    fflush(stdout);
+    ssize_t sent = sendmsg(server, &message, 0);
+    size_t done = sent > 0 ? (size_t)sent : 0;
+    while (sent > 0 && done < length) {
+        sent = send(server, request + done, length - done, 0);
+        if (sent > 0) done += sent;
+    }
+    unsigned char status = 1;
+    int answered = done == length && recv(server, &status, 1, 0) == 1;
+    if (input != NULL) fclose(input);
+    if (!answered) {
+        print_error("Lost the connection to the server!");
+        return 1;
+    }
+    return status;
+    #endif
+}
+
+void socket_file_path(char *path, size_t size) {
+    snprintf(path, size, "%s%s", data_path, SOCKET_FILE_SUFFIX);
+}
+
+#ifndef _WIN32
+// Fills in the address of a socket file. Returns 0 if the path is too long
+// for one.
+int socket_address(const char *path, struct sockaddr_un *address) {
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address->sun_path)) return 0;
+    strcpy(address->sun_path, path);
+    return 1;
+}
+
+// Takes a new connection, if there is memory for it
+void accept_client() {
+    int connection = accept(server_socket, NULL, NULL);
+    if (connection < 0) return;
+    
+    if (server_client_count == server_client_capacity) {
+        int capacity = server_client_capacity * 2;
+        ServerClient *clients = realloc(server_clients, capacity * sizeof(ServerClient));
+        if (clients != NULL) server_clients = clients;
+        struct pollfd *polls = realloc(server_polls, (capacity + 2) * sizeof(struct pollfd));
+        if (polls != NULL) server_polls = polls;
+        if (clients == NULL || polls == NULL) {
+            close(connection);
+            return;
+        }
+        server_client_capacity = capacity;
+    }
+    char *request = malloc(sizeof(RequestHeader) + SERVER_REQUEST_MAX);
+    if (request == NULL) {
+        close(connection);
+        return;
+    }
+    server_clients[server_client_count++] = (ServerClient){connection, request, 0, {-1, -1, -1}, 0};
+}
+
+// Reads what has arrived of a client's request, keeping the descriptors
+// passed with it. Returns 1 once the whole request is in, 0 while more is
+// to come, and -1 if the client hung up or broke the protocol.
+int receive_request(ServerClient *client) {
+    RequestHeader header;
+    size_t wanted = sizeof(header);
+    if (client->received >= (int)sizeof(header)) {
+        memcpy(&header, client->request, sizeof(header));
+        wanted += header.length;
+    }
+    
+    char control[CMSG_SPACE(3 * sizeof(int))];
+    struct iovec part = {client->request + client->received, wanted - client->received};
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &part;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    ssize_t got = recvmsg(client->socket, &message, 0);
+    if (got < 0 && errno == EINTR) return 0;
+    if (got <= 0) return -1;
+    
+    for (struct cmsghdr *passed = CMSG_FIRSTHDR(&message); passed != NULL; passed = CMSG_NXTHDR(&message, passed)) {
+        if (passed->cmsg_level != SOL_SOCKET || passed->cmsg_type != SCM_RIGHTS) continue;
+        int count = (passed->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (int k = 0; k < count; k++) {
+            int file;
+            memcpy(&file, CMSG_DATA(passed) + k * sizeof(int), sizeof(int));
+            if (client->file_count < 3) {
+                client->files[client->file_count++] = file;
+            } else {
+                close(file);
+            }
+        }
+    }
+    if (message.msg_flags & MSG_CTRUNC) return -1;
+    
+    client->received += (int)got;
+    if (client->received < (int)sizeof(header)) return 0;
+    memcpy(&header, client->request, sizeof(header));
+    if (header.length <= 0 || header.length > SERVER_REQUEST_MAX) return -1;
+    return client->received == (int)sizeof(header) + header.length;
+}
+
+// Runs a request that has all arrived: a change here, between the others,
+// and anything else in a child reading a snapshot of the store as it
+// stands. Answers with the exit status, ready for the client's next request.
+void serve_request(ServerClient *client) {
+    RequestHeader header;
+    memcpy(&header, client->request, sizeof(header));
+    char *args[MAX_COMMAND_ARGS];
+    int argc = 0;
+    char *text = client->request + sizeof(header), *end = text + header.length;
+    if (end[-1] == '\0') {
+        while (text < end && argc < MAX_COMMAND_ARGS) {
+            args[argc++] = text;
+            text += strlen(text) + 1;
+        }
+    }
+    if (argc == 0 || text < end || client->file_count < 2) {
+        close_client(client);
+        return;
+    }
+    
+    int change = command_changes_store(argc, args);
+    pid_t child = -1;
+    if (!change) {
+        // Output still buffered here would be written again by the child
+        fflush(stdout);
+        fflush(stderr);
+        child = fork();
+    }
+    if (child == 0) {
+        reset_scan_pool();
+        close_other_clients(client);
+        unsigned char status = run_client_command(client, argc, args, header.line, 0);
+        // Not exit(): the journal's buffer is the server's to write
+        _exit(write(client->socket, &status, 1) == 1 ? 0 : 1);
+    }
+    
+    // A change, or a command the system would not fork for, runs here
+    if (child < 0) {
+        unsigned char status = run_client_command(client, argc, args, header.line, change);
+        send(client->socket, &status, 1, MSG_DONTWAIT);
+        if (change) warm_store();
+    }
+    for (int k = 0; k < client->file_count; k++) close(client->files[k]);
+    client->file_count = 0;
+    client->received = 0;
+}
+
+// Runs a command with the client's descriptors as its stdout and stderr
+// (and stdin, if passed), as a command-line run would, syncing a change to
+// the journal. Puts the server's own back afterwards. Returns the exit status.
+int run_client_command(ServerClient *client, int argc, char *argv[], int line, int change) {
+    int saved[3];
+    fflush(stdout);
+    fflush(stderr);
+    for (int k = 0; k < 3; k++) saved[k] = dup(k);
+    dup2(client->file_count == 3 ? client->files[2] : server_null, STDIN_FILENO);
+    dup2(client->files[0], STDOUT_FILENO);
+    dup2(client->files[1], STDERR_FILENO);
+    clearerr(stdin);
+    
+    batch_line = line;
+    int status = execute_command(argc, argv);
+    if (change && (journal_file == NULL || !journal_commit()) && !checkpoint_data()) {
+        status = 1;
+    }
+    batch_line = 0;
+    
+    // Drops what an import that stopped early left in stdin's buffer
+    if (client->file_count == 3) fseek(stdin, 0, SEEK_END);
+    fflush(stdout);
+    fflush(stderr);
+    for (int k = 0; k < 3; k++) {
+        dup2(saved[k], k);
+        close(saved[k]);
+    }
+    clearerr(stdin);
+    clearerr(stdout);
+    clearerr(stderr);
+    return status;
+}
+
+void close_client(ServerClient *client) {
+    for (int k = 0; k < client->file_count; k++) close(client->files[k]);
+    client->file_count = 0;
+    close(client->socket);
+    client->socket = -1;
+    free(client->request);
+    client->request = NULL;
+}
+
+// In a child serving one client: closes what belongs to the server and the
+// others, so that no client waits on a descriptor this child holds open
+void close_other_clients(const ServerClient *client) {
+    close(server_socket);
+    close(server_wake[0]);
+    close(server_wake[1]);
+    for (int k = 0; k < server_client_count; k++) {
+        ServerClient *other = &server_clients[k];
+        if (other == client || other->socket < 0) continue;
+        for (int f = 0; f < other->file_count; f++) close(other->files[f]);
+        close(other->socket);
+    }
+}
+
+// SIGINT and SIGTERM: stops the server once the request in hand is done
+void stop_server(int number) {
+    (void)number;
+    int saved = errno;
+    server_stopping = 1;
+    ssize_t written = write(server_wake[1], "", 1);
+    (void)written;
+    errno = saved;
+}
+#endif
+
+// Whether a command changes the store or the budgets, and so runs in the
+// server itself rather than in a child
+int command_changes_store(int argc, char *argv[]) {
+    const char *name = argv[0];
+    if (strcmp(name, "budget") == 0) {
+        return argc > 1 && (strcmp(argv[1], "set") == 0 || strcmp(argv[1], "clear") == 0);
+    }
+    return strcmp(name, "add") == 0 || strcmp(name, "modify") == 0 ||
+           strcmp(name, "delete") == 0 || strcmp(name, "import") == 0;
+}
+
+// Builds every index and summary a command may need, so that the children
+// forked for requests find them ready rather than each building its own.
+// Changes keep them current, except an import, which leaves them to be
+// rebuilt here. The month totals only serve an overall budget, so they wait
+// for `budget set` to make one.
+void warm_store() {
+    require_indexes();
+    require_aggregates();
+    if (overall_budget >= 0) require_month_totals();
+    require_text_index();
+    for (int category = -1; category < category_count; category++) {
+        require_day_tree(category);
+    }
+}
+
+// Benchmarks
+//
+// Usage: expense --bench <name> [rows], the name being one of layout,
+// date-range, delete, ids, journal, startup, import, export, stats, report,
+// search, scan, parallel, amounts, results, currency, server or suite
+int run_benchmark(int argc, char *argv[]) {
+    const char *name = argc > 0 ? argv[0] : "layout";
+    int rows = argc > 1 ? atoi(argv[1]) : 2000000;
+    
+    if (rows > 0 && strcmp(name, "layout") == 0) return bench_layout(rows);
+    if (rows > 0 && strcmp(name, "date-range") == 0) return bench_date_range(rows);
+    if (rows > 0 && strcmp(name, "delete") == 0) return bench_delete(rows);
+    if (rows > 0 && strcmp(name, "ids") == 0) return bench_ids(rows);
+    if (rows > 0 && strcmp(name, "journal") == 0) return bench_journal(rows);
+    if (rows > 0 && strcmp(name, "startup") == 0) return bench_startup(rows);
+    if (rows > 0 && strcmp(name, "import") == 0) return bench_import(rows);
+    if (rows > 0 && strcmp(name, "export") == 0) return bench_export(rows);
+    if (rows > 0 && strcmp(name, "stats") == 0) return bench_stats(rows);
+    if (rows > 0 && strcmp(name, "report") == 0) return bench_report(rows);
+    if (rows > 0 && strcmp(name, "search") == 0) return bench_search(rows);
+    if (rows > 0 && strcmp(name, "scan") == 0) return bench_scan(rows);
+    if (rows > 0 && strcmp(name, "parallel") == 0) return bench_parallel(rows);
+    if (rows > 0 && strcmp(name, "amounts") == 0) return bench_amounts(rows);
+    if (rows > 0 && strcmp(name, "results") == 0) return bench_results(rows);
+    if (rows > 0 && strcmp(name, "currency") == 0) return bench_currency(rows);
+    if (rows > 0 && strcmp(name, "server") == 0) return bench_server(rows);
+    if (rows > 0 && strcmp(name, "suite") == 0) return bench_suite(rows, argc > 2 ? argc - 2 : 0, argv + 2);
+    
+    fprintf(stderr, "Usage: expense --bench <layout|date-range|delete|ids|journal|startup|import|export|stats|report|search|scan|parallel|amounts|results|currency|server|suite> [rows]\n");
+    return 1;
+}
+
+// Builds the same synthetic ledger as a plain array of Expense records and in
+// the column store, then times the scans the menu views perform on each.
+int bench_layout(int rows) {
+    Expense *records = malloc((size_t)rows * sizeof(Expense));
+    if (records == NULL) {
+        fprintf(stderr, "Out of memory allocating %d records\n", rows);
+        return 1;
+    }
+    
+    unsigned int state = 12345;
+    for (int i = 0; i < rows; i++) {
+        generate_synthetic_expense(i + 1, &state, &records[i]);
+        if (!append_expense(&records[i])) {
+            fprintf(stderr, "Out of memory filling the column store\n");
+            free(records);
+            return 1;
+        }
+    }
+    
+    size_t column_bytes = (size_t)chunk_count * (sizeof(ExpenseChunk) + EXPENSE_CHUNK_SIZE * (4 * sizeof(int) + sizeof(Money) + 2)) +
+                          (size_t)(description_block_count - 1) * DESCRIPTION_BLOCK_SIZE +
+                          description_block_used;
+    printf("rows: %d\n", rows);
+    printf("row layout:    %zu bytes/record\n", sizeof(Expense));
+    printf("column layout: %.1f bytes/record (including description text)\n\n",
+           (double)column_bytes / rows);
+    printf("%-26s %12s %12s %9s\n", "operation", "rows (ms)", "columns (ms)", "speedup");
+    
+    const char *labels[] = {"total", "date range total (1 year)", "category total"};
+    const char *start_date = "2022-01-01", *end_date = "2022-12-31";
+    int start, end;
+    parse_date(start_date, &start);
+    parse_date(end_date, &end);
+    int target = intern_category("Groceries");
+    const int repeats = 5;
+    
+    for (int op = 0; op < 3; op++) {
+        double best_rows = 0, best_columns = 0;
+        Money sum_rows = 0, sum_columns = 0;
+        
+        for (int r = 0; r < repeats; r++) {
+            // Row layout, filtering the way the original views did
+            double t0 = now_seconds();
+            Money sum = 0;
+            for (int i = 0; i < rows; i++) {
+                if (op == 0 ||
+                    (op == 1 && strcmp(records[i].date, start_date) >= 0 && strcmp(records[i].date, end_date) <= 0) ||
+                    (op == 2 && strcasecmp(records[i].category, "Groceries") == 0)) {
+                    sum += records[i].amount;
+                }
+            }
+            double t1 = now_seconds();
+            sum_rows = sum;
+            
+            // Column layout
+            sum = 0;
+            for (int c = 0; c < chunk_count; c++) {
+                ExpenseChunk *chunk = expense_chunks[c];
+                int n = chunk_rows(c);
+                if (op == 0) {
+                    for (int j = 0; j < n; j++) sum += chunk->amounts[j];
+                } else if (op == 1) {
+                    for (int j = 0; j < n; j++) {
+                        if (chunk->dates[j] >= start && chunk->dates[j] <= end) sum += chunk->amounts[j];
+                    }
+                } else {
+                    for (int j = 0; j < n; j++) {
+                        if (chunk->categories[j] == target) sum += chunk->amounts[j];
+                    }
+                }
+            }
+            double t2 = now_seconds();
+            sum_columns = sum;
+            
+            if (r == 0 || t1 - t0 < best_rows) best_rows = t1 - t0;
+            if (r == 0 || t2 - t1 < best_columns) best_columns = t2 - t1;
+        }
+        
+        printf("%-26s %12.2f %12.2f %8.1fx%s\n", labels[op],
+               best_rows * 1000, best_columns * 1000, best_rows / best_columns,
+               sum_rows == sum_columns ? "" : "  (MISMATCH)");
+    }
+    
+    free(records);
+    free_expenses();
+    return 0;
+}
+
+// Times one-month range totals over a multi-year synthetic ledger, scanning
+// the date column against walking the date index and against the range
+// total trees, then makes random adds, modifies and deletes and checks the
+// trees against a scan for random ranges and categories.
+int bench_date_range(int rows) {
+    Expense expense;
+    unsigned int state = 12345;
+    double t0 = now_seconds();
+    for (int i = 0; i < rows; i++) {
+        generate_synthetic_expense(i + 1, &state, &expense);
+        if (!append_expense(&expense)) {
+            fprintf(stderr, "Out of memory filling the store\n");
+            return 1;
+        }
+    }
+    double t1 = now_seconds();
+    int errors = require_day_tree(-1) == NULL;
+    printf("rows: %d (loaded and indexed in %.0f ms, range total tree built in %.1f ms)\n\n",
+           rows, (t1 - t0) * 1000, (now_seconds() - t1) * 1000);
+    printf("%-10s %10s %12s %12s %9s %12s\n", "month", "matches", "scan (ms)", "index (ms)", "speedup", "tree (us)");
+    
+    for (int month = 1; month <= 12; month += 3) {
+        int start = days_from_civil(2022, month, 1);
+        int end = days_from_civil(2022, month + 1, 1) - 1;
+        Money scan_total = 0, index_total = 0, tree_total = 0;
+        int matches = 0, tree_matches = 0;
+        
+        double t1 = now_seconds();
+        for (int c = 0; c < chunk_count; c++) {
+            ExpenseChunk *chunk = expense_chunks[c];
+            int n = chunk_rows(c);
+            for (int j = 0; j < n; j++) {
+                if (chunk->dates[j] >= start && chunk->dates[j] <= end) scan_total += chunk->amounts[j];
+            }
+        }
+        double t2 = now_seconds();
+        for (int day = start; day <= end; day++) {
+            SlotList *list = date_index_list(day, 0);
+            if (list == NULL) continue;
+            slot_list_sort(list);
+            for (int k = 0; k < list->count; k++) {
+                index_total += chunk_of(list->slots[k])->amounts[list->slots[k] % EXPENSE_CHUNK_SIZE];
+            }
+            matches += list->count;
+        }
+        double t3 = now_seconds();
+        if (errors == 0) day_range_total(&day_trees[0], start, end, &tree_total, &tree_matches);
+        double t4 = now_seconds();
+        
+        char label[11];
+        format_date(start, label);
+        label[7] = 0;
+        int agree = scan_total == index_total && scan_total == tree_total && tree_matches == matches;
+        printf("%-10s %10d %12.3f %12.3f %8.1fx %12.3f%s\n", label, matches,
+               (t2 - t1) * 1000, (t3 - t2) * 1000, (t2 - t1) / (t3 - t2), (t4 - t3) * 1e6,
+               agree ? "" : "  (MISMATCH)");
+        errors += !agree;
+    }
+    
+    const int operations = rows < 100000 ? rows : 100000;
+    int checks = 0;
+    for (int i = 0; i < operations && expense_count > 1 && errors == 0; i++) {
+        int op = synthetic_random(&state) % 3;
+        int slot = synthetic_random(&state) % slot_count;
+        while (!slot_is_live(slot)) slot = synthetic_random(&state) % slot_count;
+        if (op == 0) {
+            generate_synthetic_expense(allocate_expense_id(), &state, &expense);
+            append_expense(&expense);
+        } else if (op == 1) {
+            read_expense(slot, &expense);
+            generate_synthetic_expense(expense.id, &state, &expense);
+            write_expense(slot, &expense);
+        } else {
+            remove_expense_at(slot);
+        }
+        if (i % (operations / 20 + 1) != 0) continue;
+        
+        // A random range, for every category and for a random one
+        int start = days_from_civil(2019, 1, 1) + synthetic_random(&state) % 2200;
+        int end = start + synthetic_random(&state) % 1000;
+        int category = synthetic_random(&state) % category_count;
+        Money scan_totals[2] = {0, 0};
+        int scan_counts[2] = {0, 0};
+        for (int c = 0; c < chunk_count; c++) {
+            ExpenseChunk *chunk = expense_chunks[c];
+            int n = chunk_rows(c);
+            for (int j = 0; j < n; j++) {
+                if (chunk->deleted[j] || chunk->dates[j] < start || chunk->dates[j] > end) continue;
+                scan_totals[0] += chunk->amounts[j];
+                scan_counts[0]++;
+                if (chunk->categories[j] != category) continue;
+                scan_totals[1] += chunk->amounts[j];
+                scan_counts[1]++;
+            }
+        }
+        for (int t = 0; t < 2; t++) {
+            DayTree *tree = require_day_tree(t == 0 ? -1 : category);
+            Money total;
+            int count;
+            if (tree == NULL) {
+                errors++;
+                break;
+            }
+            day_range_total(tree, start, end, &total, &count);
+            errors += count != scan_counts[t] || total != scan_totals[t];
+        }
+        checks++;
+    }
+    printf("\nrandom changes: %d, range totals checked against a scan: %d, errors: %d\n", operations, checks * 2, errors);
+    
+    free_expenses();
+    return errors != 0;
+}
+
+// Deletes three quarters of a synthetic ledger in random id order, timing the id
+// lookups and tombstone deletes (compactions included), then checks that
+// every surviving id still finds its own record and no deleted id is found.
+int bench_delete(int rows) {
+    int *ids = malloc((size_t)rows * sizeof(int));
+    if (ids == NULL) {
+        fprintf(stderr, "Out of memory allocating %d ids\n", rows);
+        return 1;
+    }
+    
+    Expense expense;
+    unsigned int state = 12345;
+    for (int i = 0; i < rows; i++) {
+        ids[i] = i + 1;
+        generate_synthetic_expense(i + 1, &state, &expense);
+        if (!append_expense(&expense)) {
+            fprintf(stderr, "Out of memory filling the store\n");
+            free(ids);
+            return 1;
+        }
+    }
+    for (int i = rows - 1; i > 0; i--) {
+        int k = synthetic_random(&state) % (i + 1);
+        int id = ids[i];
+        ids[i] = ids[k];
+        ids[k] = id;
+    }
+    
+    int deletes = rows - rows / 4;
+    double t0 = now_seconds();
+    for (int i = 0; i < deletes; i++) {
+        int slot = find_expense_by_id(ids[i]);
+        if (slot >= 0) remove_expense_at(slot);
+    }
+    double t1 = now_seconds();
+    
+    int errors = 0;
+    for (int i = 0; i < rows; i++) {
+        int slot = find_expense_by_id(ids[i]);
+        if (i < deletes) {
+            if (slot >= 0) errors++;
+        } else if (slot < 0 || !slot_is_live(slot) || chunk_of(slot)->ids[slot % EXPENSE_CHUNK_SIZE] != ids[i]) {
+            errors++;
+        }
+    }
+    double t2 = now_seconds();
+    
+    printf("rows: %d\n", rows);
+    printf("deleted %d in %.1f ms (%.0f ns each, compactions included)\n",
+           deletes, (t1 - t0) * 1000, (t1 - t0) * 1e9 / deletes);
+    printf("looked up %d in %.1f ms (%.0f ns each)\n",
+           rows, (t2 - t1) * 1000, (t2 - t1) * 1e9 / rows);
+    printf("live: %d, slots: %d, lookup errors: %d\n", expense_count, slot_count, errors);
+    
+    int failed = errors != 0 || expense_count != rows - deletes;
+    free(ids);
+    free_expenses();
+    return failed;
+}
+
+// Stress test for the id allocator: interleaves random adds and deletes,
+// then checks that ids were handed out in increasing order, that every live
+// id is unique and finds its own record, and that a save and reload keeps
+// the ids and never hands one out again.
+int bench_ids(int operations) {
+    int *live_ids = malloc((size_t)operations * sizeof(int));
+    if (live_ids == NULL) {
+        fprintf(stderr, "Out of memory allocating %d ids\n", operations);
+        return 1;
+    }
+    
+    Expense expense;
+    unsigned int state = 12345;
+    int live = 0, adds = 0, deletes = 0, errors = 0;
+    int highest = 0;
+    double t0 = now_seconds();
+    for (int i = 0; i < operations; i++) {
+        if (live == 0 || synthetic_random(&state) % 3 != 0) {
+            int id = allocate_expense_id();
+            if (id <= highest) errors++;
+            highest = id;
+            generate_synthetic_expense(id, &state, &expense);
+            if (!append_expense(&expense)) {
+                fprintf(stderr, "Out of memory filling the store\n");
+                free(live_ids);
+                return 1;
+            }
+            live_ids[live++] = id;
+            adds++;
+        } else {
+            int k = synthetic_random(&state) % live;
+            int slot = find_expense_by_id(live_ids[k]);
+            if (slot < 0) {
+                errors++;
+            } else {
+                remove_expense_at(slot);
+            }
+            live_ids[k] = live_ids[--live];
+            deletes++;
+        }
+    }
+    double t1 = now_seconds();
+    
+    // Every live slot must be the one its id maps to, which rules out two
+    // live records sharing an id
+    for (int pass = 0; pass < 2; pass++) {
+        int seen = 0;
+        for (int slot = 0; slot < slot_count; slot++) {
+            if (!slot_is_live(slot)) continue;
+            if (find_expense_by_id(chunk_of(slot)->ids[slot % EXPENSE_CHUNK_SIZE]) != slot) errors++;
+            seen++;
+        }
+        for (int k = 0; k < live; k++) {
+            if (find_expense_by_id(live_ids[k]) < 0) errors++;
+        }
+        if (seen != live || expense_count != live) errors++;
+        if (pass == 1) break;
+        
+        // Reload from a scratch file and check again
+        int next_id = next_expense_id;
+        data_path = "expense-bench.dat";
+        journal_path = "expense-bench.log";
+        save_to_file();
+        free_expenses();
+        load_from_file();
+        journal_close();
+        remove(data_path);
+        remove(journal_path);
+        remove_rollup_file();
+        data_path = FILENAME;
+        journal_path = JOURNAL_FILENAME;
+        if (next_expense_id != next_id) errors++;
+    }
+    int after_reload = allocate_expense_id();
+    if (after_reload <= highest) errors++;
+    
+    printf("operations: %d (%d adds, %d deletes) in %.0f ms\n", operations, adds, deletes, (t1 - t0) * 1000);
+    printf("live: %d, highest id: %d, next id after reload: %d\n", live, highest, after_reload);
+    printf("errors: %d\n", errors);
+    
+    free(live_ids);
+    free_expenses();
+    return errors != 0;
+}
+
+// Compares the cost of saving one change by rewriting the data file with
+// committing it to the journal, then drops the store without a checkpoint,
+// as a crash would, and checks that loading replays every change.
+int bench_journal(int rows) {
+    data_path = "expense-bench.dat";
+    journal_path = "expense-bench.log";
+    
+    Expense expense;
+    unsigned int state = 12345;
+    for (int i = 0; i < rows; i++) {
+        generate_synthetic_expense(allocate_expense_id(), &state, &expense);
+        if (!append_expense(&expense)) {
+            fprintf(stderr, "Out of memory filling the store\n");
+            return 1;
+        }
+    }
+    
+    double t0 = now_seconds();
+    int saved = checkpoint_data();
+    double t1 = now_seconds();
+    
+    // One change per commit, as the menu makes them, then one batch
+    const int changes = 200;
+    double t2 = 0, t3 = 0;
+    for (int batch = 0; batch < 2; batch++) {
+        double start = now_seconds();
+        for (int i = 0; i < changes; i++) {
+            int slot = find_expense_by_id(synthetic_random(&state) % (next_expense_id - 1) + 1);
+            int op = synthetic_random(&state) % 3;
+            if (op == 0 || slot < 0) {
+                generate_synthetic_expense(allocate_expense_id(), &state, &expense);
+                append_expense(&expense);
+                journal_record(JOURNAL_ADD, &expense);
+            } else if (op == 1) {
+                read_expense(slot, &expense);
+                expense.amount += 1;
+                write_expense(slot, &expense);
+                journal_record(JOURNAL_MODIFY, &expense);
+            } else {
+                read_expense(slot, &expense);
+                remove_expense_at(slot);
+                journal_record(JOURNAL_DELETE, &expense);
+            }
+            if (batch == 0) journal_commit();
+        }
+        journal_commit();
+        if (batch == 0) t2 = now_seconds() - start;
+        else t3 = now_seconds() - start;
+    }
+    
+    // Fingerprint the store, drop it without saving and load it back
+    Money total = 0;
+    for (int slot = 0; slot < slot_count; slot++) {
+        if (slot_is_live(slot)) total += chunk_of(slot)->amounts[slot % EXPENSE_CHUNK_SIZE] * (slot % 7 + 1);
+    }
+    int live = expense_count, next_id = next_expense_id;
+    journal_close();
+    free_expenses();
+    load_from_file();
+    Money reloaded_total = 0;
+    for (int slot = 0; slot < slot_count; slot++) {
+        if (slot_is_live(slot)) reloaded_total += chunk_of(slot)->amounts[slot % EXPENSE_CHUNK_SIZE] * (slot % 7 + 1);
+    }
+    int recovered = saved && expense_count == live && next_expense_id == next_id && reloaded_total == total;
+    
+    printf("rows: %d\n", rows);
+    char label[40];
+    snprintf(label, sizeof(label), "journal, %d changes per sync", changes);
+    printf("%-30s %10.3f ms\n", "full save", (t1 - t0) * 1000);
+    printf("%-30s %10.3f ms per change\n", "journal, 1 change per sync", t2 * 1000 / changes);
+    printf("%-30s %10.3f ms per change\n", label, t3 * 1000 / changes);
+    printf("crash recovery: %s\n", recovered ? "ok" : "FAILED");
+    
+    journal_close();
+    free_expenses();
+    remove(data_path);
+    remove(journal_path);
+    remove_rollup_file();
+    data_path = FILENAME;
+    journal_path = JOURNAL_FILENAME;
+    return !recovered;
+}
+
+// Writes a synthetic ledger in the original record format and as a column
+// data file, then times loading each one (for the column file, mapping and
+// checking it) and the first queries after loading, which is where a mapped
+// store pays for the indexes it skipped.
+int bench_startup(int rows) {
+    const char *paths[2] = {"expense-bench-records.dat", "expense-bench-columns.dat"};
+    
+    Expense expense;
+    unsigned int state = 12345;
+    for (int i = 0; i < rows; i++) {
+        generate_synthetic_expense(allocate_expense_id(), &state, &expense);
+        if (!append_expense(&expense)) {
+            fprintf(stderr, "Out of memory filling the store\n");
+            return 1;
+        }
+    }
+    long long sizes[2] = {0, 0};
+    for (int format = 0; format < 2; format++) {
+        FILE *file = fopen(paths[format], "wb");
+        int written = file != NULL && (format == 0 ? write_legacy_file(file, 0) : write_data_file(file, 0));
+        if (file != NULL) {
+            fseek(file, 0, SEEK_END);
+            sizes[format] = ftell(file);
+            fclose(file);
+        }
+        if (!written) {
+            fprintf(stderr, "Could not write %s\n", paths[format]);
+            free_expenses();
+            remove(paths[0]);
+            remove(paths[1]);
+            return 1;
+        }
+    }
+    free_expenses();
+    
+    printf("rows: %d\n\n", rows);
+    printf("%-8s %10s %12s %14s %14s %14s\n", "format", "size (MB)", "load (ms)", "total (ms)", "by id (ms)", "by date (ms)");
+    
+    Money totals[2] = {0, 0};
+    int failed = 0;
+    for (int format = 0; format < 2; format++) {
+        data_path = paths[format];
+        double t0 = now_seconds();
+        int loaded = read_data_file();
+        double t1 = now_seconds();
+        
+        // First full scan, first lookup by id, then a one-month range
+        for (int c = 0; c < chunk_count; c++) {
+            ExpenseChunk *chunk = expense_chunks[c];
+            int n = chunk_rows(c);
+            for (int j = 0; j < n; j++) totals[format] += chunk->amounts[j];
+        }
+        double t2 = now_seconds();
+        int slot = find_expense_by_id(rows / 2 + 1);
+        double t3 = now_seconds();
+        int start = days_from_civil(2022, 3, 1), end = days_from_civil(2022, 3, 31);
+        int matches = 0;
+        for (int day = start; day <= end; day++) {
+            SlotList *list = date_index_list(day, 0);
+            if (list != NULL) matches += list->count;
+        }
+        double t4 = now_seconds();
+        
+        failed |= !loaded || expense_count != rows || slot < 0 || matches == 0;
+        printf("%-8s %10.1f %12.3f %14.3f %14.3f %14.3f\n", format == 0 ? "records" : "columns",
+               sizes[format] / 1e6, (t1 - t0) * 1000, (t2 - t1) * 1000, (t3 - t2) * 1000, (t4 - t3) * 1000);
+        free_expenses();
+    }
+    
+    failed |= totals[0] != totals[1];
+    if (failed) printf("(MISMATCH)\n");
+    data_path = FILENAME;
+    remove(paths[0]);
+    remove(paths[1]);
+    return failed;
+}
+
+// Writes a synthetic bank export as CSV and as JSON lines, one row in a
+// hundred malformed, then times streaming each into an empty store and the
+// checkpoint that makes an import durable
+int bench_import(int rows) {
+    const char *paths[2] = {"expense-bench.csv", "expense-bench.jsonl"};
+    data_path = "expense-bench.dat";
+    journal_path = "expense-bench.log";
+    
+    int malformed = 0;
+    for (int format = 0; format < 2; format++) {
+        FILE *file = fopen(paths[format], "wb");
+        if (file == NULL) {
+            fprintf(stderr, "Could not write %s\n", paths[format]);
+            return 1;
+        }
+        if (format == 0) fprintf(file, "Date,Description,Amount,Category,Reference\n");
+        
+        Expense expense;
+        char amount[MONEY_TEXT_SIZE];
+        unsigned int state = 12345;
+        malformed = 0;
+        for (int i = 0; i < rows; i++) {
+            generate_synthetic_expense(i + 1, &state, &expense);
+            if (i % 100 == 99) {
+                // Alternately a bad date, a bad amount and a broken line
+                malformed++;
+                if (i % 300 == 99) expense.date[5] = '1', expense.date[6] = '3';
+                else if (i % 300 == 199) expense.amount = -expense.amount;
+                else expense.category[0] = '"';
+            }
+            if (format == 0) {
+                fprintf(file, "%s,\"%s, card\",%s,%s,TX%08d\n",
+                        expense.date, expense.description, format_money(expense.amount, amount), expense.category, i);
+            } else {
+                fprintf(file, "{\"date\": \"%s\", \"amount\": %s, \"category\": \"%s\", \"description\": \"%s\", \"tags\": [\"card\"]}\n",
+                        expense.date, format_money(expense.amount, amount), expense.category, expense.description);
+            }
+        }
+        fclose(file);
+    }
+    
+    printf("rows: %d (%d malformed)\n\n", rows, malformed);
+    printf("%-12s %10s %12s %14s %10s\n", "format", "size (MB)", "import (ms)", "rows/s", "MB/s");
+    
+    int failed = 0;
+    double save_time = 0;
+    for (int format = 0; format < 2; format++) {
+        FILE *file = fopen(paths[format], "rb");
+        ImportStats stats;
+        double t0 = now_seconds();
+        int ok = file != NULL && import_expenses(file, paths[format], format == 0 ? FORMAT_CSV : FORMAT_JSON_LINES, 0, &stats);
+        double t1 = now_seconds();
+        if (file != NULL) fclose(file);
+        
+        failed |= !ok || stats.imported != rows - malformed || stats.rejected != malformed || expense_count != stats.imported;
+        printf("%-12s %10.1f %12.1f %14.0f %10.1f\n", format == 0 ? "csv" : "json lines", stats.bytes / 1e6,
+               (t1 - t0) * 1000, stats.rows / (t1 - t0), stats.bytes / 1e6 / (t1 - t0));
+        
+        if (format == 0) {
+            double t2 = now_seconds();
+            failed |= !checkpoint_data();
+            save_time = now_seconds() - t2;
+        }
+        journal_close();
+        free_expenses();
+    }
+    printf("\ndurable commit (one checkpoint): %.1f ms\n", save_time * 1000);
+    if (failed) printf("(MISMATCH)\n");
+    
+    remove(paths[0]);
+    remove(paths[1]);
+    remove(data_path);
+    remove(journal_path);
+    remove_rollup_file();
+    data_path = FILENAME;
+    journal_path = JOURNAL_FILENAME;
+    return failed;
+}
+
+// Exports a synthetic store as CSV and as JSON lines, once with an fprintf
+// per record for comparison and then through the buffered writer, and
+// imports the CSV export into an empty store to check it matches
+int bench_export(int rows) {
+    const char *paths[2] = {"expense-bench-export.csv", "expense-bench-export.jsonl"};
+    
+    Expense expense;
+    unsigned int state = 12345;
+    for (int i = 0; i < rows; i++) {
+        generate_synthetic_expense(allocate_expense_id(), &state, &expense);
+        if (i % 10 == 0) strcat(expense.description, ", \"special\"");
+        if (!append_expense(&expense)) {
+            fprintf(stderr, "Out of memory filling the store\n");
+            return 1;
+        }
+    }
+    unsigned int fingerprint = store_fingerprint();
+    int live = expense_count;
+    
+    printf("rows: %d\n\n", rows);
+    printf("%-12s %-10s %10s %12s %10s\n", "format", "writer", "size (MB)", "export (ms)", "MB/s");
+    
+    int failed = 0;
+    for (int format = 0; format < 2; format++) {
+        for (int buffered = 0; buffered < 2; buffered++) {
+            FILE *file = fopen(paths[format], "wb");
+            if (file == NULL) {
+                fprintf(stderr, "Could not write %s\n", paths[format]);
+                free_expenses();
+                return 1;
+            }
+            
+            double t0 = now_seconds();
+            if (buffered) {
+                QueryFilter filter = {FIRST_INDEXED_DAY, LAST_INDEXED_DAY, 0, NULL, -1, NULL, NULL, {"", 0}};
+                OutputBuffer out;
+                failed |= !output_open(&out, file);
+                if (format == 0) output_text(&out, "id,date,amount,category,description\n");
+                failed |= !select_expenses(&filter, NULL, &out, format == 0 ? FORMAT_CSV : FORMAT_JSON_LINES);
+                failed |= !output_close(&out);
+            } else {
+                // Unescaped, so only a measure of formatting cost
+                if (format == 0) fprintf(file, "id,date,amount,category,description\n");
+                char date[11], amount[MONEY_TEXT_SIZE];
+                for (int slot = 0; slot < slot_count; slot++) {
+                    ExpenseChunk *chunk = chunk_of(slot);
+                    int row = slot % EXPENSE_CHUNK_SIZE;
+                    format_date(chunk->dates[row], date);
+                    fprintf(file, format == 0 ? "%d,%s,%s,%s,\"%s\"\n" :
+                            "{\"id\":%d,\"date\":\"%s\",\"amount\":%s,\"category\":\"%s\",\"description\":\"%s\"}\n",
+                            chunk->ids[row], date, format_money(chunk->amounts[row], amount), category_names[chunk->categories[row]],
+                            description_text(chunk->descriptions[row]));
+                }
+            }
+            long size = ftell(file);
+            failed |= fclose(file) != 0;
+            double t1 = now_seconds();
+            
+            printf("%-12s %-10s %10.1f %12.1f %10.1f\n", format == 0 ? "csv" : "json lines",
+                   buffered ? "buffered" : "fprintf", size / 1e6, (t1 - t0) * 1000, size / 1e6 / (t1 - t0));
+        }
+    }
+    
+    // Read the buffered CSV export back
+    free_expenses();
+    FILE *file = fopen(paths[0], "rb");
+    ImportStats stats;
+    int ok = file != NULL && import_expenses(file, paths[0], FORMAT_CSV, 0, &stats);
+    if (file != NULL) fclose(file);
+    int matches = ok && stats.rejected == 0 && expense_count == live && store_fingerprint() == fingerprint;
+    printf("\nround trip through import: %s\n", matches ? "ok" : "MISMATCH");
+    
+    free_expenses();
+    remove(paths[0]);
+    remove(paths[1]);
+    return failed || !matches;
+}
+
+// CRC-32 of every live record's fields, in slot order
+unsigned int store_fingerprint() {
+    unsigned int crc = 0;
+    for (int slot = 0; slot < slot_count; slot++) {
+        if (!slot_is_live(slot)) continue;
+        ExpenseChunk *chunk = chunk_of(slot);
+        int row = slot % EXPENSE_CHUNK_SIZE;
+        const char *category = category_names[chunk->categories[row]];
+        const char *description = description_text(chunk->descriptions[row]);
+        crc = crc32(crc, &chunk->dates[row], sizeof(chunk->dates[row]));
+        crc = crc32(crc, &chunk->amounts[row], sizeof(chunk->amounts[row]));
+        crc = crc32(crc, &chunk->currencies[row], 1);
+        crc = crc32(crc, category, strlen(category));
+        crc = crc32(crc, description, strlen(description));
+    }
+    return crc;
+}
+
+// Times the statistics worked out by scanning the store against reading
+// them from the aggregates, then makes random adds, modifies and deletes,
+// many of them aimed at the current highest and lowest expense, and checks
+// the aggregates against a scan as it goes
+int bench_stats(int rows) {
+    Expense expense;
+    unsigned int state = 12345;
+    for (int i = 0; i < rows; i++) {
+        generate_synthetic_expense(allocate_expense_id(), &state, &expense);
+        if (!append_expense(&expense)) {
+            fprintf(stderr, "Out of memory filling the store\n");
+            return 1;
+        }
+    }
+    
+    double t0 = now_seconds();
+    int errors = check_aggregates(1);
+    double t1 = now_seconds();
+    errors += !require_aggregates();
+    double t2 = now_seconds();
+    const int reads = 1000;
+    volatile Money sink = 0;  // keeps the reads from being optimized away
+    for (int r = 0; r < reads; r++) {
+        sink += amount_total + chunk_of(heap_top(&highest_amounts))->ids[0] + chunk_of(heap_top(&lowest_amounts))->ids[0];
+        for (int k = 0; k < category_count; k++) sink += category_totals[k].total;
+    }
+    double t3 = now_seconds();
+    
+    const int operations = rows < 100000 ? rows : 100000;
+    int checks = 0;
+    double t4 = now_seconds();
+    for (int i = 0; i < operations && expense_count > 1; i++) {
+        int op = synthetic_random(&state) % 6;
+        int slot = op < 2 ? heap_top(op == 0 ? &highest_amounts : &lowest_amounts) : -1;
+        while (slot < 0 || !slot_is_live(slot)) slot = synthetic_random(&state) % slot_count;
+        
+        if (op == 2) {
+            generate_synthetic_expense(allocate_expense_id(), &state, &expense);
+            append_expense(&expense);
+        } else if (op == 3 || (op < 2 && i % 2 == 0)) {
+            read_expense(slot, &expense);
+            generate_synthetic_expense(expense.id, &state, &expense);
+            write_expense(slot, &expense);
+        } else {
+            remove_expense_at(slot);
+        }
+        if (i % (operations / 20 + 1) == 0) {
+            errors += check_aggregates(0);
+            checks++;
+        }
+    }
+    double t5 = now_seconds();
+    errors += check_aggregates(0);
+    
+    printf("rows: %d, categories: %d\n", rows, category_count);
+    printf("%-36s %12.3f ms\n", "statistics by scanning", (t1 - t0) * 1000);
+    printf("%-36s %12.3f ms\n", "first use (building aggregates)", (t2 - t1) * 1000);
+    printf("%-36s %12.3f us\n", "after that, per dashboard", (t3 - t2) * 1e6 / reads);
+    printf("%-36s %12.3f ms (%d checks)\n", "changes with aggregates kept", (t5 - t4) * 1000, checks);
+    printf("errors: %d\n", errors);
+    
+    free_expenses();
+    return errors != 0;
+}
+
+// Works the statistics out by scanning the store, as the dashboard used
+// to, and counts how many disagree with the aggregates. With `scan_only`
+// just the scan is done.
+int check_aggregates(int scan_only) {
+    Money total = 0;
+    Money *totals = calloc(category_count + 1, sizeof(Money));
+    int *counts = calloc(category_count + 1, sizeof(int));
+    int highest = -1, lowest = -1;
+    if (totals == NULL || counts == NULL) {
+        free(totals);
+        free(counts);
+        return 1;
+    }
+    
+    for (int c = 0; c < chunk_count; c++) {
+        ExpenseChunk *chunk = expense_chunks[c];
+        int rows = chunk_rows(c);
+        for (int j = 0; j < rows; j++) {
+            if (chunk->deleted[j]) continue;
+            int slot = c * EXPENSE_CHUNK_SIZE + j;
+            Money amount = base_amount(chunk, j);
+            total += amount;
+            totals[chunk->categories[j]] += amount;
+            counts[chunk->categories[j]]++;
+            if (highest < 0 || amount > slot_base_amount(highest)) highest = slot;
+            if (lowest < 0 || amount < slot_base_amount(lowest)) lowest = slot;
+        }
+    }
+    
+    int errors = 0;
+    if (!scan_only) {
+        errors += total != amount_total;
+        for (int k = 0; k < category_count; k++) {
+            errors += counts[k] != category_totals[k].count;
+            errors += totals[k] != category_totals[k].total;
+        }
+        errors += heap_top(&highest_amounts) != highest || heap_top(&lowest_amounts) != lowest;
+    }
+    free(totals);
+    free(counts);
+    return errors;
+}
+
+// Times a report worked out by scanning the store against one read from the
+// rollups, including loading them with the data file, then makes random
+// adds, modifies and deletes and checks the rollups against a scan as it
+// goes and after saving and loading again
+int bench_report(int rows) {
+    data_path = "expense-bench.dat";
+    journal_path = "expense-bench.log";
+    Expense expense;
+    unsigned int state = 12345;
+    for (int i = 0; i < rows; i++) {
+        generate_synthetic_expense(allocate_expense_id(), &state, &expense);
+        if (!append_expense(&expense)) {
+            fprintf(stderr, "Out of memory filling the store\n");
+            return 1;
+        }
+    }
+    
+    double t0 = now_seconds();
+    int errors = !rebuild_rollups();
+    double t1 = now_seconds();
+    errors += !checkpoint_data();
+    journal_close();
+    free_expenses();
+    load_from_file();
+    double t2 = now_seconds();
+    errors += !load_rollups();
+    double t3 = now_seconds();
+    
+    // Five years by month, then by year, for every category
+    int from = 2020 * 12, to = 2024 * 12 + 11;
+    const int reports = 1000;
+    int lines[2] = {0, 0};
+    double times[2];
+    for (int by_year = 0; by_year < 2; by_year++) {
+        double start = now_seconds();
+        for (int r = 0; r < reports; r++) {
+            ReportRow *report;
+            lines[by_year] = collect_report(from, to, by_year, -1, 0, &report);
+            if (lines[by_year] >= 0) free(report);
+        }
+        times[by_year] = now_seconds() - start;
+        errors += lines[by_year] <= 0;
+    }
+    
+    const int operations = rows < 100000 ? rows : 100000;
+    int checks = 0;
+    double t4 = now_seconds();
+    for (int i = 0; i < operations && expense_count > 1; i++) {
+        int op = synthetic_random(&state) % 3;
+        int slot = synthetic_random(&state) % slot_count;
+        while (!slot_is_live(slot)) slot = synthetic_random(&state) % slot_count;
+        
+        if (op == 0) {
+            generate_synthetic_expense(allocate_expense_id(), &state, &expense);
+            append_expense(&expense);
+            journal_record(JOURNAL_ADD, &expense);
+        } else if (op == 1) {
+            read_expense(slot, &expense);
+            generate_synthetic_expense(expense.id, &state, &expense);
+            write_expense(slot, &expense);
+            journal_record(JOURNAL_MODIFY, &expense);
+        } else {
+            read_expense(slot, &expense);
+            remove_expense_at(slot);
+            journal_record(JOURNAL_DELETE, &expense);
+        }
+        if (i % (operations / 20 + 1) == 0) {
+            errors += check_rollups();
+            checks++;
+        }
+    }
+    double t5 = now_seconds();
+    journal_commit();
+    
+    // Load again with the changes only in the journal, then after a checkpoint
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 1) errors += !checkpoint_data();
+        journal_close();
+        free_expenses();
+        load_from_file();
+        errors += !rollups_ready || check_rollups();
+    }
+    
+    printf("rows: %d, categories: %d, cells: %d\n", rows, category_count, rollup_table_used);
+    printf("%-38s %12.3f ms\n", "totals by month from a scan", (t1 - t0) * 1000);
+    printf("%-38s %12.3f ms\n", "loading the saved rollups", (t3 - t2) * 1000);
+    printf("%-38s %12.3f us (%d lines)\n", "5 years by month, from rollups", times[0] * 1e6 / reports, lines[0]);
+    printf("%-38s %12.3f us (%d lines)\n", "5 years by year, from rollups", times[1] * 1e6 / reports, lines[1]);
+    printf("%-38s %12.3f ms (%d checks)\n", "changes with rollups kept", (t5 - t4) * 1000, checks);
+    printf("errors: %d\n", errors);
+    
+    journal_close();
+    free_expenses();
+    remove(data_path);
+    remove(journal_path);
+    remove_rollup_file();
+    data_path = FILENAME;
+    journal_path = JOURNAL_FILENAME;
+    return errors != 0;
+}
+
+// Totals the store by month from a scan, as a report without rollups
+// would, and counts the cells that disagree with the rollups kept
+int check_rollups() {
+    RollupCell *kept = rollup_table;
+    int kept_size = rollup_table_size, kept_used = rollup_table_used;
+    if (!rollups_ready) return 1;
+    rollup_table = NULL;
+    rollup_table_size = 0;
+    rollup_table_used = 0;
+    
+    int errors = !rebuild_rollups();
+    int scanned = 0, compared = 0;
+    for (int b = 0; b < rollup_table_size; b++) {
+        if (rollup_table[b].category >= 0 && rollup_table[b].count > 0) scanned++;
+    }
+    for (int b = 0; errors == 0 && b < kept_size; b++) {
+        if (kept[b].category < 0 || kept[b].count == 0) continue;
+        RollupCell *cell = rollup_cell(kept[b].month, kept[b].category, kept[b].currency);
+        if (cell == NULL) {
+            errors++;
+            break;
+        }
+        errors += cell->count != kept[b].count;
+        errors += cell->total != kept[b].total;
+        compared++;
+    }
+    errors += compared != scanned;
+    
+    free(rollup_table);
+    rollup_table = kept;
+    rollup_table_size = kept_size;
+    rollup_table_used = kept_used;
+    rollups_ready = 1;
+    return errors;
+}
+
+// Times searches through the text index against scanning every record, the
+// way the search used to with strstr() and word by word as the index
+// matches, then makes random adds, modifies and deletes and checks the
+// index against the word scan as it goes
+int bench_search(int rows) {
+    Expense expense;
+    unsigned int state = 12345;
+    for (int i = 0; i < rows; i++) {
+        generate_synthetic_expense(allocate_expense_id(), &state, &expense);
+        if (!append_expense(&expense)) {
+            fprintf(stderr, "Out of memory filling the store\n");
+            return 1;
+        }
+    }
+    
+    double t0 = now_seconds();
+    int errors = !require_text_index();
+    printf("rows: %d, words: %d (indexed in %.0f ms)\n\n", rows, index_term_count, (now_seconds() - t0) * 1000);
+    printf("%-28s %9s %12s %12s %12s %9s\n", "search", "matches", "strstr (ms)", "words (ms)", "index (ms)", "speedup");
+    
+    const char *searches[] = {"coffee", "Coffee", "weekly shopping", "taxi OR bus", "ph*", "dinner with friends",
+                              "hotel flight OR concert tickets", "gym OR movie OR lunch"};
+    for (int s = 0; s < (int)(sizeof(searches) / sizeof(searches[0])) && errors == 0; s++) {
+        SearchQuery query;
+        parse_search(searches[s], &query);
+        
+        double t1 = now_seconds();
+        volatile int strstr_matches = 0;
+        for (int c = 0; c < chunk_count; c++) {
+            ExpenseChunk *chunk = expense_chunks[c];
+            int n = chunk_rows(c);
+            for (int j = 0; j < n; j++) {
+                if (!chunk->deleted[j] && strstr(description_text(chunk->descriptions[j]), searches[s]) != NULL) {
+                    strstr_matches++;
+                }
+            }
+        }
+        double t2 = now_seconds();
+        int scan_matches = 0;
+        for (int c = 0; c < chunk_count; c++) {
+            ExpenseChunk *chunk = expense_chunks[c];
+            int n = chunk_rows(c);
+            for (int j = 0; j < n; j++) {
+                if (!chunk->deleted[j] && record_matches_search(&query, chunk, j)) scan_matches++;
+            }
+        }
+        double t3 = now_seconds();
+        int *slots;
+        int matches = search_slots(&query, &slots);
+        double t4 = now_seconds();
+        free(slots);
+        
+        errors += matches != scan_matches;
+        printf("%-28s %9d %12.3f %12.3f %12.3f %8.1fx%s\n", searches[s], matches, (t2 - t1) * 1000,
+               (t3 - t2) * 1000, (t4 - t3) * 1000, (t2 - t1) / (t4 - t3), matches == scan_matches ? "" : "  (MISMATCH)");
+    }
+    
+    const int operations = rows < 100000 ? rows : 100000;
+    int checks = 0;
+    for (int i = 0; i < operations && expense_count > 1 && errors == 0; i++) {
+        int op = synthetic_random(&state) % 3;
+        int slot = synthetic_random(&state) % slot_count;
+        while (!slot_is_live(slot)) slot = synthetic_random(&state) % slot_count;
+        if (op == 0) {
+            generate_synthetic_expense(allocate_expense_id(), &state, &expense);
+            append_expense(&expense);
+        } else if (op == 1) {
+            read_expense(slot, &expense);
+            generate_synthetic_expense(expense.id, &state, &expense);
+            write_expense(slot, &expense);
+        } else {
+            remove_expense_at(slot);
+        }
+        if (i % (operations / 20 + 1) != 0) continue;
+        
+        // Every search again, in slot order, against the word scan
+        for (int s = 0; s < (int)(sizeof(searches) / sizeof(searches[0])); s++) {
+            SearchQuery query;
+            int *slots;
+            parse_search(searches[s], &query);
+            int matches = search_slots(&query, &slots);
+            int k = 0;
+            for (int scan = 0; scan < slot_count && matches >= 0; scan++) {
+                ExpenseChunk *chunk = chunk_of(scan);
+                int row = scan % EXPENSE_CHUNK_SIZE;
+                if (chunk->deleted[row] || !record_matches_search(&query, chunk, row)) continue;
+                errors += k >= matches || slots[k] != scan;
+                k++;
+            }
+            errors += matches < 0 || k != matches;
+            free(slots);
+        }
+        checks++;
+    }
+    printf("\nrandom changes: %d, searches checked against a scan: %d, errors: %d\n",
+           operations, checks * (int)(sizeof(searches) / sizeof(searches[0])), errors);
+    
+    free_expenses();
+    return errors != 0;
+}
 
-void get_current_date(char *buffer) {
-    time_t t = time(NULL);
-    struct tm *tm_info = localtime(&t);
-    strftime(buffer, 11, "%Y-%m-%d", tm_info);
+// Times substring searches, ignoring case, over the description arena with
+// each kernel the processor supports, against strstr() on every record's
+// description as the search used to. Some records are described anew first,
+// so the arena also holds stale text. Every kernel's records are checked
+// against a record-by-record search.
+int bench_scan(int rows) {
+    Expense expense;
+    unsigned int state = 12345;
+    for (int i = 0; i < rows; i++) {
+        generate_synthetic_expense(allocate_expense_id(), &state, &expense);
+        if (!append_expense(&expense)) {
+            fprintf(stderr, "Out of memory filling the store\n");
+            return 1;
+        }
+    }
+    for (int i = 0; i < rows / 10; i++) {
+        int slot = synthetic_random(&state) % slot_count;
+        read_expense(slot, &expense);
+        generate_synthetic_expense(expense.id, &state, &expense);
+        write_expense(slot, &expense);
+    }
+    
+    size_t arena_bytes = 0;
+    for (int b = 0; b < description_block_count; b++) arena_bytes += description_block_extent(b);
+    choose_text_kernel();
+    printf("rows: %d, arena: %.1f MB, kernel picked: %s\n\n", rows, arena_bytes / 1e6, text_kernel_name);
+    
+    const char *kernel_names[] = {"scalar", "sse2", "avx2"};
+    const char *(*kernels[])(const char *, size_t, const FoldedNeedle *) = {
+        find_folded_scalar,
+        #ifdef TEXT_SCAN_X86
+        __builtin_cpu_supports("sse2") ? find_folded_sse2 : NULL,
+        __builtin_cpu_supports("avx2") ? find_folded_avx2 : NULL,
+        #else
+        NULL, NULL,
+        #endif
+    };
+    const char *needles[] = {"coffee", "COFFEE", "ner wi", "ticket", "zzqx", "e"};
+    int *slots = malloc(TEXT_SCAN_BATCH * sizeof(int));
+    int *expected = malloc((size_t)slot_count * sizeof(int));
+    if (slots == NULL || expected == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    
+    int errors = 0;
+    printf("%-8s %-8s %9s %12s %12s %10s\n", "needle", "kernel", "records", "arena (ms)", "records (ms)", "GB/s");
+    for (int n = 0; n < (int)(sizeof(needles) / sizeof(needles[0])); n++) {
+        // What the search used to cost, and the records a scan should find
+        double t0 = now_seconds();
+        volatile int strstr_matches = 0;
+        for (int slot = 0; slot < slot_count; slot++) {
+            ExpenseChunk *chunk = chunk_of(slot);
+            int row = slot % EXPENSE_CHUNK_SIZE;
+            if (!chunk->deleted[row] && strstr(description_text(chunk->descriptions[row]), needles[n]) != NULL) {
+                strstr_matches++;
+            }
+        }
+        double t1 = now_seconds();
+        printf("%-8s %-8s %9d %12.3f %12s %10.2f\n", needles[n], "strstr", strstr_matches, (t1 - t0) * 1000, "-",
+               arena_bytes / (t1 - t0) / 1e9);
+        
+        FoldedNeedle needle;
+        fold_needle(needles[n], &needle);
+        find_folded = find_folded_scalar;
+        int expected_count = 0;
+        for (int slot = 0; slot < slot_count; slot++) {
+            ExpenseChunk *chunk = chunk_of(slot);
+            int row = slot % EXPENSE_CHUNK_SIZE;
+            if (!chunk->deleted[row] && (text_contains(description_text(chunk->descriptions[row]), &needle) ||
+                                         text_contains(category_names[chunk->categories[row]], &needle))) {
+                expected[expected_count++] = slot;
+            }
+        }
+        
+        for (int k = 0; k < 3; k++) {
+            if (kernels[k] == NULL) continue;
+            find_folded = kernels[k];
+            TextScan scan;
+            double t2 = now_seconds();
+            if (!begin_text_scan(&scan, needles[n])) return 1;
+            double t3 = now_seconds();
+            int count, found = 0;
+            while ((count = next_text_matches(&scan, slots, TEXT_SCAN_BATCH)) > 0) {
+                for (int s = 0; s < count; s++) {
+                    errors += found + s >= expected_count || slots[s] != expected[found + s];
+                }
+                found += count;
+            }
+            double t4 = now_seconds();
+            end_text_scan(&scan);
+            errors += found != expected_count;
+            printf("%-8s %-8s %9d %12.3f %12.3f %10.2f\n", "", kernel_names[k], found, (t3 - t2) * 1000,
+                   (t4 - t3) * 1000, arena_bytes / (t3 - t2) / 1e9);
+        }
+    }
+    printf("\nerrors: %d\n", errors);
+    
+    free(slots);
+    free(expected);
+    free_expenses();
+    return errors != 0;
 }
 
-void clear_input_buffer() {
-    int c;
-    while ((c = getchar()) != '\n' && c != EOF);
+// Times the parallel scans on one thread, then on twice as many each step
+// up to the processors online (at least two, so the pool is used): totals
+// of the whole store, totals of a substring search and a rebuild of the
+// statistics aggregates. The one-thread totals are checked against the
+// statistics scan, and every other run against the one-thread run, heaps
+// entry by entry.
+int bench_parallel(int rows) {
+    Expense expense;
+    unsigned int state = 12345;
+    for (int i = 0; i < rows; i++) {
+        generate_synthetic_expense(allocate_expense_id(), &state, &expense);
+        if (!append_expense(&expense)) {
+            fprintf(stderr, "Out of memory filling the store\n");
+            return 1;
+        }
+    }
+    for (int i = 0; i < rows / 10; i++) {
+        remove_expense_at(synthetic_random(&state) % slot_count);
+    }
+    
+    int processors = scan_thread_count();
+    printf("rows: %d, processors: %d\n\n", expense_count, processors);
+    printf("%-8s %12s %9s %12s %9s %16s %9s\n", "threads", "total (ms)", "speedup", "search (ms)", "speedup",
+           "aggregates (ms)", "speedup");
+    
+    QueryFilter all = {FIRST_INDEXED_DAY, LAST_INDEXED_DAY, 0, NULL, -1, NULL, NULL, {"", 0}};
+    QueryFilter search = all;
+    search.search = "coffee";
+    size_t category_bytes = ((size_t)category_count + 1) * sizeof(CategoryTotal);
+    ScanTotals expected[2], got[2];
+    HeapEntry *heaps[2] = {NULL, NULL};
+    int heap_count = 0, errors = 0;
+    for (int k = 0; k < 2; k++) {
+        expected[k].categories = calloc(category_count + 1, sizeof(CategoryTotal));
+        got[k].categories = calloc(category_count + 1, sizeof(CategoryTotal));
+        if (expected[k].categories == NULL || got[k].categories == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            return 1;
+        }
+    }
+    
+    double base[3] = {0, 0, 0};
+    for (int threads = 1; threads <= processors || threads <= 2; threads *= 2) {
+        scan_threads = threads;
+        double best[3] = {0, 0, 0};
+        for (int r = 0; r < 3; r++) {
+            double t0 = now_seconds();
+            errors += !scan_totals(&all, &got[0]);
+            double t1 = now_seconds();
+            errors += !scan_totals(&search, &got[1]);
+            double t2 = now_seconds();
+            aggregates_ready = 0;
+            errors += !require_aggregates();
+            double t3 = now_seconds();
+            double times[3] = {t1 - t0, t2 - t1, t3 - t2};
+            for (int k = 0; k < 3; k++) {
+                if (r == 0 || times[k] < best[k]) best[k] = times[k];
+            }
+        }
+        
+        if (threads == 1) {
+            // The reference run, itself checked against the statistics scan
+            errors += check_aggregates(0);
+            errors += got[0].count != expense_count || got[0].total != amount_total ||
+                      got[0].highest != heap_top(&highest_amounts) || got[0].lowest != heap_top(&lowest_amounts);
+            heap_count = highest_amounts.count;
+            for (int h = 0; h < 2; h++) {
+                AmountHeap *heap = h == 0 ? &highest_amounts : &lowest_amounts;
+                heaps[h] = malloc(((size_t)heap_count + 1) * sizeof(HeapEntry));
+                if (heaps[h] == NULL) {
+                    fprintf(stderr, "Out of memory\n");
+                    return 1;
+                }
+                memcpy(heaps[h], heap->entries, heap_count * sizeof(HeapEntry));
+            }
+            for (int k = 0; k < 2; k++) {
+                CategoryTotal *categories = expected[k].categories;
+                expected[k] = got[k];
+                expected[k].categories = categories;
+                memcpy(categories, got[k].categories, category_bytes);
+            }
+            memcpy(base, best, sizeof(base));
+        }
+        // Field by field, as the structs' padding is not part of the results
+        for (int k = 0; k < 2; k++) {
+            int differs = got[k].count != expected[k].count || got[k].total != expected[k].total ||
+                          got[k].highest != expected[k].highest || got[k].lowest != expected[k].lowest;
+            for (int c = 0; c <= category_count && !differs; c++) {
+                differs = got[k].categories[c].total != expected[k].categories[c].total ||
+                          got[k].categories[c].count != expected[k].categories[c].count;
+            }
+            errors += differs;
+        }
+        int heaps_differ = highest_amounts.count != heap_count || lowest_amounts.count != heap_count;
+        for (int e = 0; e < heap_count && !heaps_differ; e++) {
+            heaps_differ = highest_amounts.entries[e].amount != heaps[0][e].amount ||
+                           highest_amounts.entries[e].slot != heaps[0][e].slot ||
+                           lowest_amounts.entries[e].amount != heaps[1][e].amount ||
+                           lowest_amounts.entries[e].slot != heaps[1][e].slot;
+        }
+        errors += heaps_differ;
+        printf("%-8d %12.3f %8.2fx %12.3f %8.2fx %16.3f %8.2fx\n", threads,
+               best[0] * 1000, base[0] / best[0], best[1] * 1000, base[1] / best[1], best[2] * 1000, base[2] / best[2]);
+    }
+    printf("\nsearch matches: %d, errors: %d\n", expected[1].count, errors);
+    
+    for (int k = 0; k < 2; k++) {
+        free(expected[k].categories);
+        free(got[k].categories);
+        free(heaps[k]);
+    }
+    scan_threads = processors;
+    free_expenses();
+    return errors != 0;
 }
 
-void clear_screen() {
+// Times the count, total and extremes of the store under four filters (none,
+// a year, a category, both) on one thread: testing each record as the
+// filtered totals used to, then with the scalar and the AVX2 amount kernels,
+// and checks that all of them agree
+int bench_amounts(int rows) {
+    Expense expense;
+    unsigned int state = 12345;
+    for (int i = 0; i < rows; i++) {
+        generate_synthetic_expense(allocate_expense_id(), &state, &expense);
+        if (!append_expense(&expense)) {
+            fprintf(stderr, "Out of memory filling the store\n");
+            return 1;
+        }
+    }
+    for (int i = 0; i < rows / 10; i++) {
+        remove_expense_at(synthetic_random(&state) % slot_count);
+    }
+    
+    choose_amount_kernel();
+    printf("rows: %d, kernel picked: %s\n\n", expense_count, amount_kernel_name);
+    
+    int year_from, year_to;
+    parse_date("2022-01-01", &year_from);
+    parse_date("2022-12-31", &year_to);
+    int groceries = find_category("Groceries");
+    const char *filter_names[] = {"all", "year", "category", "both"};
+    AmountFilter filters[] = {
+        {FIRST_INDEXED_DAY, LAST_INDEXED_DAY, -1},
+        {year_from, year_to, -1},
+        {FIRST_INDEXED_DAY, LAST_INDEXED_DAY, groceries},
+        {year_from, year_to, groceries},
+    };
+    const char *kernel_names[] = {"scalar", "avx2"};
+    void (*kernels[])(const ExpenseChunk *, int, const AmountFilter *, AmountSummary *) = {
+        summarize_amounts_scalar,
+        #ifdef TEXT_SCAN_X86
+        __builtin_cpu_supports("avx2") ? summarize_amounts_avx2 : NULL,
+        #else
+        NULL,
+        #endif
+    };
+    
+    int errors = 0;
+    printf("%-9s %-8s %9s %12s %9s\n", "filter", "method", "records", "time (ms)", "speedup");
+    for (int f = 0; f < 4; f++) {
+        // Each record tested on its own, with its extremes looked up by slot
+        QueryFilter query = {filters[f].from, filters[f].to, 0, NULL, filters[f].category, NULL, NULL, {"", 0}};
+        AmountSummary expected = {0, 0, 0, 0, -1, -1};
+        double base = 0;
+        for (int r = 0; r < 3; r++) {
+            double t0 = now_seconds();
+            AmountSummary summary = {0, 0, 0, 0, -1, -1};
+            for (int slot = 0; slot < slot_count; slot++) {
+                ExpenseChunk *chunk = chunk_of(slot);
+                int row = slot % EXPENSE_CHUNK_SIZE;
+                if (query_matches(&query, chunk, row)) add_amount(&summary, chunk->amounts[row], slot);
+            }
+            double t1 = now_seconds();
+            if (r == 0 || t1 - t0 < base) base = t1 - t0;
+            expected = summary;
+        }
+        printf("%-9s %-8s %9d %12.3f %8.2fx\n", filter_names[f], "records", expected.count, base * 1000, 1.0);
+        
+        for (int k = 0; k < 2; k++) {
+            if (kernels[k] == NULL) continue;
+            AmountSummary got;
+            double best = 0;
+            for (int r = 0; r < 3; r++) {
+                double t0 = now_seconds();
+                summarize_store(kernels[k], &filters[f], &got);
+                double t1 = now_seconds();
+                if (r == 0 || t1 - t0 < best) best = t1 - t0;
+            }
+            errors += got.count != expected.count || got.total != expected.total ||
+                      got.highest != expected.highest || got.lowest != expected.lowest ||
+                      got.highest_row != expected.highest_row || got.lowest_row != expected.lowest_row;
+            printf("%-9s %-8s %9d %12.3f %8.2fx\n", "", kernel_names[k], got.count, best * 1000, base / best);
+        }
+    }
+    printf("\nerrors: %d\n", errors);
+    
+    free_expenses();
+    return errors != 0;
+}
+
+// Runs an amount kernel over every chunk and merges the parts, with the
+// extremes as slots
+void summarize_store(void (*kernel)(const ExpenseChunk *, int, const AmountFilter *, AmountSummary *),
+                     const AmountFilter *filter, AmountSummary *summary) {
+    *summary = (AmountSummary){0, 0, 0, 0, -1, -1};
+    for (int c = 0; c < chunk_count; c++) {
+        AmountSummary part;
+        kernel(expense_chunks[c], chunk_rows(c), filter, &part);
+        if (part.count == 0) continue;
+        summary->count += part.count;
+        summary->total += part.total;
+        if (summary->highest_row < 0 || part.highest > summary->highest) {
+            summary->highest = part.highest;
+            summary->highest_row = c * EXPENSE_CHUNK_SIZE + part.highest_row;
+        }
+        if (summary->lowest_row < 0 || part.lowest < summary->lowest) {
+            summary->lowest = part.lowest;
+            summary->lowest_row = c * EXPENSE_CHUNK_SIZE + part.lowest_row;
+        }
+    }
+}
+
+// Times ordered queries against sorting every match and taking a slice, as
+// a sorted view would without a result engine: the 10 largest expenses of
+// a year, and a 50 row page by date and by amount from a cursor halfway
+// through the store. Each is written to a temporary file and checked
+// against the slice written the same way.
+int bench_results(int rows) {
+    Expense expense;
+    unsigned int state = 12345;
+    for (int i = 0; i < rows; i++) {
+        generate_synthetic_expense(allocate_expense_id(), &state, &expense);
+        if (!append_expense(&expense)) {
+            fprintf(stderr, "Out of memory filling the store\n");
+            return 1;
+        }
+    }
+    for (int i = 0; i < rows / 10; i++) {
+        remove_expense_at(synthetic_random(&state) % slot_count);
+    }
+    if (!require_indexes()) return 1;
+    
+    QueryFilter all = {FIRST_INDEXED_DAY, LAST_INDEXED_DAY, 0, NULL, -1, NULL, NULL, {"", 0}};
+    QueryFilter year = all;
+    parse_date("2022-01-01", &year.from);
+    parse_date("2022-12-31", &year.to);
+    year.by_date = 1;
+    const char *names[] = {"top 10 amounts in 2022", "page of 50 by date", "page of 50 by amount"};
+    const QueryFilter *filters[] = {&year, &all, &all};
+    ResultOrder orders[] = {{SORT_AMOUNT, 1, 10, 0}, {SORT_DATE, 0, 50, 0}, {SORT_AMOUNT, 0, 50, 0}};
+    ResultRow *sorted = malloc(((size_t)expense_count + 1) * sizeof(ResultRow));
+    FILE *files[2] = {tmpfile(), tmpfile()};
+    if (sorted == NULL || files[0] == NULL || files[1] == NULL) {
+        fprintf(stderr, "Out of memory or no temporary files\n");
+        return 1;
+    }
+    
+    int errors = 0;
+    printf("rows: %d\n\n", expense_count);
+    printf("%-24s %14s %14s %9s\n", "query", "sort all (ms)", "engine (ms)", "speedup");
+    for (int q = 0; q < 3; q++) {
+        // The cursor for a page is the row halfway through the sorted store
+        ResultSet set = {filters[q], &orders[q], NULL, 0, {0, 0}, NULL, 0, 0, 0};
+        int count = 0;
+        for (int slot = 0; slot < slot_count; slot++) {
+            if (slot_is_live(slot)) sorted[count++] = result_row(&set, slot);
+        }
+        qsort(sorted, count, sizeof(ResultRow), compare_result_rows);
+        orders[q].after = q > 0 ? chunk_of(sorted[count / 2].slot)->ids[sorted[count / 2].slot % EXPENSE_CHUNK_SIZE] : 0;
+        
+        double best[2] = {0, 0};
+        for (int r = 0; r < 3; r++) {
+            OutputBuffer out;
+            rewind(files[0]);
+            double t0 = now_seconds();
+            count = 0;
+            for (int slot = 0; slot < slot_count; slot++) {
+                ExpenseChunk *chunk = chunk_of(slot);
+                if (query_matches(filters[q], chunk, slot % EXPENSE_CHUNK_SIZE)) sorted[count++] = result_row(&set, slot);
+            }
+            qsort(sorted, count, sizeof(ResultRow), compare_result_rows);
+            int first = 0;
+            while (orders[q].after != 0 && chunk_of(sorted[first].slot)->ids[sorted[first].slot % EXPENSE_CHUNK_SIZE] != orders[q].after) {
+                first++;
+            }
+            first += orders[q].after != 0;
+            errors += !output_open(&out, files[0]);
+            for (int k = first; k < count && k < first + orders[q].limit; k++) {
+                write_record(&out, FORMAT_TSV, chunk_of(sorted[k].slot), sorted[k].slot % EXPENSE_CHUNK_SIZE);
+            }
+            errors += !output_close(&out);
+            double t1 = now_seconds();
+            
+            rewind(files[1]);
+            QueryFilter filter = *filters[q];
+            double t2 = now_seconds();
+            errors += !output_open(&out, files[1]);
+            errors += !select_expenses(&filter, &orders[q], &out, FORMAT_TSV);
+            errors += !output_close(&out);
+            double t3 = now_seconds();
+            if (r == 0 || t1 - t0 < best[0]) best[0] = t1 - t0;
+            if (r == 0 || t3 - t2 < best[1]) best[1] = t3 - t2;
+        }
+        errors += !output_matches(files[0], files[1]);
+        printf("%-24s %14.3f %14.3f %8.0fx\n", names[q], best[0] * 1000, best[1] * 1000, best[0] / best[1]);
+    }
+    printf("\nerrors: %d\n", errors);
+    
+    fclose(files[0]);
+    fclose(files[1]);
+    free(sorted);
+    free_expenses();
+    return errors != 0;
+}
+
+// Times a report in dollars read from the rollups, each cell converted at
+// its month's rate, against one converting every record, and checks that
+// they agree to within a paisa a record. Then makes random adds, modifies
+// (some of only the currency) and deletes, checking the rollups and the
+// aggregates against scans as it goes and the report after loading again.
+int bench_currency(int rows) {
+    static const char *codes[] = {"USD", "EUR", "GBP"};
+    data_path = "expense-bench.dat";
+    journal_path = "expense-bench.log";
+    
+    // A rate for each currency on the first of every month the synthetic
+    // expenses fall in
+    char rate_path[FILENAME_MAX];
+    rate_file_path(rate_path, sizeof(rate_path));
+    FILE *file = fopen(rate_path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Cannot write %s\n", rate_path);
+        return 1;
+    }
+    unsigned int state = 12345;
+    for (int month = 2019 * 12; month < 2025 * 12; month++) {
+        for (int k = 0; k < 3; k++) {
+            long long rate = (100 + 20 * k) * (long long)RATE_SCALE + synthetic_random(&state) % (5 * RATE_SCALE);
+            fprintf(file, "%04d-%02d-01 %s %lld.%06lld\n", month / 12, month % 12 + 1, codes[k],
+                    rate / RATE_SCALE, rate % RATE_SCALE);
+        }
+    }
+    int errors = fclose(file) != 0 || !load_rates();
+    
+    // One expense in four is in a foreign currency
+    Expense expense;
+    for (int i = 0; i < rows; i++) {
+        generate_synthetic_expense(allocate_expense_id(), &state, &expense);
+        if (i % 4 == 0) strcpy(expense.currency, codes[i / 4 % 3]);
+        if (!append_expense(&expense)) {
+            fprintf(stderr, "Out of memory filling the store\n");
+            return 1;
+        }
+    }
+    int dollars = find_currency("USD");
+    
+    double t0 = now_seconds();
+    errors += !require_rollups();
+    double t1 = now_seconds();
+    errors += !require_aggregates() || !checkpoint_data();
+    
+    // Five years by month, for every category
+    int from = 2020 * 12, to = 2024 * 12 + 11;
+    double scan_seconds = 0;
+    errors += compare_currency_report(from, to, dollars, &scan_seconds);
+    const int reports = 100;
+    int lines = 0;
+    double t2 = now_seconds();
+    for (int r = 0; r < reports; r++) {
+        ReportRow *report;
+        lines = collect_report(from, to, 0, -1, dollars, &report);
+        if (lines >= 0) free(report);
+    }
+    double t3 = now_seconds();
+    errors += lines <= 0;
+    
+    const int operations = rows < 100000 ? rows : 100000;
+    int checks = 0;
+    double t4 = now_seconds();
+    for (int i = 0; i < operations && expense_count > 1; i++) {
+        int op = synthetic_random(&state) % 4;
+        int slot = synthetic_random(&state) % slot_count;
+        while (!slot_is_live(slot)) slot = synthetic_random(&state) % slot_count;
+        const char *code = synthetic_random(&state) % 2 == 0 ? "" : codes[synthetic_random(&state) % 3];
+        
+        if (op == 0) {
+            generate_synthetic_expense(allocate_expense_id(), &state, &expense);
+            strcpy(expense.currency, code);
+            append_expense(&expense);
+            journal_record(JOURNAL_ADD, &expense);
+        } else if (op < 3) {
+            read_expense(slot, &expense);
+            if (op == 1) generate_synthetic_expense(expense.id, &state, &expense);
+            strcpy(expense.currency, code);
+            write_expense(slot, &expense);
+            journal_record(JOURNAL_MODIFY, &expense);
+        } else {
+            read_expense(slot, &expense);
+            remove_expense_at(slot);
+            journal_record(JOURNAL_DELETE, &expense);
+        }
+        if (i % (operations / 20 + 1) == 0) {
+            errors += check_rollups() + check_aggregates(0);
+            checks++;
+        }
+    }
+    double t5 = now_seconds();
+    journal_commit();
+    
+    // Load again with the changes only in the journal, then after a checkpoint
+    int live = expense_count;
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 1) errors += !checkpoint_data();
+        journal_close();
+        free_expenses();
+        load_from_file();
+        errors += expense_count != live || !rollups_ready || check_rollups();
+        double unused = 0;
+        errors += compare_currency_report(from, to, find_currency("USD"), &unused);
+    }
+    
+    printf("rows: %d, currencies: %d, cells: %d\n", rows, currency_count, rollup_table_used);
+    printf("%-38s %12.3f ms\n", "rollups from a scan", (t1 - t0) * 1000);
+    printf("%-38s %12.3f ms\n", "5 years in USD, converting records", scan_seconds * 1000);
+    printf("%-38s %12.3f us (%d lines)\n", "5 years in USD, from rollups", (t3 - t2) * 1e6 / reports, lines);
+    printf("%-38s %12.3f ms (%d checks)\n", "changes with rollups kept", (t5 - t4) * 1000, checks);
+    printf("errors: %d\n", errors);
+    
+    journal_close();
+    free_expenses();
+    remove(data_path);
+    remove(journal_path);
+    remove(rate_path);
+    remove_rollup_file();
+    data_path = FILENAME;
+    journal_path = JOURNAL_FILENAME;
+    return errors != 0;
+}
+
+// Totals the months from..to by month and category in `currency` from a
+// scan converting every record, and counts the report lines read from the
+// rollups that differ by more than a paisa a record, which is as far apart
+// rounding each record and rounding each cell can take them. Adds the time
+// the scan took to *seconds.
+int compare_currency_report(int from, int to, int currency, double *seconds) {
+    size_t cells = (size_t)(to - from + 1) * category_count;
+    Money *totals = calloc(cells + 1, sizeof(Money));
+    int *counts = calloc(cells + 1, sizeof(int));
+    if (totals == NULL || counts == NULL) {
+        free(totals);
+        free(counts);
+        return 1;
+    }
+    
+    double start = now_seconds();
+    long long scanned = 0;
+    for (int c = 0; c < chunk_count; c++) {
+        ExpenseChunk *chunk = expense_chunks[c];
+        int rows = chunk_rows(c);
+        for (int j = 0; j < rows; j++) {
+            if (chunk->deleted[j]) continue;
+            int month = month_of_day(chunk->dates[j]);
+            if (month < from || month > to) continue;
+            size_t cell = (size_t)(month - from) * category_count + chunk->categories[j];
+            totals[cell] += convert_amount(chunk->amounts[j], chunk->currencies[j], currency, month);
+            counts[cell]++;
+            scanned++;
+        }
+    }
+    *seconds += now_seconds() - start;
+    
+    ReportRow *report;
+    int lines = collect_report(from, to, 0, -1, currency, &report);
+    int errors = lines < 0;
+    for (int k = 0; k < lines; k++) {
+        size_t cell = (size_t)(report[k].period - from) * category_count + report[k].category;
+        Money difference = report[k].total - totals[cell];
+        errors += report[k].count != counts[cell] || difference > report[k].count || -difference > report[k].count;
+        scanned -= report[k].count;
+    }
+    errors += scanned != 0;
+    if (lines >= 0) free(report);
+    free(totals);
+    free(counts);
+    return errors;
+}
+
+// Starts a server on a synthetic ledger and runs load-test clients against
+// it, each on a thread and a connection of its own: rounds of 1, 2, 4, ...
+// up to twice the processor count of clients sending reads with one add in
+// ten, then one client adding alone and next to clients exporting every
+// expense. Checks that the server holds every expense added, and that it
+// saves them when it stops.
+int bench_server(int rows) {
     #ifdef _WIN32
-        system("cls");
+    fprintf(stderr, "The server benchmark needs fork() and Unix domain sockets\n");
+    return 1;
     #else
-        system("clear");
+    data_path = "expense-bench.dat";
+    journal_path = "expense-bench.log";
+    Expense expense;
+    unsigned int state = 12345;
+    Money expected_total = 0;
+    for (int i = 0; i < rows; i++) {
+        generate_synthetic_expense(allocate_expense_id(), &state, &expense);
+        if (!append_expense(&expense)) {
+            fprintf(stderr, "Out of memory filling the store\n");
+            return 1;
+        }
+        expected_total += expense.amount;
+    }
+    int errors = !checkpoint_data();
+    journal_close();
+    free_expenses();
+    
+    // The server builds its indexes before it listens
+    double t0 = now_seconds();
+    fflush(stdout);
+    pid_t server = fork();
+    if (server == 0) exit(run_server());
+    int ready = 0;
+    while (server > 0 && !ready && waitpid(server, NULL, WNOHANG) == 0) {
+        int probe = connect_server();
+        if (probe >= 0) {
+            close(probe);
+            ready = 1;
+        } else {
+            struct timespec pause = {0, 10000000};
+            nanosleep(&pause, NULL);
+        }
+    }
+    double t1 = now_seconds();
+    if (!ready) {
+        fprintf(stderr, "The server did not start\n");
+        remove(data_path);
+        remove(journal_path);
+        remove_rollup_file();
+        data_path = FILENAME;
+        journal_path = JOURNAL_FILENAME;
+        return 1;
+    }
+    
+    int output = open("/dev/null", O_WRONLY);
+    int most = 2 * scan_thread_count();
+    if (most > 64) most = 64;
+    LoadClient clients[64];
+    long long added = 0;
+    double *reads, *adds;
+    printf("rows: %d, server ready in %.3f s\n", rows, t1 - t0);
+    printf("%-8s %12s %12s %12s %12s %12s\n", "clients", "requests/s", "read p50 ms", "read p99 ms", "adds/s", "add p99 ms");
+    for (int count = 1; count <= most; count *= 2) {
+        for (int k = 0; k < count; k++) {
+            clients[k] = (LoadClient){LOAD_MIXED, 7919 * (k + 1) + count, 0, output, NULL, 0, 0, NULL, 0, 0, 0, 0};
+        }
+        double seconds = run_load_test(clients, count);
+        int read_count = merge_latencies(clients, count, 0, &reads);
+        int add_count = merge_latencies(clients, count, 1, &adds);
+        printf("%-8d %12.0f %12.3f %12.3f %12.0f %12.3f\n", count, (read_count + add_count) / seconds,
+               percentile(reads, read_count, 50) * 1000, percentile(reads, read_count, 99) * 1000,
+               add_count / seconds, percentile(adds, add_count, 99) * 1000);
+        for (int k = 0; k < count; k++) {
+            added += clients[k].add_count;
+            expected_total += clients[k].added;
+            errors += clients[k].failures;
+            free(clients[k].reads);
+            free(clients[k].adds);
+        }
+        free(reads);
+        free(adds);
+    }
+    
+    // Adds alone, then next to an export of every expense per processor
+    int exporters = scan_thread_count() < 63 ? scan_thread_count() : 63;
+    for (int round = 0; round < 2; round++) {
+        int count = 1 + round * exporters;
+        for (int k = 0; k < count; k++) {
+            clients[k] = (LoadClient){k == 0 ? LOAD_ADDS : LOAD_EXPORTS, 104729 * (k + 1) + round, 0, output,
+                                      NULL, 0, 0, NULL, 0, 0, 0, 0};
+        }
+        double seconds = run_load_test(clients, count);
+        int read_count = merge_latencies(clients, count, 0, &reads);
+        int add_count = merge_latencies(clients, count, 1, &adds);
+        printf("%-38s %8.3f ms p50 %8.3f ms p99 %8.0f/s\n", round == 0 ? "adds alone" : "adds during exports",
+               percentile(adds, add_count, 50) * 1000, percentile(adds, add_count, 99) * 1000, add_count / seconds);
+        if (round == 1) {
+            printf("%-38s %8.3f ms p50 %8d done\n", "exports of every expense", percentile(reads, read_count, 50) * 1000, read_count);
+        }
+        for (int k = 0; k < count; k++) {
+            added += clients[k].add_count;
+            expected_total += clients[k].added;
+            errors += clients[k].failures;
+            free(clients[k].reads);
+            free(clients[k].adds);
+        }
+        free(reads);
+        free(adds);
+    }
+    
+    // Every add is in the server's store, and in what it saves on stopping
+    FILE *totals = tmpfile();
+    int connection = connect_server();
+    char *total_args[] = {"total"};
+    int count = -1;
+    char total_text[MONEY_TEXT_SIZE] = "", expected_text[MONEY_TEXT_SIZE];
+    format_money(expected_total, expected_text);
+    if (totals != NULL && connection >= 0 && send_request(connection, 1, total_args, fileno(totals)) == 0) {
+        rewind(totals);
+        if (fscanf(totals, "count\t%d\ntotal\t%23s", &count, total_text) != 2) count = -1;
+    }
+    errors += count != rows + added || strcmp(total_text, expected_text) != 0;
+    if (totals != NULL) fclose(totals);
+    if (connection >= 0) close(connection);
+    close(output);
+    
+    int status;
+    kill(server, SIGTERM);
+    errors += waitpid(server, &status, 0) != server || !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    load_from_file();
+    errors += expense_count != rows + added || !require_aggregates() || amount_total != expected_total;
+    printf("expenses added: %lld\n", added);
+    printf("errors: %d\n", errors);
+    
+    journal_close();
+    free_expenses();
+    remove(data_path);
+    remove(journal_path);
+    remove_rollup_file();
+    data_path = FILENAME;
+    journal_path = JOURNAL_FILENAME;
+    return errors != 0;
     #endif
 }
 
-void pause_screen() {
-    printf("\n%sPress Enter to continue...%s", COLOR_CYAN, COLOR_RESET);
-    clear_input_buffer();
-    getchar();
+#ifndef _WIN32
+// Runs the clients for LOAD_TEST_SECONDS, counting a client whose thread
+// could not be started as a failure. Returns the seconds from the first
+// start to the last finish.
+double run_load_test(LoadClient *clients, int count) {
+    pthread_t threads[64];
+    double start = now_seconds();
+    int started = 0;
+    for (; started < count; started++) {
+        clients[started].until = start + LOAD_TEST_SECONDS;
+        if (pthread_create(&threads[started], NULL, run_load_client, &clients[started]) != 0) break;
+    }
+    for (int k = 0; k < started; k++) pthread_join(threads[k], NULL);
+    for (int k = started; k < count; k++) clients[k].failures++;
+    return now_seconds() - start;
 }
 
-void enable_colors() {
+// A load-test client: sends requests until its time is up, timing each.
+// A mixed client lists a day, totals a year to date, reports a year by
+// month, takes the statistics of a category or searches for a word, and
+// one time in ten adds an expense.
+void *run_load_client(void *context) {
+    LoadClient *client = context;
+    int server = connect_server();
+    if (server < 0) {
+        client->failures++;
+        return NULL;
+    }
+    
+    Expense expense;
+    char amount[MONEY_TEXT_SIZE], from[11], to[11], word[MAX_DESCRIPTION_LENGTH];
+    while (now_seconds() < client->until) {
+        char *args[8];
+        int argc = 0;
+        unsigned int pick = synthetic_random(&client->state) % 10;
+        generate_synthetic_expense(0, &client->state, &expense);
+        int add = client->mode == LOAD_ADDS || (client->mode == LOAD_MIXED && pick == 0);
+        if (add) {
+            args[argc++] = "add";
+            args[argc++] = expense.date;
+            args[argc++] = format_money(expense.amount, amount);
+            args[argc++] = expense.category;
+            args[argc++] = expense.description;
+        } else if (client->mode == LOAD_EXPORTS) {
+            args[argc++] = "export";
+        } else if (pick <= 3) {
+            char *list[] = {"query", "--from", expense.date, "--to", expense.date, "--limit", "20"};
+            memcpy(args, list, sizeof(list));
+            argc = 7;
+        } else if (pick <= 5) {
+            snprintf(from, sizeof(from), "%.4s-01-01", expense.date);
+            char *list[] = {"total", "--from", from, "--to", expense.date};
+            memcpy(args, list, sizeof(list));
+            argc = 5;
+        } else if (pick <= 7) {
+            snprintf(from, sizeof(from), "%.4s-01", expense.date);
+            snprintf(to, sizeof(to), "%.4s-12", expense.date);
+            char *list[] = {"report", "--from", from, "--to", to};
+            memcpy(args, list, sizeof(list));
+            argc = 5;
+        } else if (pick == 8) {
+            char *list[] = {"stats", "--category", expense.category};
+            memcpy(args, list, sizeof(list));
+            argc = 3;
+        } else {
+            snprintf(word, sizeof(word), "%.*s", (int)strcspn(expense.description, " "), expense.description);
+            char *list[] = {"query", "--match", word, "--limit", "10"};
+            memcpy(args, list, sizeof(list));
+            argc = 5;
+        }
+        
+        double start = now_seconds();
+        int status = send_request(server, argc, args, client->output);
+        double seconds = now_seconds() - start;
+        if (status != 0) {
+            client->failures++;
+        } else if (add) {
+            client->added += expense.amount;
+            client->failures += !add_latency(&client->adds, &client->add_count, &client->add_capacity, seconds);
+        } else {
+            client->failures += !add_latency(&client->reads, &client->read_count, &client->read_capacity, seconds);
+        }
+    }
+    close(server);
+    return NULL;
+}
+
+// Appends a latency to a growing array. Returns 0 if memory is exhausted.
+int add_latency(double **values, int *count, int *capacity, double seconds) {
+    if (*count == *capacity) {
+        int new_capacity = *capacity == 0 ? 1024 : *capacity * 2;
+        double *grown = realloc(*values, new_capacity * sizeof(double));
+        if (grown == NULL) return 0;
+        *values = grown;
+        *capacity = new_capacity;
+    }
+    (*values)[(*count)++] = seconds;
+    return 1;
+}
+
+// Gathers the clients' read (or add) latencies into one sorted array.
+// Returns how many there are, 0 if memory is exhausted.
+int merge_latencies(LoadClient *clients, int count, int adds, double **values) {
+    int total = 0;
+    for (int k = 0; k < count; k++) total += adds ? clients[k].add_count : clients[k].read_count;
+    *values = malloc((total + 1) * sizeof(double));
+    if (*values == NULL) return 0;
+    
+    int used = 0;
+    for (int k = 0; k < count; k++) {
+        int n = adds ? clients[k].add_count : clients[k].read_count;
+        if (n > 0) memcpy(*values + used, adds ? clients[k].adds : clients[k].reads, n * sizeof(double));
+        used += n;
+    }
+    qsort(*values, used, sizeof(double), compare_seconds);
+    return used;
+}
+
+// The latency within which `percent` percent of the requests finished
+double percentile(const double *sorted, int count, int percent) {
+    if (count == 0) return 0;
+    int rank = (int)(((long long)count * percent + 99) / 100);
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+int compare_seconds(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+#endif
+
+// Times the everyday operations on a synthetic ledger of a chosen shape:
+// generating, saving, loading and indexing it, adds and deletes journaled as
+// commands make them, viewing every category, one-month range queries, text
+// and word searches and the statistics. Prints a line per operation with the
+// ledger's shape, as tab-separated values under a header or as JSON lines,
+// so that runs can be compared across builds and commits.
+int bench_suite(int rows, int argc, char *argv[]) {
+    LedgerShape shape = {12, 1, 2019, 6, 0, 12345, NULL};
+    int format = FORMAT_TSV;
+    for (int k = 0; k < argc; k += 2) {
+        const char *option = argv[k], *value = k + 1 < argc ? argv[k + 1] : "";
+        int ok = isdigit((unsigned char)value[0]);
+        if (strcmp(option, "--categories") == 0) {
+            shape.categories = atoi(value);
+            ok = ok && shape.categories >= 1 && shape.categories <= 1000;
+        } else if (strcmp(option, "--skew") == 0) {
+            shape.skew = atoi(value);
+            ok = ok && shape.skew <= 4;
+        } else if (strcmp(option, "--from") == 0) {
+            shape.first_year = atoi(value);
+            ok = ok && shape.first_year >= 1;
+        } else if (strcmp(option, "--years") == 0) {
+            shape.years = atoi(value);
+            ok = ok && shape.years >= 1;
+        } else if (strcmp(option, "--seed") == 0) {
+            shape.seed = (unsigned int)strtoul(value, NULL, 10);
+            ok = ok && shape.seed != 0;
+        } else if (strcmp(option, "--dates") == 0) {
+            shape.recent = strcmp(value, "recent") == 0;
+            ok = shape.recent || strcmp(value, "uniform") == 0;
+        } else if (strcmp(option, "--format") == 0) {
+            format = strcmp(value, "tsv") == 0 ? FORMAT_TSV : format_by_name(value) == FORMAT_JSON_LINES ? FORMAT_JSON_LINES : 0;
+            ok = format != 0;
+        } else {
+            ok = 0;
+        }
+        if (!ok || shape.first_year + shape.years - 1 > 9999) {
+            fprintf(stderr, "Usage: expense --bench suite <rows> [--categories N] [--skew 0-4] [--from YEAR] [--years N]\n"
+                            "                              [--dates uniform|recent] [--seed N] [--format tsv|jsonl]\n");
+            return 1;
+        }
+    }
+    
+    // Category shares fall off as 1 / rank^skew
+    shape.shares = malloc(shape.categories * sizeof(double));
     #ifdef _WIN32
-    // Enable ANSI color codes in Windows 10+
-    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-    DWORD mode;
-    if (GetConsoleMode(hConsole, &mode)) {
-        SetConsoleMode(hConsole, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+    FILE *sink = fopen("NUL", "wb");
+    #else
+    FILE *sink = fopen("/dev/null", "wb");
+    #endif
+    if (shape.shares == NULL || sink == NULL) {
+        fprintf(stderr, "Cannot set up the benchmark\n");
+        free(shape.shares);
+        if (sink != NULL) fclose(sink);
+        return 1;
+    }
+    double sum = 0;
+    for (int c = 0; c < shape.categories; c++) {
+        double weight = 1;
+        for (int p = 0; p < shape.skew; p++) weight /= c + 1;
+        sum += weight;
+        shape.shares[c] = sum;
+    }
+    for (int c = 0; c < shape.categories; c++) shape.shares[c] /= sum;
+    shape.shares[shape.categories - 1] = 1;
+    
+    data_path = "expense-bench.dat";
+    journal_path = "expense-bench.log";
+    batch_mode = 1;  // keeps messages about loading and saving out of the results
+    if (format == FORMAT_TSV) {
+        printf("rows\tcategories\tskew\tfirst_year\tyears\tdates\tseed\toperation\tcount\tseconds\tus_per_op\tper_second\n");
+    }
+    
+    int errors = run_suite(&shape, rows, format, sink);
+    if (errors < 0) {
+        fprintf(stderr, "Out of memory filling the store\n");
+    } else if (errors > 0) {
+        fprintf(stderr, "errors: %d\n", errors);
     }
+    journal_close();
+    free_expenses();
+    remove(data_path);
+    remove(journal_path);
+    remove_rollup_file();
+    fclose(sink);
+    free(shape.shares);
+    batch_mode = 0;
+    data_path = FILENAME;
+    journal_path = JOURNAL_FILENAME;
+    return errors != 0;
+}
+
+// Runs the operations of the benchmark suite on a ledger of the given shape
+// and prints their timings. Returns the number of errors, or -1 if the store
+// could not be filled.
+int run_suite(const LedgerShape *shape, int rows, int format, FILE *sink) {
+    int errors = 0;
+    Expense expense;
+    unsigned int state = shape->seed;
+    double start = now_seconds();
+    for (int i = 0; i < rows; i++) {
+        generate_shaped_expense(shape, allocate_expense_id(), &state, &expense);
+        if (!append_expense(&expense)) return -1;
+    }
+    print_suite_result(shape, rows, format, "generate", rows, now_seconds() - start);
+    
+    start = now_seconds();
+    errors += !checkpoint_data();
+    print_suite_result(shape, rows, format, "save", 1, now_seconds() - start);
+    journal_close();
+    free_expenses();
+    
+    start = now_seconds();
+    load_from_file();
+    print_suite_result(shape, rows, format, "load", 1, now_seconds() - start);
+    errors += expense_count != rows;
+    start = now_seconds();
+    errors += !require_indexes();
+    print_suite_result(shape, rows, format, "index", 1, now_seconds() - start);
+    
+    // Adds, then deletes by id, synced once per batch of commands
+    int changes = rows < 100000 ? rows : 100000;
+    start = now_seconds();
+    for (int i = 0; i < changes; i++) {
+        generate_shaped_expense(shape, allocate_expense_id(), &state, &expense);
+        errors += !append_expense(&expense);
+        journal_record(JOURNAL_ADD, &expense);
+        if ((i + 1) % BATCH_COMMIT_COMMANDS == 0) journal_commit();
+    }
+    errors += !journal_commit();
+    print_suite_result(shape, rows, format, "add", changes, now_seconds() - start);
+    
+    start = now_seconds();
+    for (int i = 0; i < changes && expense_count > 0; i++) {
+        int slot = synthetic_random(&state) % slot_count;
+        while (!slot_is_live(slot)) slot = synthetic_random(&state) % slot_count;
+        read_expense(slot, &expense);
+        slot = find_expense_by_id(expense.id);
+        errors += slot < 0;
+        if (slot < 0) continue;
+        remove_expense_at(slot);
+        journal_record(JOURNAL_DELETE, &expense);
+        if ((i + 1) % BATCH_COMMIT_COMMANDS == 0) journal_commit();
+    }
+    errors += !journal_commit();
+    print_suite_result(shape, rows, format, "delete", changes, now_seconds() - start);
+    
+    // Every category, then one-month ranges, as `query` lists them. Queries
+    // pick their category, month and word from a random expense, so busy
+    // categories and months come up as often as they would in use.
+    QueryFilter all = {FIRST_INDEXED_DAY, LAST_INDEXED_DAY, 0, NULL, -1, NULL, NULL, {"", 0}};
+    start = now_seconds();
+    for (int c = 0; c < category_count; c++) {
+        QueryFilter filter = all;
+        filter.category_name = category_names[c];
+        errors += !suite_query(&filter, sink);
+    }
+    print_suite_result(shape, rows, format, "category-view", category_count, now_seconds() - start);
+    
+    const int queries = 100;
+    start = now_seconds();
+    for (int q = 0; q < queries; q++) {
+        QueryFilter filter = all;
+        generate_shaped_expense(shape, 0, &state, &expense);
+        memcpy(expense.date + 8, "01", 2);
+        parse_date(expense.date, &filter.from);
+        filter.to = filter.from + 30;
+        filter.by_date = 1;
+        errors += !suite_query(&filter, sink);
+    }
+    print_suite_result(shape, rows, format, "range-query", queries, now_seconds() - start);
+    
+    char word[MAX_DESCRIPTION_LENGTH];
+    start = now_seconds();
+    for (int q = 0; q < queries; q++) {
+        QueryFilter filter = all;
+        generate_shaped_expense(shape, 0, &state, &expense);
+        snprintf(word, sizeof(word), "%.*s", (int)strcspn(expense.description, " "), expense.description);
+        filter.search = word;
+        errors += !suite_query(&filter, sink);
+    }
+    print_suite_result(shape, rows, format, "search", queries, now_seconds() - start);
+    
+    start = now_seconds();
+    errors += !require_text_index();
+    print_suite_result(shape, rows, format, "text-index", 1, now_seconds() - start);
+    start = now_seconds();
+    for (int q = 0; q < queries; q++) {
+        QueryFilter filter = all;
+        generate_shaped_expense(shape, 0, &state, &expense);
+        snprintf(word, sizeof(word), "%.*s", (int)strcspn(expense.description, " "), expense.description);
+        filter.match = word;
+        errors += !suite_query(&filter, sink);
+    }
+    print_suite_result(shape, rows, format, "match", queries, now_seconds() - start);
+    
+    // The dashboard's figures from a full scan, then a category's from a
+    // filtered one, as `stats --category` takes them
+    const int rebuilds = 10;
+    start = now_seconds();
+    for (int r = 0; r < rebuilds; r++) {
+        aggregates_ready = 0;
+        errors += !require_aggregates();
+    }
+    print_suite_result(shape, rows, format, "stats", rebuilds, now_seconds() - start);
+    
+    start = now_seconds();
+    for (int q = 0; q < queries; q++) {
+        QueryFilter filter = all;
+        ScanTotals totals = {0, 0, -1, -1, NULL};
+        generate_shaped_expense(shape, 0, &state, &expense);
+        filter.category = find_category(expense.category);
+        errors += filter.category >= 0 && !scan_totals(&filter, &totals);
+    }
+    print_suite_result(shape, rows, format, "category-stats", queries, now_seconds() - start);
+    return errors;
+}
+
+
+// Runs a query as `query` would, writing the rows to `sink`. Returns 0 if
+// it failed.
+int suite_query(QueryFilter *filter, FILE *sink) {
+    OutputBuffer out;
+    if (!output_open(&out, sink)) return 0;
+    int ok = select_expenses(filter, NULL, &out, FORMAT_TSV);
+    return output_close(&out) && ok;
+}
+
+// Prints how long one operation of the suite took, with the ledger's shape
+void print_suite_result(const LedgerShape *shape, int rows, int format, const char *operation, int count, double seconds) {
+    const char *dates = shape->recent ? "recent" : "uniform";
+    double per_operation = count > 0 ? seconds * 1e6 / count : 0;
+    double per_second = seconds > 0 ? count / seconds : 0;
+    if (format == FORMAT_JSON_LINES) {
+        printf("{\"rows\":%d,\"categories\":%d,\"skew\":%d,\"first_year\":%d,\"years\":%d,\"dates\":\"%s\",\"seed\":%u,"
+               "\"operation\":\"%s\",\"count\":%d,\"seconds\":%.6f,\"us_per_op\":%.3f,\"per_second\":%.1f}\n",
+               rows, shape->categories, shape->skew, shape->first_year, shape->years, dates, shape->seed,
+               operation, count, seconds, per_operation, per_second);
+    } else {
+        printf("%d\t%d\t%d\t%d\t%d\t%s\t%u\t%s\t%d\t%.6f\t%.3f\t%.1f\n",
+               rows, shape->categories, shape->skew, shape->first_year, shape->years, dates, shape->seed,
+               operation, count, seconds, per_operation, per_second);
+    }
+}
+
+// Compares what was last written to two files from their start
+int output_matches(FILE *a, FILE *b) {
+    long length = ftell(a);
+    if (length != ftell(b)) return 0;
+    rewind(a);
+    rewind(b);
+    for (long k = 0; k < length; k++) {
+        if (fgetc(a) != fgetc(b)) return 0;
+    }
+    return 1;
+}
+
+double now_seconds() {
+    #ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / frequency.QuadPart;
+    #else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
     #endif
 }
 
+// Fills in a plausible random expense dated between 2019 and 2024
+void generate_synthetic_expense(int id, unsigned int *state, Expense *expense) {
+    static const char *words[] = {
+        "weekly", "shopping", "bus", "fare", "concert", "tickets", "monthly", "rent",
+        "electric", "bill", "dinner", "with", "friends", "pharmacy", "books", "flight",
+        "hotel", "coffee", "lunch", "taxi", "internet", "phone", "gym", "movie"
+    };
+    
+    unsigned int year = 2019 + synthetic_random(state) % 6;
+    unsigned int month = 1 + synthetic_random(state) % 12;
+    unsigned int day = 1 + synthetic_random(state) % 28;
+    
+    expense->id = id;
+    snprintf(expense->date, sizeof(expense->date), "%04u-%02u-%02u", year % 10000, month, day);
+    expense->amount = 1 + synthetic_random(state) % 500000;
+    expense->currency[0] = '\0';
+    strcpy(expense->category, synthetic_categories[synthetic_random(state) % SYNTHETIC_CATEGORY_COUNT]);
+    
+    int length = 0;
+    int word_count = 2 + synthetic_random(state) % 4;
+    for (int w = 0; w < word_count; w++) {
+        const char *word = words[synthetic_random(state) % (sizeof(words) / sizeof(words[0]))];
+        length += snprintf(expense->description + length, MAX_DESCRIPTION_LENGTH - length,
+                           w == 0 ? "%s" : " %s", word);
+    }
+}
+
+// Fills in a random expense of a ledger of the given shape, described as
+// generate_synthetic_expense() describes them. Amounts spread evenly over
+// each power of ten from 1.00 to 9,990.00, so small expenses are as common
+// as they are in a real ledger.
+void generate_shaped_expense(const LedgerShape *shape, int id, unsigned int *state, Expense *expense) {
+    generate_synthetic_expense(id, state, expense);
+    
+    double pick = synthetic_random(state) / 4294967296.0;
+    int low = 0, high = shape->categories - 1;
+    while (low < high) {
+        int middle = (low + high) / 2;
+        if (shape->shares[middle] > pick) {
+            high = middle;
+        } else {
+            low = middle + 1;
+        }
+    }
+    if (low < SYNTHETIC_CATEGORY_COUNT) {
+        strcpy(expense->category, synthetic_categories[low]);
+    } else {
+        snprintf(expense->category, sizeof(expense->category), "Category %d", low + 1);
+    }
+    
+    // The later of two days is as likely as its distance from the start
+    int first = days_from_civil(shape->first_year, 1, 1);
+    unsigned int span = days_from_civil(shape->first_year + shape->years, 1, 1) - first;
+    unsigned int offset = synthetic_random(state) % span;
+    if (shape->recent) {
+        unsigned int other = synthetic_random(state) % span;
+        if (other > offset) offset = other;
+    }
+    format_date(first + (int)offset, expense->date);
+    
+    Money amount = 100 + synthetic_random(state) % 900;
+    for (unsigned int power = synthetic_random(state) % 4; power > 0; power--) amount *= 10;
+    expense->amount = amount;
+}
+
+// xorshift32; deterministic so benchmark runs are comparable
+unsigned int synthetic_random(unsigned int *state) {
+    unsigned int x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
 // Display functions
 void print_success(const char *text) {
+    if (batch_mode) return;
     printf("%s✓ %s%s\n", COLOR_GREEN, text, COLOR_RESET);
 }
 
 void print_error(const char *text) {
+    if (batch_mode) {
+        print_command_message("error", text);
+        return;
+    }
     printf("%s✗ %s%s\n", COLOR_RED, text, COLOR_RESET);
 }
 
 void print_warning(const char *text) {
+    if (batch_mode) {
+        print_command_message("warning", text);
+        return;
+    }
     printf("%s⚠ %s%s\n", COLOR_YELLOW, text, COLOR_RESET);
 }
 
 void print_info(const char *text) {
+    if (batch_mode) return;
     printf("%sℹ %s%s\n", COLOR_CYAN, text, COLOR_RESET);
 }
+
+// Prints a message from command mode as `expense: [line N: ]kind: text`
+void print_command_message(const char *kind, const char *text) {
+    if (batch_line > 0) {
+        fprintf(stderr, "expense: line %d: %s: %s\n", batch_line, kind, text);
+    } else {
+        fprintf(stderr, "expense: %s: %s\n", kind, text);
+    }
+}